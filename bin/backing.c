@@ -0,0 +1,192 @@
+#define _GNU_SOURCE /* for MAP_HUGETLB */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "backing.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define SIZE_2M (2UL << 20)
+#define SIZE_1G (1UL << 30)
+
+static const char *backing_names[NUM_BACKINGS] = {
+	[BACKING_ANON]       = "anon-4k",
+	[BACKING_THP]        = "thp",
+	[BACKING_HUGETLB_2M] = "hugetlb-2m",
+	[BACKING_HUGETLB_1G] = "hugetlb-1g",
+	[BACKING_SHM]        = "shm",
+	[BACKING_FILE]       = "file",
+};
+
+int parse_backing(const char *name, enum backing_mode *mode,
+		  const char **path)
+{
+	int i;
+
+	*path = NULL;
+	if (!strncmp(name, "file:", 5) && name[5]) {
+		*mode = BACKING_FILE;
+		*path = name + 5;
+		return 0;
+	}
+	for (i = 0; i < NUM_BACKINGS; i++)
+		if (!strcmp(name, backing_names[i])) {
+			*mode = i;
+			return 0;
+		}
+	return -1;
+}
+
+const char *backing_mode_name(enum backing_mode mode)
+{
+	return backing_names[mode];
+}
+
+static size_t mode_page_size(enum backing_mode mode)
+{
+	switch (mode) {
+	case BACKING_THP:
+	case BACKING_HUGETLB_2M:
+		return SIZE_2M;
+	case BACKING_HUGETLB_1G:
+		return SIZE_1G;
+	default:
+		return getpagesize();
+	}
+}
+
+/* Map len bytes aligned to align: over-allocate, then trim. */
+static void* map_aligned(size_t len, size_t align)
+{
+	char *area, *start;
+
+	area = mmap(NULL, len + align, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		return MAP_FAILED;
+
+	start = (char *) (((uintptr_t) area + align - 1) & ~(align - 1));
+	if (start > area)
+		munmap(area, start - area);
+	munmap(start + len, area + align - start);
+	return start;
+}
+
+/* shared mapping of fd, which is closed */
+static void* map_shared_fd(int fd, size_t len)
+{
+	void *mem = MAP_FAILED;
+	int err;
+
+	if (ftruncate(fd, len) == 0)
+		mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+	err = errno;
+	close(fd);
+	errno = err;
+	return mem;
+}
+
+static int open_backing_file(const char *path)
+{
+	char tmpl[256];
+	const char *dir;
+	int fd;
+
+	if (path)
+		return open(path, O_RDWR | O_CREAT, 0600);
+
+	dir = getenv("TMPDIR");
+	snprintf(tmpl, sizeof(tmpl), "%s/cpmd-XXXXXX", dir ? dir : "/tmp");
+	fd = mkstemp(tmpl);
+	if (fd >= 0)
+		/* gone as soon as it is unmapped */
+		unlink(tmpl);
+	return fd;
+}
+
+static int open_shm(void)
+{
+	char name[64];
+	int fd;
+
+	snprintf(name, sizeof(name), "/cpmd-%d", (int) getpid());
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0)
+		shm_unlink(name);
+	return fd;
+}
+
+int backing_map(struct backing *backing, enum backing_mode mode,
+		size_t len, const char *path)
+{
+	size_t page_size = mode_page_size(mode);
+	void *mem = MAP_FAILED;
+	int fd;
+
+	len = (len + page_size - 1) & ~(page_size - 1);
+
+	switch (mode) {
+	case BACKING_ANON:
+		mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem != MAP_FAILED)
+			madvise(mem, len, MADV_NOHUGEPAGE);
+		break;
+	case BACKING_THP:
+		mem = map_aligned(len, page_size);
+		if (mem != MAP_FAILED && madvise(mem, len, MADV_HUGEPAGE)) {
+			munmap(mem, len);
+			mem = MAP_FAILED;
+		}
+		break;
+	case BACKING_HUGETLB_2M:
+		mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			   (21 << MAP_HUGE_SHIFT), -1, 0);
+		break;
+	case BACKING_HUGETLB_1G:
+		mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			   (30 << MAP_HUGE_SHIFT), -1, 0);
+		break;
+	case BACKING_SHM:
+		fd = open_shm();
+		if (fd >= 0)
+			mem = map_shared_fd(fd, len);
+		break;
+	case BACKING_FILE:
+		fd = open_backing_file(path);
+		if (fd >= 0)
+			mem = map_shared_fd(fd, len);
+		break;
+	default:
+		errno = EINVAL;
+		break;
+	}
+
+	if (mem == MAP_FAILED)
+		return -1;
+
+	backing->mode = mode;
+	backing->base = mem;
+	backing->len = len;
+	backing->page_size = page_size;
+	return 0;
+}
+
+void backing_unmap(struct backing *backing)
+{
+	if (backing->base)
+		munmap(backing->base, backing->len);
+	backing->base = NULL;
+}
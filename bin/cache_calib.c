@@ -0,0 +1,443 @@
+/*
+ * Cache hierarchy calibration.
+ *
+ * Measures the load latency (pointer chasing) and read bandwidth of
+ * working sets of growing size with the touch kernels of cache_cost,
+ * finds the knees of the latency curve, where a cache level overflows,
+ * compares them with the cache sizes in sysfs, and proposes a WSS grid
+ * for cache_cost that is dense around the knees, where CPMD changes.
+ */
+#define _GNU_SOURCE /* for sched_setaffinity */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "backing.h"
+#include "topology.h"
+#include "touch.h"
+#include "tsc.h"
+
+#define MAX_LEVEL 4
+#define MAX_POINTS 512
+/* smallest working set, in KB */
+#define MIN_WSS 1
+/* default largest working set, in KB, unless the LLC asks for more */
+#define DEFAULT_MAX_WSS (256 * 1024)
+/* cache lines traversed per timed measurement (at least one pass) */
+#define LINES_PER_MEASUREMENT (1 << 20)
+/* the minimum of this many measurements counts */
+#define REPETITIONS 5
+
+/* A step up of the latency curve that is steeper than RISE_STEP
+ * (relative, per octave) is part of a transition; a transition that
+ * raises the latency by more than RISE_KNEE in total marks a knee.
+ * Where the slope of a transition drops to less than VALLEY of its
+ * peaks on either side (in log terms) between two peaks, it is split:
+ * one cache level overflows after the other.
+ */
+#define RISE_STEP 0.15
+#define RISE_KNEE 0.25
+#define VALLEY 0.5
+
+struct point {
+	int wss;		/* KB */
+	double ns_per_load;	/* dependent loads */
+	double mbps;		/* sequential reads */
+};
+
+struct knee {
+	int first;		/* last point before the transition */
+	int mid;		/* halfway up (geometric mean latency) */
+	int last;		/* first point after it */
+	double rise;		/* latency after / before */
+};
+
+static struct tsc_calibration tsc;
+/* keeps the loads of the kernels */
+static volatile int sink;
+
+static void die(char *error)
+{
+	perror(error);
+	exit(1);
+}
+
+/* Minimum cycles per cache line of kernel on layout. */
+static double time_kernel(touch_kernel_t kernel, struct access_layout *layout)
+{
+	unsigned long passes = LINES_PER_MEASUREMENT / layout->num_lines;
+	uint64_t start, cycles, best = 0;
+	unsigned long i;
+	int r, sum = 0;
+
+	if (!passes)
+		passes = 1;
+	/* warm up */
+	for (i = 0; i < passes; i++)
+		sum += kernel(layout, 0);
+
+	for (r = 0; r < REPETITIONS; r++) {
+		start = tsc_begin();
+		for (i = 0; i < passes; i++)
+			sum += kernel(layout, 0);
+		cycles = tsc_cycles(&tsc, start, tsc_end());
+		if (!r || cycles < best)
+			best = cycles;
+	}
+	sink += sum;
+	return (double) best / (passes * layout->num_lines);
+}
+
+static void measure(struct point *p, int *mem, touch_kernel_t stream)
+{
+	struct access_layout layout;
+	double cycles;
+
+	memset(&layout, 0, sizeof(layout));
+	if (build_layout(&layout, PATTERN_CHASE, 0, mem, p->wss))
+		die("out of memory");
+	cycles = time_kernel(select_touch_kernel(PATTERN_CHASE, 0), &layout);
+	p->ns_per_load = cycles * 1000.0 / tsc.mhz;
+
+	if (build_layout(&layout, PATTERN_SEQ, 0, mem, p->wss))
+		die("out of memory");
+	cycles = time_kernel(stream, &layout);
+	/* bytes per microsecond */
+	p->mbps = CACHE_LINE_SIZE * tsc.mhz / cycles;
+	free_layout(&layout);
+}
+
+/* Add the transition from point first to point last if it is large
+ * enough.
+ */
+static int add_knee(double *lat, int first, int last, struct knee *knee)
+{
+	double half = sqrt(lat[first] * lat[last]);
+	int i;
+
+	if (lat[last] <= lat[first] * (1 + RISE_KNEE))
+		return 0;
+	knee->first = first;
+	knee->last = last;
+	knee->rise = lat[last] / lat[first];
+	for (i = first; i < last && lat[i] < half; i++)
+		;
+	knee->mid = i;
+	return 1;
+}
+
+/* Transitions of the latency curve that are large enough. */
+static int find_knees(struct point *points, int num, int steps,
+		      struct knee *knees)
+{
+	double lat[MAX_POINTS], slope[MAX_POINTS], a, b, c;
+	double rise = log(1 + RISE_STEP) / steps;
+	int i, j, start, end, peak, valley, count = 0;
+
+	/* median of three against outliers */
+	for (i = 0; i < num; i++) {
+		a = points[i > 0 ? i - 1 : i].ns_per_load;
+		b = points[i].ns_per_load;
+		c = points[i < num - 1 ? i + 1 : i].ns_per_load;
+		lat[i] = a > b ? (b > c ? b : (a > c ? c : a)) :
+			(a > c ? a : (b > c ? c : b));
+	}
+
+	/* log slope of the step from point i to i + 1 */
+	for (i = 0; i < num - 1; i++)
+		slope[i] = log(lat[i + 1] / lat[i]);
+
+	for (i = 0; i < num - 1; i++) {
+		if (slope[i] <= rise)
+			continue;
+		start = i;
+		while (i < num - 1 && slope[i] > rise)
+			i++;
+		end = i;
+
+		/* Split the steps start .. end - 1 at deep valleys of the
+		 * slope: peak is the steepest step since start, valley the
+		 * flattest since peak.
+		 */
+		peak = start;
+		valley = -1;
+		for (j = start + 1; j < end; j++) {
+			if (valley >= 0 && slope[j] > slope[valley] &&
+			    slope[valley] < VALLEY * slope[peak] &&
+			    slope[valley] < VALLEY * slope[j]) {
+				/* the flat step belongs to neither */
+				count += add_knee(lat, start, valley,
+						  &knees[count]);
+				start = valley + 1;
+				peak = j;
+				valley = -1;
+			} else if (slope[j] >= slope[peak]) {
+				peak = j;
+				valley = -1;
+			} else if (valley < 0 || slope[j] < slope[valley]) {
+				valley = j;
+			}
+		}
+		count += add_knee(lat, start, end, &knees[count]);
+	}
+	return count;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/* Powers of two up to max_wss, plus 2 * dense + 1 points spaced
+ * 1/steps of an octave around each knee. Returns the number of sizes.
+ */
+static int make_grid(int *grid, int max_points, int max_wss,
+		     struct point *points, struct knee *knees,
+		     int num_knees, int dense, int steps)
+{
+	int num = 0, wss, i, k, j;
+
+	for (wss = MIN_WSS; wss <= max_wss && num < max_points; wss *= 2)
+		grid[num++] = wss;
+	for (k = 0; k < num_knees; k++)
+		for (j = -dense; j <= dense && num < max_points; j++) {
+			wss = points[knees[k].mid].wss *
+				pow(2.0, (double) j / steps) + 0.5;
+			if (wss >= MIN_WSS && wss <= max_wss)
+				grid[num++] = wss;
+		}
+
+	qsort(grid, num, sizeof(int), cmp_int);
+	for (i = 1, j = 1; i < num; i++)
+		if (grid[i] != grid[j - 1])
+			grid[j++] = grid[i];
+	return num ? j : 0;
+}
+
+static void print_curve(FILE *out, struct point *points, int num)
+{
+	int i;
+
+	fprintf(out, "# WSS_KB, NS_PER_LOAD, MB_PER_S\n");
+	for (i = 0; i < num; i++)
+		fprintf(out, "%8d, %8.2f, %9.0f\n", points[i].wss,
+			points[i].ns_per_load, points[i].mbps);
+}
+
+/* The sysfs cache level whose size is closest to wss (by ratio), 0 if
+ * sysfs tells none.
+ */
+static int closest_level(int wss, int *sizes, int levels)
+{
+	double dist, best_dist = 0;
+	int level, best = 0;
+
+	for (level = 1; level <= levels; level++) {
+		if (!sizes[level])
+			continue;
+		dist = fabs(log((double) wss / sizes[level]));
+		if (!best || dist < best_dist) {
+			best = level;
+			best_dist = dist;
+		}
+	}
+	return best;
+}
+
+/* Each knee and the sysfs cache size closest to it. */
+static void print_knees(FILE *out, struct point *points,
+			struct knee *knees, int num_knees, int *sizes,
+			int levels)
+{
+	int k, level, wss;
+
+	for (level = 1; level <= levels; level++)
+		if (sizes[level])
+			fprintf(out, "# sysfs L%d: %d KB\n", level,
+				sizes[level]);
+	for (k = 0; k < num_knees; k++) {
+		wss = points[knees[k].mid].wss;
+		fprintf(out, "# knee %d: %d KB (latency x%.2f from %d KB "
+			"to %d KB)", k + 1, wss, knees[k].rise,
+			points[knees[k].first].wss,
+			points[knees[k].last].wss);
+		level = closest_level(wss, sizes, levels);
+		if (level)
+			fprintf(out, ", L%d per sysfs %d KB (%+.0f%%)", level,
+				sizes[level], 100.0 *
+				(wss - sizes[level]) / sizes[level]);
+		fprintf(out, "\n");
+	}
+}
+
+/* The LLC capacity: the knee closest to the sysfs LLC size among those
+ * closer to it than to other levels, the last knee if sysfs tells
+ * nothing, else the sysfs size.
+ */
+static int measured_llc(struct point *points, struct knee *knees,
+			int num_knees, int *sizes, int levels, int max_wss)
+{
+	double dist, best_dist = 0;
+	int k, wss, best = 0;
+
+	if (!levels)
+		return num_knees ? points[knees[num_knees - 1].mid].wss : 0;
+	for (k = 0; k < num_knees; k++) {
+		wss = points[knees[k].mid].wss;
+		if (closest_level(wss, sizes, levels) != levels)
+			continue;
+		dist = fabs(log((double) wss / sizes[levels]));
+		if (!best || dist < best_dist) {
+			best = wss;
+			best_dist = dist;
+		}
+	}
+	if (best)
+		return best;
+	fprintf(stderr, "Warning: no knee near the sysfs LLC size (%d KB)%s; "
+		"using it.\n", sizes[levels], max_wss < 2 * sizes[levels] ?
+		", measure up to twice that (-m)" : "");
+	return sizes[levels];
+}
+
+static void usage(char *error)
+{
+	if (error)
+		fprintf(stderr, "Error: %s\n", error);
+	fprintf(stderr,
+"Usage: cache_calib [-c CPU] [-m MAX_WSS] [-r STEPS] [-d POINTS]\n"
+"                   [-M BACKING] [-g] [-l] [-h]\n"
+"Options:\n"
+"       -c: CPU to measure on (default 0).\n"
+"       -m: Largest working set in KB (default: twice the LLC,\n"
+"           at least %d KB).\n"
+"       -r: Working set sizes per octave (default 4).\n"
+"       -d: Grid points on either side of each knee (default 4),\n"
+"           spaced 1/(2 STEPS) of an octave.\n"
+"       -M: Memory backing, as for cache_cost (default anon-4k).\n"
+"       -g: Print only the WSS grid (for cache_cost -s).\n"
+"       -l: Print only the measured LLC capacity in KB (the knee\n"
+"           nearest the sysfs LLC size, else that size with a warning;\n"
+"           the last knee if sysfs tells nothing).\n"
+"       -h: Show this message.\n"
+"The latency (dependent loads) and bandwidth (sequential reads) curve\n"
+"is printed as CSV, followed by the knees, the sysfs cache sizes and\n"
+"the grid as '#' lines.\n", DEFAULT_MAX_WSS);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static struct point points[MAX_POINTS];
+	static struct knee knees[MAX_POINTS];
+	static int grid[4 * MAX_POINTS];
+	int sizes[MAX_LEVEL + 1];
+	enum backing_mode mode = BACKING_ANON;
+	const char *backing_path = NULL;
+	struct backing backing;
+	touch_kernel_t stream;
+	cpu_set_t cpus;
+	int cpu = 0, max_wss = 0, steps = 4, dense = 4;
+	int grid_only = 0, llc_only = 0;
+	int levels, num = 0, num_knees, num_grid, opt, i, k, wss;
+
+	while ((opt = getopt(argc, argv, "c:m:r:d:M:glh")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'm':
+			max_wss = atoi(optarg);
+			if (max_wss < MIN_WSS)
+				usage("Invalid largest working set.");
+			break;
+		case 'r':
+			steps = atoi(optarg);
+			if (steps <= 0)
+				usage("Invalid number of steps.");
+			break;
+		case 'd':
+			dense = atoi(optarg);
+			if (dense < 0)
+				usage("Invalid number of points.");
+			break;
+		case 'M':
+			if (parse_backing(optarg, &mode, &backing_path))
+				usage("Unknown backing mode.");
+			break;
+		case 'g':
+			grid_only = 1;
+			break;
+		case 'l':
+			llc_only = 1;
+			break;
+		case 'h':
+		default:
+			usage(NULL);
+		}
+	}
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		die("could not move to the CPU");
+
+	levels = get_cache_sizes(cpu, sizes, MAX_LEVEL);
+	if (!max_wss) {
+		max_wss = DEFAULT_MAX_WSS;
+		if (levels && 2 * sizes[levels] > max_wss)
+			max_wss = 2 * sizes[levels];
+	}
+
+	if (tsc_calibrate(&tsc))
+		die("could not calibrate the TSC");
+	if (backing_map(&backing, mode, (size_t) max_wss * 1024,
+			backing_path))
+		die("could not map the working sets");
+
+	stream = touch_isa_supported(best_touch_isa()) ?
+		select_simd_kernel(best_touch_isa(), PATTERN_SEQ, 0) : NULL;
+	if (!stream)
+		stream = select_touch_kernel(PATTERN_SEQ, 0);
+
+	/* step k is 2^(k / steps) times MIN_WSS, without rounding drift */
+	for (k = 0; num < MAX_POINTS; k++) {
+		wss = MIN_WSS * pow(2.0, (double) k / steps) + 0.5;
+		if (wss > max_wss)
+			break;
+		points[num].wss = wss;
+		/* sizes that round to the same KB */
+		if (num && points[num].wss == points[num - 1].wss)
+			continue;
+		measure(&points[num], backing.base, stream);
+		num++;
+	}
+
+	num_knees = find_knees(points, num, steps, knees);
+	num_grid = make_grid(grid, sizeof(grid) / sizeof(grid[0]), max_wss,
+			     points, knees, num_knees, dense, 2 * steps);
+
+	if (llc_only) {
+		printf("%d\n", measured_llc(points, knees, num_knees, sizes,
+					    levels, max_wss));
+	} else if (grid_only) {
+		for (i = 0; i < num_grid; i++)
+			printf("%s%d", i ? "," : "", grid[i]);
+		printf("\n");
+	} else {
+		printf("# cpu=%d\n# tsc_mhz=%.3f\n# backing=%s\n", cpu,
+		       tsc.mhz, backing_mode_name(mode));
+		print_curve(stdout, points, num);
+		print_knees(stdout, points, knees, num_knees, sizes, levels);
+		printf("# wss_grid=");
+		for (i = 0; i < num_grid; i++)
+			printf("%s%d", i ? "," : "", grid[i]);
+		printf("\n");
+	}
+
+	backing_unmap(&backing);
+	return 0;
+}
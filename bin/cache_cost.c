@@ -1,16 +1,21 @@
 #define _GNU_SOURCE /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
 #include <time.h>
 
 #include <signal.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <sched.h>
+#include <pthread.h>
 
 #include <sys/io.h>
 #include <sys/utsname.h>
 #include <sys/sysinfo.h>
+#include <sys/wait.h>
 
 #if defined(__i386__) || defined(__x86_64__)
 #include "x86-cycles.h"
@@ -19,7 +24,20 @@
 #error unsupported architecture
 #endif
 
+#include "backing.h"
+#include "color.h"
+#include "numa.h"
 #include "pagemap.h"
+#include "perfctr.h"
+#include "polluter.h"
+#include "preemptor.h"
+#include "stopping.h"
+#include "strata.h"
+#include "summary.h"
+#include "topology.h"
+#include "touch.h"
+#include "trace.h"
+#include "tsc.h"
 
 static void die(char *error)
 {
@@ -83,7 +101,8 @@ static int become_posix_realtime_task(void)
 {
 	struct sched_param param;
 
-	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	/* the highest priority is left for the preemptor (-F) */
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
 	return sched_setscheduler(0 /* self */, SCHED_FIFO, &param);
 }
 
@@ -92,7 +111,25 @@ static int become_posix_realtime_task(void)
 #define INTS_IN_1KB (1024 / sizeof(int))
 #define ARENA_SIZE (INTS_IN_1KB * 1024 * ARENA_SIZE_MB)
 static int page_idx = 0;
-static int arena[ARENA_SIZE];
+/* mapped according to the backing mode (-M); page aligned, as vector
+ * kernels need aligned cache lines
+ */
+static struct backing arena_backing;
+static int *arena;
+static int arena_size = ARENA_SIZE;
+
+/* with page coloring (-C), the arena is rebuilt from pages of the
+ * chosen colors
+ */
+#define MAX_COLORS 65536
+static struct color_region arena_colors;
+static int arena_num_colors;
+
+/* The part of the arena used by this process. Campaign workers
+ * each get a disjoint slice so that they do not share pages.
+ */
+static int *arena_base;
+static int arena_len = ARENA_SIZE;
 
 static int lock_memory(void)
 {
@@ -102,15 +139,22 @@ static int lock_memory(void)
 
 static void touch_arena(void) {
 	int i;
-	for (i = 0; i < ARENA_SIZE; i++)
-		arena[i] = i;
+	for (i = 0; i < arena_len; i++)
+		arena_base[i] = i;
 }
 
 static int arena_pos = 0;
+static int arena_touched = 0;
 
+/* Only the first experiment of a process (or of a campaign worker)
+ * needs to prefault the arena; later ones, e.g. in a sweep, find the
+ * cache as dirty as the previous experiment left it.
+ */
 static void reset_arena(void) {
 	arena_pos = 0;
-	touch_arena();
+	if (!arena_touched)
+		touch_arena();
+	arena_touched = 1;
 }
 
 static int* allocate(int wss)
@@ -122,15 +166,15 @@ static int* allocate(int wss)
 	 * At most half of the arena may be used
 	 * at any one time.
 	 */
-	if (size * 2 > ARENA_SIZE)
+	if (size * 2 > arena_len)
 		die("static memory arena too small");
 
-	if (arena_pos + size > ARENA_SIZE) {
+	if (arena_pos + size > arena_len) {
 		/* wrap to beginning */
-		mem = arena;
+		mem = arena_base;
 		arena_pos = size;
 	} else {
-		mem = arena + arena_pos;
+		mem = arena_base + arena_pos;
 		arena_pos += size;
 	}
 
@@ -147,191 +191,1382 @@ static void migrate_to(int target)
 		die("migration failed");
 }
 
+static void map_arena(enum backing_mode mode, const char *path)
+{
+	if (backing_map(&arena_backing, mode, sizeof(int) * ARENA_SIZE, path))
+		die("could not map the memory arena");
+	arena = arena_backing.base;
+	arena_size = ARENA_SIZE;
+	arena_base = arena;
+	arena_len = arena_size;
+}
+
+/* Place the arena on node: bind it there, or fault it in from a CPU of
+ * that node (first touch). This must happen before the memory is
+ * locked, which faults in all pages.
+ */
+static void place_arena(int node, int first_touch)
+{
+	int cpus[CPU_SETSIZE];
+
+	if (first_touch) {
+		if (numa_node_cpus(node, cpus, CPU_SETSIZE) <= 0)
+			die("node has no CPUs for first-touch placement");
+		migrate_to(cpus[0]);
+		touch_arena();
+	} else if (numa_bind(arena, sizeof(int) * arena_size, node))
+		die("could not bind the arena to the node");
+}
+
+/* Replace the arena by its pages of the colors in spec, "[NUM:]LIST",
+ * where NUM is the number of colors (default: from the LLC geometry)
+ * and LIST is a list like "0-7,16". Page i of the new arena has the
+ * (i mod k)-th of the k listed colors.
+ */
+static void color_arena(const char *spec)
+{
+	static int colors[MAX_COLORS];
+	const char *list = strchr(spec, ':');
+	int num;
+
+	if (list) {
+		arena_num_colors = atoi(spec);
+		list++;
+	} else {
+		arena_num_colors = llc_page_colors(0, arena_backing.page_size);
+		list = spec;
+	}
+	if (arena_num_colors <= 0 || arena_num_colors > MAX_COLORS)
+		die("invalid number of page colors");
+	num = parse_cpu_list(list, colors, MAX_COLORS);
+	if (num <= 0)
+		die("invalid list of page colors");
+
+	if (color_region_build(&arena_colors, arena, sizeof(int) * arena_size,
+			       arena_backing.page_size, arena_num_colors,
+			       colors, num, 0))
+		die("could not build the colored arena");
+	arena = (int *) arena_colors.base;
+	arena_size = arena_colors.len / sizeof(int);
+	arena_base = arena;
+	arena_len = arena_size;
+}
+
+/* Restrict this process to slice 'idx' of 'num' equal arena slices. */
+static void use_arena_slice(int idx, int num)
+{
+	int len = arena_size / num;
+
+	/* keep slices aligned to the (possibly huge) backing pages */
+	len -= len % (arena_backing.page_size / sizeof(int));
+	if (!len)
+		die("backing pages too large to split the arena");
+	arena_base = arena + idx * len;
+	arena_len = len;
+	arena_pos = 0;
+}
+
+static volatile sig_atomic_t time_is_up = 0;
+
 static void sleep_us(int microseconds)
 {
 	struct timespec delay;
 
 	delay.tv_sec = 0;
 	delay.tv_nsec = microseconds * 1000;
-	if (nanosleep(&delay, NULL) != 0)
+	if (nanosleep(&delay, NULL) != 0 && errno != EINTR)
 		die("sleep failed");
 }
 
-static int touch_mem(int *mem, int wss, int write_cycle)
+/* Sleep for delay microseconds on cpu, while the preemptor runs there
+ * (released halfway through the delay). If the preemptor takes
+ * longer than the rest of the delay, it delays the task further.
+ */
+static void sleep_preempted(struct preemptor *p, int cpu, int delay)
 {
-	int sum = 0, i;
-
-	if (write_cycle > 0) {
-		for (i = 0; i < wss * 1024 / sizeof(int); i++) {
-			if (i % write_cycle == (write_cycle - 1))
-				mem[i]++;
-			else
-				sum += mem[i];
-		}
-	} else {
-		/* sequential access, pure read */
-		for (i = 0; i < wss * 1024 / sizeof(int); i++)
-			sum += mem[i];
-	}
-	return sum;
+	struct timespec release;
+	int64_t ns;
+
+	/* halfway through the sleep (delay is in us) */
+	clock_gettime(CLOCK_MONOTONIC, &release);
+	ns = release.tv_nsec + (int64_t) delay * 1000 / 2;
+	release.tv_sec += ns / 1000000000;
+	release.tv_nsec = ns % 1000000000;
+	errno = preemptor_release(p, cpu, &release);
+	if (errno)
+		die("could not release the preemptor");
+	sleep_us(delay);
+	preemptor_wait(p);
 }
 
-static int pick_cpu(int last_cpu, int num_cpus)
+/* Parameters of one measurement configuration. */
+struct experiment {
+	int wss;		/* working set size, in KB */
+	int sleep_min;
+	int sleep_max;
+	int write_cycle;	/* every nth int is a write; 0 means read-only */
+	int sample_count;
+	int best_effort;
+	enum access_pattern pattern;
+	int stride;		/* in bytes, for PATTERN_STRIDE */
+	enum touch_isa isa;
+	int nontemporal;	/* vector kernels: streaming stores */
+	enum backing_mode backing;
+	int numa_node;		/* home node of the arena, -1: don't care */
+	int numa_touch;		/* place by first touch rather than binding */
+	const char *colors;	/* page colors of the arena, NULL: any */
+	int counters;		/* read performance counters around phases */
+	int preempt_kb;		/* preemptor footprint, 0: plain sleep */
+	enum access_pattern preempt_pattern;
+	int preempt_wcycle;
+	struct polluter_spec pollute;	/* footprint 0: no polluters */
+	int handoff;		/* pinned threads instead of migrations */
+	int stratified;		/* pick CPU pairs by migration class */
+	const char *coverage_file;	/* pair coverage across runs */
+	int adaptive;		/* stop once stop is satisfied */
+	struct stop_rule stop;
+	const char *summary_file;	/* streaming statistics, or NULL */
+	int summary_only;	/* no samples in the trace */
+	touch_kernel_t kernel;	/* picked once for pattern and write_cycle */
+};
+
+/* The CPUs that one measuring process moves among. */
+struct cpu_group {
+	int num;
+	int cpus[CPU_SETSIZE];
+	/* If non-NULL, only migrations that cross LLC domains are
+	 * generated (cross-domain phase of a campaign).
+	 */
+	const int *domain_of;
+	/* If non-NULL, picks the target CPUs (-D). */
+	struct strata *strata;
+	/* Migration class of each pair, if needed. */
+	struct strata *classes;
+	/* If non-NULL, the CPMD of each migration class decides when to
+	 * stop (-Q).
+	 */
+	struct stop_series *series;	/* per class */
+	/* If non-NULL, receives the statistics of the samples (-Y). */
+	struct summary *summary;
+};
+
+static int pick_cpu(int last_cpu, struct cpu_group *group)
 {
 	int cpu;
-	if (num_cpus == 1 || random() % 2 == 0)
+
+	if (group->strata)
+		return strata_pick(group->strata, last_cpu);
+
+	if (group->domain_of) {
+		/* only cross-domain migrations */
+		do {
+			cpu = group->cpus[random() % group->num];
+		} while (group->domain_of[cpu] == group->domain_of[last_cpu]);
+		return cpu;
+	}
+
+	if (group->num == 1 || random() % 2 == 0)
 		return last_cpu; /* preemption */
 	else {
 		do {
-			cpu = random() % num_cpus;
+			cpu = group->cpus[random() % group->num];
 		} while (cpu == last_cpu);
 		return cpu;
 	}
 }
 
-static void do_random_experiment(FILE* outfile,
-				 int num_cpus, int wss,
-				 int sleep_min, int sleep_max,
-				 int write_cycle, int sample_count,
-				 int best_effort)
+/* Has every migration class converged or reached the cap (-c)? */
+static int series_converged(struct cpu_group *group, struct experiment *exp)
 {
-	int last_cpu, next_cpu, delay, show = 1, i;
-	unsigned long preempt_counter = 0;
-	unsigned long migration_counter = 0;
-	unsigned long counter = 1;
-	unsigned long num_pages = wss / getpagesize();
-	unsigned long *phys_addrs;
+	int cls;
+
+	for (cls = 0; cls < NUM_CLASSES; cls++) {
+		if (!group->classes->pairs[cls])
+			continue;
+		if (exp->sample_count &&
+		    group->series[cls].n >= (unsigned long) exp->sample_count)
+			continue;
+		if (!stop_series_converged(&exp->stop, &group->series[cls]))
+			return 0;
+	}
+	return 1;
+}
 
-	cycles_t start, stop;
-	cycles_t cold, hot1, hot2, hot3, after_resume;
+static int need_more_samples(struct cpu_group *group, struct experiment *exp,
+			     unsigned long preempt_counter,
+			     unsigned long migration_counter)
+{
+	int sample_count = exp->sample_count;
+
+	if (time_is_up)
+		return 0;
+	if (group->series && series_converged(group, exp))
+		return 0;
+	if (!sample_count)
+		return 1;
+	if (group->strata)
+		return !strata_done(group->strata);
+	if (group->domain_of)
+		return sample_count >= migration_counter;
+	return sample_count >= preempt_counter ||
+		(group->num > 1 && sample_count >= migration_counter);
+}
 
-	int *mem;
+/* number of pages whose physical addresses are recorded per sample */
+static unsigned long wss_pages(int wss)
+{
+	unsigned long num_pages = wss * 1024 / getpagesize();
 
-	if (!num_pages)
-		num_pages = 1;
+	return num_pages ? num_pages : 1;
+}
 
-	phys_addrs = malloc(sizeof(long) * num_pages);
+/* samples that the trace writer thread may lag behind */
+#define TRACE_RING_SIZE 4096
 
-	migrate_to(0);
-	last_cpu = 0;
+static void start_writer(struct trace_writer *writer, struct trace *trace,
+			 int cpu)
+{
+	errno = trace_writer_start(writer, trace, TRACE_RING_SIZE, cpu);
+	if (errno)
+		die("could not start trace writer");
+}
 
-	/* prefault and dirty cache */
-	reset_arena();
+static void stop_writer(struct trace_writer *writer)
+{
+	errno = trace_writer_stop(writer);
+	if (errno)
+		die("could not write trace");
+	if (writer->stalls)
+		fprintf(stderr, "Trace writer fell behind %lu time(s).\n",
+			writer->stalls);
+}
 
-#if defined(__i386__) || defined(__x86_64__)
-	if (!best_effort)
-		iopl(3);
-#endif
+/* Physical addresses are resolved by the trace writer thread, with the
+ * translations of this process's arena slice cached between samples.
+ * Opened once per process and shared by the traces of all
+ * configurations.
+ */
+static struct pagemap pagemap;
 
-	fprintf(outfile,
-		"# %5s, %6s, %6s, %6s, %3s, %3s"
-		", %10s, %10s, %10s, %10s, %10s"
-		", %12s, %12s"
-		"\n",
-		"COUNT", "WCYCLE",
-		"WSS", "DELAY", "SRC", "TGT", "COLD",
-		"HOT1", "HOT2", "HOT3", "WITH-CPMD",
-		"VIRT ADDR", "PHYS ADDR");
+static void open_pagemap(void)
+{
+	if (pagemap_open(&pagemap, 0))
+		die("could not open pagemap");
+	if (pagemap_cache_range(&pagemap, (unsigned long) arena_base,
+				arena_len * sizeof(int)))
+		die("out of memory");
+}
 
+/* Performance counters of the measuring thread (-E), opened once per
+ * process; they follow the thread across migrations.
+ */
+static struct perf_group perf;
 
-	while (!sample_count ||
-	       sample_count >= preempt_counter ||
-	       (num_cpus > 1 && sample_count >= migration_counter)) {
+static void open_counters(void)
+{
+	if (perf_group_open(&perf, 0))
+		die("could not open performance counters");
+}
 
-		delay = sleep_min + random() % (sleep_max - sleep_min + 1);
-		next_cpu = pick_cpu(last_cpu, num_cpus);
+/* The timed phases run with interrupts off (unless best effort), where
+ * the counters are read with rdpmc only: a read() is a system call.
+ * Returns -1 if a counter cannot be read that way right now.
+ */
+static inline int read_counters(struct experiment *exp,
+				struct perf_group *counters, uint64_t *values)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	if (!exp->best_effort)
+		return perf_group_read_user(counters, values);
+#endif
+	perf_group_read(counters, values);
+	return 0;
+}
 
-		if (sample_count)
-			show = (next_cpu == last_cpu && sample_count >= preempt_counter) ||
-				(next_cpu != last_cpu && sample_count >= migration_counter);
+/* timing overhead is subtracted from every phase */
+static struct tsc_calibration tsc;
+
+/* Streaming statistics (-Y): one summary per measuring process (the
+ * workers of a campaign and the cross-domain phase), in shared memory,
+ * plus what the summary file held before.
+ */
+static struct summary *summaries;
+static int num_summaries;
+static struct summary summary_base;
+static char summary_path[255];
+static cycles_t summary_written;
+
+/* seconds between snapshots of the summary file */
+#define SUMMARY_INTERVAL 10
+
+/* Background load (-G): one polluter on each CPU that neither measures
+ * nor writes the trace, and their traffic at the start of the current
+ * configuration.
+ */
+static struct polluter *polluters;
+static int num_polluters;
+static struct polluter_mark *polluter_marks;
+
+static void print_metadata(FILE *outfile, struct experiment *exp)
+{
+	int slot;
+
+	fprintf(outfile, "# tsc_mhz=%.3f\n", tsc.mhz);
+	fprintf(outfile, "# tsc_invariant=%d\n", tsc.invariant);
+	fprintf(outfile, "# timer=%s\n", tsc.rdtscp ? "rdtscp" : "rdtsc");
+	fprintf(outfile, "# timer_overhead=%llu\n",
+		(unsigned long long) tsc.overhead);
+	fprintf(outfile, "# timer_jitter=%llu\n",
+		(unsigned long long) tsc.jitter);
+	if (exp->preempt_kb)
+		fprintf(outfile, "# preemptor=%d:%s:%d\n", exp->preempt_kb,
+			access_pattern_name(exp->preempt_pattern),
+			exp->preempt_wcycle);
+	else
+		fprintf(outfile, "# preemptor=none\n");
+	if (num_polluters) {
+		fprintf(outfile, "# polluter=%d:%s:%d:%ld:%s\n",
+			exp->pollute.footprint,
+			access_pattern_name(exp->pollute.pattern),
+			exp->pollute.write_cycle, exp->pollute.rate,
+			rate_unit_name(exp->pollute.unit));
+		fprintf(outfile, "# polluter_cpus=");
+		for (slot = 0; slot < num_polluters; slot++)
+			fprintf(outfile, "%s%d", slot ? "," : "",
+				polluters[slot].cpu);
+		fprintf(outfile, "\n");
+	} else
+		fprintf(outfile, "# polluter=none\n");
+	fprintf(outfile, "# migration=%s\n",
+		exp->handoff ? "handoff" : "affinity");
+	fprintf(outfile, "# cpu_pairs=%s\n",
+		exp->stratified ? "stratified" : "random");
+	if (exp->coverage_file)
+		fprintf(outfile, "# coverage_file=%s\n", exp->coverage_file);
+	if (exp->adaptive)
+		fprintf(outfile, "# stop_rule=%s:%g\n",
+			stop_statistic_name(exp->stop.statistic),
+			exp->stop.width);
+	else
+		fprintf(outfile, "# stop_rule=none\n");
+	if (exp->summary_file)
+		fprintf(outfile, "# summary=%s\n", summary_path);
+	if (exp->summary_only)
+		fprintf(outfile, "# summary_only=1\n");
+	fprintf(outfile, "# pattern=%s\n", access_pattern_name(exp->pattern));
+	if (exp->pattern == PATTERN_STRIDE)
+		fprintf(outfile, "# stride=%d\n", exp->stride);
+	fprintf(outfile, "# isa=%s\n", touch_isa_name(exp->isa));
+	if (exp->isa != ISA_SCALAR)
+		fprintf(outfile, "# nontemporal=%d\n", exp->nontemporal);
+	fprintf(outfile, "# kernel=%s\n",
+		exp->isa != ISA_SCALAR ? "vector" :
+		exp->write_cycle <= MAX_KERNEL_WCYCLE ?
+		"specialized" : "generic");
+	fprintf(outfile, "# kernel_cycles_per_line=%.2f\n",
+		kernel_cycles_per_line(exp->kernel, exp->pattern,
+				       exp->write_cycle));
+	fprintf(outfile, "# backing=%s\n", backing_mode_name(exp->backing));
+	fprintf(outfile, "# backing_page_size=%lu\n",
+		(unsigned long) arena_backing.page_size);
+	fprintf(outfile, "# numa_nodes=%d\n", numa_num_nodes());
+	if (exp->numa_node >= 0)
+		fprintf(outfile, "# numa_placement=%s:%d\n",
+			exp->numa_touch ? "touch" : "bind", exp->numa_node);
+	else
+		fprintf(outfile, "# numa_placement=none\n");
+	fprintf(outfile, "# numa_balancing=%d\n", numa_balancing_enabled());
+	if (exp->colors) {
+		fprintf(outfile, "# page_colors=%d\n", arena_num_colors);
+		fprintf(outfile, "# colors=%s\n", exp->colors);
+		fprintf(outfile, "# color_pages=%lu\n", arena_colors.pages);
+	} else
+		fprintf(outfile, "# colors=any\n");
+	if (exp->counters) {
+		fprintf(outfile, "# perf_counters=");
+		for (slot = 0; slot < NUM_PERF_SLOTS; slot++)
+			fprintf(outfile, "%s%s", slot ? "," : "",
+				perf_slot_name(&perf, slot));
+		fprintf(outfile, "\n# perf_read=%s\n",
+			perf.rdpmc ? "rdpmc" : "read");
+	}
+}
 
-		mem = allocate(wss);
+/* The sample in progress. */
+struct sample {
+	int *mem;
+	struct access_layout layout;
+	int delay;
+	int src;
+	int tgt;
+	int show;		/* goes into the trace */
+	cycles_t cycles[NUM_PHASES];
+	/* counters before and after each phase */
+	uint64_t ctr_start[NUM_PHASES][NUM_PERF_SLOTS];
+	uint64_t ctr_stop[NUM_PHASES][NUM_PERF_SLOTS];
+	uint64_t handoff;	/* cycles, handoff mode only */
+	unsigned long numa_moved;	/* NUMA balancing page moves */
+};
+
+/* Traverse the working set once, timed as phase. */
+static inline void timed_phase(struct experiment *exp, struct sample *s,
+			       struct perf_group *counters, int phase)
+{
+	cycles_t start, stop;
+	int unread = counters &&
+		read_counters(exp, counters, s->ctr_start[phase]);
+
+	start = tsc_begin();
+	s->mem[0] = exp->kernel(&s->layout, exp->write_cycle);
+	stop  = tsc_end();
+	if (counters)
+		unread |= read_counters(exp, counters, s->ctr_stop[phase]);
+	s->cycles[phase] = tsc_cycles(&tsc, start, stop);
+	/* a counter was off the PMU: no deltas for this phase */
+	if (unread) {
+		memset(s->ctr_start[phase], 0, sizeof(s->ctr_start[phase]));
+		memset(s->ctr_stop[phase], 0, sizeof(s->ctr_stop[phase]));
+	}
+}
 
+/* Pick the delay and the target CPU of the next sample, allocate its
+ * working set and measure the cold and hot phases on this CPU.
+ */
+static void start_sample(struct sample *s, struct experiment *exp,
+			 struct cpu_group *group, struct perf_group *counters,
+			 int cpu, unsigned long preempt_counter,
+			 unsigned long migration_counter)
+{
+	int sample_count = exp->sample_count;
+
+	s->delay = exp->sleep_min +
+		random() % (exp->sleep_max - exp->sleep_min + 1);
+	s->src = cpu;
+	s->tgt = pick_cpu(cpu, group);
+	s->show = 1;
+	s->handoff = 0;
+
+	if (group->strata)
+		s->show = strata_record(group->strata, s->src, s->tgt);
+	else if (sample_count)
+		s->show = (s->tgt == s->src && sample_count >= preempt_counter) ||
+			(s->tgt != s->src && sample_count >= migration_counter);
+
+	s->mem = allocate(exp->wss);
+	if (build_layout(&s->layout, exp->pattern, exp->stride, s->mem, exp->wss))
+		die("could not build access layout");
+
+	s->numa_moved = numa_pages_migrated();
 #if defined(__i386__) || defined(__x86_64__)
-		if (!best_effort)
-			cli();
+	if (!exp->best_effort)
+		cli();
 #endif
-		start = get_cycles();
-		mem[0] = touch_mem(mem, wss, write_cycle);
-		stop  = get_cycles();
-		cold = stop - start;
-
-		start = get_cycles();
-		mem[0] = touch_mem(mem, wss, write_cycle);
-		stop  = get_cycles();
-		hot1 = stop - start;
-
-		start = get_cycles();
-		mem[0] = touch_mem(mem, wss, write_cycle);
-		stop  = get_cycles();
-		hot2 = stop - start;
-
-		start = get_cycles();
-		mem[0] = touch_mem(mem, wss, write_cycle);
-		stop  = get_cycles();
-		hot3 = stop - start;
+	timed_phase(exp, s, counters, PHASE_COLD);
+	timed_phase(exp, s, counters, PHASE_HOT1);
+	timed_phase(exp, s, counters, PHASE_HOT2);
+	timed_phase(exp, s, counters, PHASE_HOT3);
 #if defined(__i386__) || defined(__x86_64__)
-		if (!best_effort)
-			sti();
+	if (!exp->best_effort)
+		sti();
 #endif
-		migrate_to(next_cpu);
-		sleep_us(delay);
+}
+
+/* On the target CPU: sleep, then measure the phase with CPMD. */
+static void finish_sample(struct sample *s, struct experiment *exp,
+			  struct perf_group *counters,
+			  struct preemptor *preemptor)
+{
+	if (exp->preempt_kb)
+		sleep_preempted(preemptor, s->tgt, s->delay);
+	else
+		sleep_us(s->delay);
 
 #if defined(__i386__) || defined(__x86_64__)
-		if (!best_effort)
-			cli();
+	if (!exp->best_effort)
+		cli();
 #endif
-		start = get_cycles();
-		mem[0] = touch_mem(mem, wss, write_cycle);
-		stop  = get_cycles();
+	timed_phase(exp, s, counters, PHASE_CPMD);
 #if defined(__i386__) || defined(__x86_64__)
-		if (!best_effort)
-			sti();
+	if (!exp->best_effort)
+		sti();
 #endif
-		after_resume = stop - start;
-
-
-		/* run, write ratio, wss, delay, from, to, cold, hot1, hot2,
-		 * hot3, after_resume */
-		if (show) {
-			fprintf(outfile,
-				" %6ld, %6d, %6d, %6d, %3d, %3d, "
-				"%10" CYCLES_FMT ", "
-				"%10" CYCLES_FMT ", "
-				"%10" CYCLES_FMT ", "
-				"%10" CYCLES_FMT ", "
-				"%10" CYCLES_FMT ", "
-				"%12lu",
-				counter++, write_cycle,
-				wss, delay, last_cpu, next_cpu, cold,
-				hot1, hot2, hot3,
-				after_resume,
-				(unsigned long) mem);
-			get_phys_addrs(0,
-				(unsigned long) mem,
-				wss * 1024 + (unsigned long) mem,
-				phys_addrs,
-				wss);
-			for (i = 0; i < num_pages; i++)
-				fprintf(outfile, ", %12lu", phys_addrs[i]);
-			fprintf(outfile, "\n");
-		}
-		if (next_cpu == last_cpu)
+	s->numa_moved = numa_pages_migrated() - s->numa_moved;
+}
+
+/* Add the CPMD of a sample to the series of its migration class. */
+static void add_to_series(struct cpu_group *group, struct experiment *exp,
+			  struct sample *s)
+{
+	cycles_t hot = s->cycles[PHASE_COLD];
+	int phase, cls;
+
+	cls = strata_class_of(group->classes, s->src, s->tgt);
+	if (cls < 0)
+		return;
+	/* as in build_cpmd_model.py */
+	for (phase = PHASE_HOT1; phase <= PHASE_HOT3; phase++)
+		if (s->cycles[phase] < hot)
+			hot = s->cycles[phase];
+	if (stop_series_add(&group->series[cls],
+			    (double) s->cycles[PHASE_CPMD] - (double) hot))
+		die("out of memory");
+	/* stratified picking can skip the class from now on */
+	if (group->strata &&
+	    stop_series_converged(&exp->stop, &group->series[cls]))
+		strata_close(group->strata, cls);
+}
+
+static void write_summary(void)
+{
+	static struct summary total;
+	int i;
+
+	total = summary_base;
+	for (i = 0; i < num_summaries; i++)
+		summary_merge(&total, &summaries[i]);
+	if (summary_save(&total, summary_path, tsc.mhz))
+		die("could not write summary");
+	summary_written = tsc_begin();
+}
+
+static void summarize_sample(struct cpu_group *group, struct sample *s)
+{
+	uint64_t cycles[NUM_PHASES];
+	int phase, cls;
+
+	cls = strata_class_of(group->classes, s->src, s->tgt);
+	if (cls < 0)
+		return;
+	for (phase = 0; phase < NUM_PHASES; phase++)
+		cycles[phase] = s->cycles[phase];
+	summary_add(group->summary, cls, cycles);
+
+	/* between samples, so it does not disturb a measurement */
+	if (tsc_begin() - summary_written > SUMMARY_INTERVAL * tsc.mhz * 1e6)
+		write_summary();
+}
+
+static void commit_sample(struct trace_writer *writer, struct sample *s,
+			  struct experiment *exp, unsigned long count)
+{
+	struct trace_record *rec;
+	int phase, slot;
+
+	rec = trace_writer_reserve(writer);
+	rec->count = count;
+	rec->write_cycle = exp->write_cycle;
+	rec->wss = exp->wss;
+	rec->delay = s->delay;
+	rec->src = s->src;
+	rec->tgt = s->tgt;
+	rec->cold = s->cycles[PHASE_COLD];
+	rec->hot1 = s->cycles[PHASE_HOT1];
+	rec->hot2 = s->cycles[PHASE_HOT2];
+	rec->hot3 = s->cycles[PHASE_HOT3];
+	rec->after_resume = s->cycles[PHASE_CPMD];
+	rec->virt_addr = (unsigned long) s->mem;
+	rec->handoff = s->handoff;
+	for (phase = 0; phase < NUM_PHASES; phase++)
+		for (slot = 0; slot < NUM_PERF_SLOTS; slot++)
+			rec->perf[phase][slot] =
+				s->ctr_stop[phase][slot] -
+				s->ctr_start[phase][slot];
+	/* where the working set is now, not when the writer gets to it */
+	rec->numa_moved = s->numa_moved;
+	rec->numa = s->numa_moved ? NUMA_BALANCED : 0;
+	trace_resolve_nodes(writer->trace, rec);
+	trace_writer_commit(writer);
+}
+
+static void start_preemptor(struct preemptor *preemptor,
+			    struct experiment *exp)
+{
+	errno = preemptor_start(preemptor, exp->preempt_kb,
+				exp->preempt_pattern, exp->stride,
+				exp->preempt_wcycle,
+				exp->best_effort ? 0 :
+				sched_get_priority_max(SCHED_FIFO));
+	if (errno)
+		die("could not start the preemptor");
+}
+
+static void start_polluters(struct experiment *exp, int num_cpus,
+			    int writer_cpu)
+{
+	int cpu;
+
+	polluters = calloc(num_online_cpus(), sizeof(*polluters));
+	polluter_marks = calloc(num_online_cpus(), sizeof(*polluter_marks));
+	if (!polluters || !polluter_marks)
+		die("out of memory");
+	for (cpu = num_cpus; cpu < num_online_cpus(); cpu++) {
+		if (cpu == writer_cpu)
+			continue;
+		errno = polluter_start(&polluters[num_polluters], cpu,
+				       &exp->pollute);
+		if (errno)
+			die("could not start a polluter");
+		num_polluters++;
+	}
+	if (!num_polluters)
+		fprintf(stderr, "Warning: no CPU left for polluters (-G).\n");
+}
+
+static void stop_polluters(void)
+{
+	int i;
+
+	for (i = 0; i < num_polluters; i++)
+		polluter_stop(&polluters[i]);
+	free(polluters);
+	free(polluter_marks);
+	polluters = NULL;
+	num_polluters = 0;
+}
+
+static void mark_polluters(void)
+{
+	int i;
+
+	for (i = 0; i < num_polluters; i++)
+		polluter_mark(&polluters[i], &polluter_marks[i]);
+}
+
+/* The bandwidth the polluters achieved during the configuration, on
+ * stderr and, as trailing metadata, in CSV traces.
+ */
+static void report_polluters(FILE *out, enum trace_format format)
+{
+	double mbps[CPU_SETSIZE], total = 0;
+	int i;
+
+	for (i = 0; i < num_polluters; i++) {
+		mbps[i] = polluter_rate(&polluters[i], &polluter_marks[i],
+					RATE_MBPS);
+		total += mbps[i];
+	}
+	fprintf(stderr, "Polluters: %.0f MB/s on %d CPU(s).\n", total,
+		num_polluters);
+	if (format != TRACE_CSV)
+		return;
+	fprintf(out, "# polluter_mbps=%.1f\n", total);
+	fprintf(out, "# polluter_cpu_mbps=");
+	for (i = 0; i < num_polluters; i++)
+		fprintf(out, "%s%d:%.1f", i ? "," : "", polluters[i].cpu,
+			mbps[i]);
+	fprintf(out, "\n");
+}
+
+/* Samples are handed to the writer thread, which resolves the physical
+ * addresses of the working set and writes them out.
+ */
+static void do_random_experiment(struct trace_writer *writer,
+				 struct cpu_group *group,
+				 struct experiment *exp)
+{
+	unsigned long preempt_counter = 0;
+	unsigned long migration_counter = 0;
+	unsigned long counter = 1;
+	struct preemptor preemptor;
+	struct sample s;
+	int last_cpu;
+
+	memset(&s, 0, sizeof(s));
+
+	migrate_to(group->cpus[0]);
+	last_cpu = group->cpus[0];
+
+	/* prefault and dirty cache */
+	reset_arena();
+
+	if (exp->preempt_kb)
+		start_preemptor(&preemptor, exp);
+
+#if defined(__i386__) || defined(__x86_64__)
+	if (!exp->best_effort)
+		iopl(3);
+#endif
+
+	while (need_more_samples(group, exp,
+				 preempt_counter, migration_counter)) {
+
+		start_sample(&s, exp, group, exp->counters ? &perf : NULL,
+			     last_cpu, preempt_counter, migration_counter);
+		migrate_to(s.tgt);
+		finish_sample(&s, exp, exp->counters ? &perf : NULL,
+			      &preemptor);
+		if (group->series)
+			add_to_series(group, exp, &s);
+		if (group->summary && s.show)
+			summarize_sample(group, &s);
+
+		if (s.show && !exp->summary_only)
+			commit_sample(writer, &s, exp, counter++);
+		if (s.tgt == s.src)
 			preempt_counter++;
 		else
 			migration_counter++;
-		last_cpu = next_cpu;
-		deallocate(mem);
+		last_cpu = s.tgt;
+		deallocate(s.mem);
+	}
+	free_layout(&s.layout);
+	if (exp->preempt_kb)
+		preemptor_stop(&preemptor);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+#define HANDOFF_STOP -1
+
+/* Handoff mode (-X): one measuring thread is pinned to each CPU of the
+ * group and spins until it owns the working set. A migration is a
+ * store to the owner word, so the measured path involves neither
+ * sched_setaffinity() nor a wake-up.
+ */
+struct handoff {
+	/* the only cache line that waiting threads read */
+	int owner __attribute__ ((aligned(64)));	/* CPU, or HANDOFF_STOP */
+	uint64_t released;	/* TSC when the owner passed it on */
+
+	/* used by the owner only */
+	struct trace_writer *writer __attribute__ ((aligned(64)));
+	struct cpu_group *group;
+	struct experiment *exp;
+	struct preemptor *preemptor;
+	struct sample sample;
+	int pending;		/* the sample awaits its CPMD phase */
+	unsigned long preempt_counter;
+	unsigned long migration_counter;
+	unsigned long counter;
+};
+
+struct handoff_thread {
+	struct handoff *handoff;
+	int cpu;
+	pthread_t thread;
+};
+
+static void* handoff_thread(void *arg)
+{
+	struct handoff_thread *t = arg;
+	struct handoff *h = t->handoff;
+	struct experiment *exp = h->exp;
+	struct sample *s = &h->sample;
+	struct perf_group group, *counters = NULL;
+	uint64_t acquired;
+	int owner;
+
+	/* counters are per thread */
+	if (exp->counters) {
+		if (perf_group_open(&group, 0))
+			die("could not open performance counters");
+		counters = &group;
+	}
+#if defined(__i386__) || defined(__x86_64__)
+	if (!exp->best_effort)
+		iopl(3);
+#endif
+
+	for (;;) {
+		while ((owner = __atomic_load_n(&h->owner, __ATOMIC_ACQUIRE))
+		       != t->cpu && owner != HANDOFF_STOP)
+			cpu_relax();
+		if (owner == HANDOFF_STOP)
+			break;
+		acquired = tsc_begin();
+
+		if (h->pending) {
+			/* TSCs are synchronized, but don't trust it blindly */
+			s->handoff = acquired > h->released ?
+				acquired - h->released : 0;
+			finish_sample(s, exp, counters, h->preemptor);
+			if (h->group->series)
+				add_to_series(h->group, exp, s);
+			if (h->group->summary && s->show)
+				summarize_sample(h->group, s);
+			if (s->show && !exp->summary_only)
+				commit_sample(h->writer, s, exp, h->counter++);
+			if (s->tgt == s->src)
+				h->preempt_counter++;
+			else
+				h->migration_counter++;
+			deallocate(s->mem);
+			h->pending = 0;
+		}
+
+		if (!need_more_samples(h->group, exp, h->preempt_counter,
+				       h->migration_counter)) {
+			__atomic_store_n(&h->owner, HANDOFF_STOP,
+					 __ATOMIC_RELEASE);
+			break;
+		}
+
+		start_sample(s, exp, h->group, counters, t->cpu,
+			     h->preempt_counter, h->migration_counter);
+		h->pending = 1;
+		h->released = tsc_end();
+		__atomic_store_n(&h->owner, s->tgt, __ATOMIC_RELEASE);
+	}
+
+	if (counters)
+		perf_group_close(&group);
+	return NULL;
+}
+
+static void do_handoff_experiment(struct trace_writer *writer,
+				  struct cpu_group *group,
+				  struct experiment *exp)
+{
+	static struct handoff h;
+	static struct handoff_thread threads[CPU_SETSIZE];
+	struct preemptor preemptor;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int i;
+
+	memset(&h, 0, sizeof(h));
+	h.writer = writer;
+	h.group = group;
+	h.exp = exp;
+	h.preemptor = &preemptor;
+	h.counter = 1;
+	h.owner = group->cpus[0];
+
+	migrate_to(group->cpus[0]);
+	/* prefault and dirty cache */
+	reset_arena();
+
+	if (exp->preempt_kb)
+		start_preemptor(&preemptor, exp);
+
+	/* the threads inherit our (real-time) scheduling policy */
+	for (i = 0; i < group->num; i++) {
+		threads[i].handoff = &h;
+		threads[i].cpu = group->cpus[i];
+		pthread_attr_init(&attr);
+		CPU_ZERO(&cpus);
+		CPU_SET(group->cpus[i], &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		errno = pthread_create(&threads[i].thread, &attr,
+				       handoff_thread, &threads[i]);
+		pthread_attr_destroy(&attr);
+		if (errno)
+			die("could not start measuring thread");
+	}
+	for (i = 0; i < group->num; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	free_layout(&h.sample.layout);
+	if (exp->preempt_kb)
+		preemptor_stop(&preemptor);
+}
+
+static void print_stop_reason(FILE *out, struct cpu_group *group,
+			      struct experiment *exp)
+{
+	struct stop_series *series;
+	const char *state;
+	int cls;
+
+	if (time_is_up)
+		fprintf(out, "Stopped: time limit reached.\n");
+	else if (series_converged(group, exp))
+		fprintf(out, "Stopped: every class converged or hit the cap.\n");
+	else
+		fprintf(out, "Stopped: sample cap reached.\n");
+
+	for (cls = 0; cls < NUM_CLASSES; cls++) {
+		if (!group->classes->pairs[cls])
+			continue;
+		series = &group->series[cls];
+		if (series->converged)
+			state = "converged";
+		else if (exp->sample_count &&
+			 series->n >= (unsigned long) exp->sample_count)
+			state = "capped";
+		else
+			state = "open";
+		if (!series->valid)
+			fprintf(out, "# stop_%s=%lu samples, too few for %s, %s\n",
+				strata_class_name(cls), series->n,
+				stop_statistic_name(exp->stop.statistic),
+				state);
+		else
+			fprintf(out, "# stop_%s=%lu samples, %s %.0f [%.0f, %.0f], "
+				"%s\n", strata_class_name(cls), series->n,
+				stop_statistic_name(exp->stop.statistic),
+				series->estimate, series->lo, series->hi, state);
+	}
+}
+
+static void run_experiment(struct trace_writer *writer,
+			   struct cpu_group *group, struct experiment *exp)
+{
+	static struct stop_series series[NUM_CLASSES];
+	struct strata strata;
+	int cls;
+
+	/* the migration class of each pair */
+	if (exp->stratified || exp->adaptive || group->summary) {
+		if (strata_init(&strata, group->cpus, group->num,
+				group->domain_of, exp->sample_count))
+			die("out of memory");
+		if (exp->coverage_file &&
+		    strata_load(&strata, exp->coverage_file))
+			die("could not read coverage file");
+		group->classes = &strata;
+	}
+	if (exp->stratified)
+		group->strata = &strata;
+	if (exp->adaptive) {
+		memset(series, 0, sizeof(series));
+		group->series = series;
+	}
+
+	if (exp->handoff)
+		do_handoff_experiment(writer, group, exp);
+	else
+		do_random_experiment(writer, group, exp);
+
+	if (exp->adaptive) {
+		print_stop_reason(stderr, group, exp);
+		for (cls = 0; cls < NUM_CLASSES; cls++)
+			stop_series_free(&series[cls]);
+		group->series = NULL;
+	}
+	if (exp->stratified) {
+		group->strata = NULL;
+		strata_print(stderr, &strata);
+		if (exp->coverage_file &&
+		    strata_save(&strata, exp->coverage_file))
+			die("could not write coverage file");
+	}
+	if (group->classes) {
+		group->classes = NULL;
+		strata_free(&strata);
 	}
-	free(phys_addrs);
 }
 
 static void on_sigalarm(int signo)
 {
 	/*fprintf(stderr, "SIGALARM\n");*/
-	exit(0);
+	time_is_up = 1;
+}
+
+/* Report the cycles per cache line of every kernel when running
+ * out of L1, so that the arithmetic overhead of the kernels can be
+ * checked against the COLD/HOT numbers.
+ */
+static void kernel_self_check(FILE *outfile)
+{
+	int pattern, wcycle, isa, nt;
+	touch_kernel_t kernel;
+	char name[16];
+
+	fprintf(outfile, "# scalar kernels\n# %6s", "WCYCLE");
+	for (pattern = 0; pattern < NUM_PATTERNS; pattern++)
+		fprintf(outfile, ", %8s", access_pattern_name(pattern));
+	fprintf(outfile, "\n");
+
+	for (wcycle = 0; wcycle <= MAX_KERNEL_WCYCLE + 1; wcycle++) {
+		fprintf(outfile, "  %6d", wcycle);
+		for (pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+			kernel = select_touch_kernel(pattern, wcycle);
+			fprintf(outfile, ", %8.2f",
+				kernel_cycles_per_line(kernel, pattern, wcycle));
+		}
+		fprintf(outfile, "\n");
+	}
+
+	fprintf(outfile, "# vector kernels (WCYCLE = 4)\n# %9s", "ISA");
+	for (pattern = 0; pattern < NUM_PATTERNS; pattern++)
+		fprintf(outfile, ", %8s", access_pattern_name(pattern));
+	fprintf(outfile, "\n");
+
+	for (isa = ISA_SCALAR + 1; isa < NUM_ISAS; isa++) {
+		if (!touch_isa_supported(isa))
+			continue;
+		for (nt = 0; nt <= 1; nt++) {
+			snprintf(name, sizeof(name), "%s%s",
+				 touch_isa_name(isa), nt ? "-nt" : "");
+			fprintf(outfile, "  %9s", name);
+			for (pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+				kernel = select_simd_kernel(isa, pattern, nt);
+				if (kernel)
+					fprintf(outfile, ", %8.2f",
+						kernel_cycles_per_line(kernel,
+								       pattern, 4));
+				else
+					fprintf(outfile, ", %8s", "-");
+			}
+			fprintf(outfile, "\n");
+		}
+	}
+}
+
+/* Copy the samples of a campaign worker (binary records, without
+ * header) to out, renumbering the COUNT column so that the merged
+ * trace stays consistent.
+ */
+static void merge_trace(struct trace *out, FILE *part, unsigned long *counter)
+{
+	struct trace_record rec;
+	uint64_t *phys;
+	int ret;
+
+	phys = malloc(sizeof(uint64_t) * out->num_pages);
+	if (!phys)
+		die("out of memory");
+
+	rewind(part);
+	while ((ret = trace_read(part, sizeof(rec), out->num_pages,
+				 &rec, phys)) == 1) {
+		rec.count = (*counter)++;
+		if (trace_write(out, &rec, phys))
+			die("could not write trace");
+	}
+	if (ret < 0)
+		fprintf(stderr, "Worker trace is truncated.\n");
+	free(phys);
+	fclose(part);
+}
+
+/* Topology-partitioned campaign: run one measuring process per LLC
+ * domain in parallel (preemptions and intra-domain migrations), then
+ * an exclusive phase with only cross-domain migrations.
+ */
+static void run_campaign(struct trace *out, int num_cpus,
+			 struct experiment *exp, int exit_after, int writer_cpu)
+{
+	static int domain_of[CPU_SETSIZE];
+	static struct cpu_group groups[CPU_SETSIZE];
+	static struct cpu_group all;
+	FILE *parts[CPU_SETSIZE];
+	pid_t workers[CPU_SETSIZE];
+	struct trace part_trace;
+	struct trace_writer writer;
+	unsigned long counter = 1;
+	int num_domains, d, cpu, status;
+
+	num_domains = get_llc_domains(num_cpus, domain_of);
+
+	memset(groups, 0, sizeof(groups));
+	all.num = 0;
+	all.domain_of = domain_of;
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		d = domain_of[cpu];
+		groups[d].cpus[groups[d].num++] = cpu;
+		all.cpus[all.num++] = cpu;
+	}
+	for (d = 0; d < num_domains; d++)
+		groups[d].summary = summaries ? &summaries[d] : NULL;
+	all.summary = summaries ? &summaries[num_domains] : NULL;
+
+	for (d = 0; d < num_domains; d++) {
+		parts[d] = tmpfile();
+		if (!parts[d])
+			die("could not create worker trace");
+		fflush(out->file);
+		workers[d] = fork();
+		if (workers[d] == -1)
+			die("fork failed");
+		if (workers[d] == 0) {
+			/* memory locks are not inherited */
+			if (!exp->best_effort && lock_memory() != 0)
+				die("Could not lock memory.");
+			if (exit_after > 0)
+				alarm(exit_after);
+			srandom(time(NULL) + d);
+			use_arena_slice(d, num_domains);
+			if (trace_init(&part_trace, parts[d], TRACE_BINARY,
+				       out->num_pages))
+				die("out of memory");
+			part_trace.numa_node = exp->numa_node;
+			/* the inherited handle is for the parent's pages */
+			pagemap_close(&pagemap);
+			open_pagemap();
+			part_trace.pagemap = &pagemap;
+			/* ... and so are the counters */
+			if (exp->counters) {
+				perf_group_close(&perf);
+				open_counters();
+			}
+			start_writer(&writer, &part_trace, writer_cpu);
+			run_experiment(&writer, &groups[d], exp);
+			stop_writer(&writer);
+			if (fclose(parts[d]))
+				die("could not write worker trace");
+			exit(0);
+		}
+	}
+
+	for (d = 0; d < num_domains; d++) {
+		while (waitpid(workers[d], &status, 0) == -1) {
+			if (errno != EINTR)
+				die("waitpid failed");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			fprintf(stderr, "Worker for LLC domain %d failed.\n", d);
+		merge_trace(out, parts[d], &counter);
+	}
+
+	/* cross-domain migrations, with the whole machine to ourselves */
+	if (num_domains > 1) {
+		if (exit_after > 0)
+			alarm(exit_after);
+		start_writer(&writer, out, writer_cpu);
+		run_experiment(&writer, &all, exp);
+		stop_writer(&writer);
+	}
+}
+
+
+/* "KB[:PATTERN[:WRITECYCLE]]" */
+static int parse_preemptor(char *spec, struct experiment *exp)
+{
+	char *pattern, *wcycle = NULL;
+
+	pattern = strchr(spec, ':');
+	if (pattern) {
+		*pattern++ = '\0';
+		wcycle = strchr(pattern, ':');
+		if (wcycle)
+			*wcycle++ = '\0';
+		if (parse_access_pattern(pattern, &exp->preempt_pattern))
+			return -1;
+	}
+	exp->preempt_kb = atoi(spec);
+	if (wcycle)
+		exp->preempt_wcycle = atoi(wcycle);
+	return exp->preempt_kb > 0 && exp->preempt_wcycle >= 0 ? 0 : -1;
+}
+
+/* Values of a parameter that is swept (-s, -w, -x, -y). */
+#define MAX_SWEEP_VALUES 256
+
+struct sweep {
+	int num;
+	int values[MAX_SWEEP_VALUES];
+};
+
+/* Comma-separated values or ranges FIRST-LAST[:+STEP|:xFACTOR],
+ * e.g. "0,2-4" or "1-1024:x2".
+ */
+static int parse_sweep(const char *spec, struct sweep *sweep)
+{
+	long first, last, step, value;
+	int geometric;
+	char *end;
+
+	sweep->num = 0;
+	do {
+		first = strtol(spec, &end, 10);
+		if (end == spec)
+			return -1;
+		last = first;
+		step = 1;
+		geometric = 0;
+		spec = end;
+		if (*spec == '-') {
+			last = strtol(spec + 1, &end, 10);
+			if (end == spec + 1 || last < first)
+				return -1;
+			spec = end;
+			if (*spec == ':') {
+				geometric = spec[1] == 'x';
+				if (spec[1] != 'x' && spec[1] != '+')
+					return -1;
+				step = strtol(spec + 2, &end, 10);
+				if (end == spec + 2 || step < 1 + geometric)
+					return -1;
+				spec = end;
+			}
+			if (geometric && first <= 0)
+				return -1;
+		}
+		for (value = first; value <= last;
+		     value = geometric ? value * step : value + step) {
+			if (sweep->num == MAX_SWEEP_VALUES)
+				return -1;
+			sweep->values[sweep->num++] = value;
+		}
+	} while (*spec == ',' && *++spec);
+	return *spec ? -1 : 0;
+}
+
+static void auto_name(char *fname, size_t len, const char *prefix,
+		      struct experiment *exp, enum trace_format format)
+{
+	struct utsname utsname;
+	char preempt_name[32];
+
+	uname(&utsname);
+	preempt_name[0] = '\0';
+	if (exp->preempt_kb)
+		snprintf(preempt_name, sizeof(preempt_name),
+			 "_preempt=%d", exp->preempt_kb);
+	snprintf(fname, len,
+		 "%s_host=%s_wss=%d_wcycle=%d_smin=%d_smax=%d"
+		 "_pattern=%s%s%s%s%s%s%s%s%s%s.%s",
+		 prefix,
+		 utsname.nodename, exp->wss, exp->write_cycle,
+		 exp->sleep_min, exp->sleep_max,
+		 access_pattern_name(exp->pattern),
+		 exp->isa != ISA_SCALAR ? "_isa=" : "",
+		 exp->isa != ISA_SCALAR ? touch_isa_name(exp->isa) : "",
+		 exp->nontemporal ? "-nt" : "",
+		 exp->backing != BACKING_ANON ? "_backing=" : "",
+		 exp->backing != BACKING_ANON ?
+		 backing_mode_name(exp->backing) : "",
+		 exp->colors ? "_colors=" : "",
+		 exp->colors ? exp->colors : "",
+		 preempt_name,
+		 exp->handoff ? "_handoff" : "",
+		 format == TRACE_BINARY ? "bin" : "csv");
+}
+
+/* Substitute {wss}, {wcycle}, {smin} and {smax} in an -o template. */
+static void expand_name(char *fname, size_t len, const char *tmpl,
+			struct experiment *exp)
+{
+	static const char *keys[] = {"{wss}", "{wcycle}", "{smin}", "{smax}"};
+	int values[] = {exp->wss, exp->write_cycle,
+			exp->sleep_min, exp->sleep_max};
+	size_t pos = 0;
+	int i, n;
+
+	while (*tmpl && pos + 1 < len) {
+		for (i = 0; i < 4; i++)
+			if (!strncmp(tmpl, keys[i], strlen(keys[i])))
+				break;
+		if (i < 4) {
+			n = snprintf(fname + pos, len - pos, "%d", values[i]);
+			pos = pos + n < len ? pos + n : len - 1;
+			tmpl += strlen(keys[i]);
+		} else
+			fname[pos++] = *tmpl++;
+	}
+	fname[pos] = '\0';
 }
 
+/* Measure one configuration into out. */
+static void run_configuration(FILE *out, struct experiment *exp,
+			      enum trace_format format, int num_cpus,
+			      int campaign, int repetitions, int exit_after,
+			      int writer_cpu)
+{
+	static int domain_of[CPU_SETSIZE];
+	const char *counter_names[NUM_PERF_SLOTS];
+	struct trace trace;
+	struct trace_writer writer;
+	struct cpu_group *group;
+	struct summary_key key;
+	FILE *metafile;
+	size_t meta_len;
+	char *meta;
+	int i;
+
+	time_is_up = 0;
+	if (exit_after > 0 && !campaign)
+		alarm(exit_after);
+
+	if (exp->summary_file) {
+		expand_name(summary_path, sizeof(summary_path),
+			    exp->summary_file, exp);
+		/* entries of other configurations in the file stay apart */
+		memset(&key, 0, sizeof(key));
+		key.wss = exp->wss;
+		key.write_cycle = exp->write_cycle;
+		key.sleep_min = exp->sleep_min;
+		key.sleep_max = exp->sleep_max;
+		snprintf(key.pattern, sizeof(key.pattern), "%s",
+			 access_pattern_name(exp->pattern));
+		summary_init(&summary_base, &key);
+		if (summary_load(&summary_base, summary_path))
+			die("could not read summary file");
+		/* workers of a campaign, then the cross-domain phase */
+		num_summaries = campaign ?
+			get_llc_domains(num_cpus, domain_of) + 1 : 1;
+		summaries = mmap(NULL, sizeof(struct summary) * num_summaries,
+				 PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (summaries == MAP_FAILED)
+			die("could not map summaries");
+		for (i = 0; i < num_summaries; i++)
+			summary_init(&summaries[i], &key);
+		summary_written = tsc_begin();
+	}
+
+	metafile = open_memstream(&meta, &meta_len);
+	if (!metafile)
+		die("out of memory");
+
+	if (exp->best_effort) {
+		fprintf(metafile, "\n[!!!] WARNING: running in best-effort mode "
+		                  "=> all measurements are unreliable!\n\n");
+	}
+
+	print_metadata(metafile, exp);
+	fprintf(metafile, "# writer_cpu=%d\n", writer_cpu);
+	if (campaign)
+		fprintf(metafile, "# campaign: %d LLC domain(s) among %d CPU(s)\n",
+			get_llc_domains(num_cpus, domain_of), num_cpus);
+	fclose(metafile);
+
+	if (trace_init(&trace, out, format, wss_pages(exp->wss)))
+		die("out of memory");
+	trace.numa_node = exp->numa_node;
+	trace.tsc_khz = tsc.mhz * 1000.0 + 0.5;
+	if (exp->handoff &&
+	    trace_add_field(&trace, "HANDOFF", FIELD_U64,
+			    offsetof(struct trace_record, handoff), 8))
+		die("out of memory");
+	if (exp->counters) {
+		for (i = 0; i < NUM_PERF_SLOTS; i++)
+			counter_names[i] = perf_slot_name(&perf, i);
+		if (trace_add_counters(&trace, counter_names))
+			die("out of memory");
+	}
+	if (trace_write_header(&trace, meta))
+		die("could not write trace");
+	free(meta);
+	trace.pagemap = &pagemap;
+	mark_polluters();
+
+	if (campaign) {
+		for (i = 0; i < repetitions && !time_is_up; i++)
+			run_campaign(&trace, num_cpus, exp, exit_after,
+				     writer_cpu);
+	} else {
+		group = calloc(1, sizeof(*group));
+		if (!group)
+			die("out of memory");
+		for (i = 0; i < num_cpus; i++)
+			group->cpus[group->num++] = i;
+		group->summary = summaries;
+
+		start_writer(&writer, &trace, writer_cpu);
+		for (i = 0; i < repetitions; i++)
+			run_experiment(&writer, group, exp);
+		stop_writer(&writer);
+		free(group);
+	}
+	alarm(0);
+
+	if (summaries) {
+		write_summary();
+		munmap(summaries, sizeof(struct summary) * num_summaries);
+		summaries = NULL;
+		num_summaries = 0;
+	}
+	trace_free(&trace);
+	if (num_polluters)
+		report_polluters(out, format);
+}
 
 static void usage(char *error) {
 	if (error)
@@ -340,7 +1575,12 @@ static void usage(char *error) {
 "Usage: cache_cost [-m PROCS] [-w WRITECYCLE] [-s WSS] [-x MINIMUM SLEEP TIME]\n"
 "                  [-y MAXIMUM SLEEP TIME] [-n] [-c SAMPLES] [-l DURATION] \n"
 "                  [-o FILENAME] [-h] [-b] [-R REPETITIONS]\n"
-"                  [-P PREFIX]\n"
+"                  [-P PREFIX] [-T] [-a PATTERN] [-S STRIDE] [-K]\n"
+"                  [-k ISA] [-N] [-B] [-H CPU] [-M BACKING]\n"
+"                  [-A [touch:|bind:]NODE] [-C [NUM:]COLORS] [-E]\n"
+"                  [-F KB[:PATTERN[:WRITECYCLE]]] [-X] [-D] [-V FILE]\n"
+"                  [-Q STAT:WIDTH] [-u] [-Y FILE] [-z]\n"
+"                  [-G KB[:PATTERN[:WRITECYCLE[:RATE[:UNIT]]]]]\n"
 "Options:\n"
 "       -b: Run as a best-effort task (for debugging, NOT for measurements)\n"
 "       -m: Enable migrations among the first PROCS processors. \n"
@@ -350,39 +1590,165 @@ static void usage(char *error) {
 "           Example: WRITECYCLE = 3 means that 1/3 of the operations are writes.\n"
 "           Use 0 for read-only.\n"
 "       -s: WSS size in kB.\n"
+"           -s, -w, -x and -y also take lists of values and ranges\n"
+"           FIRST-LAST[:+STEP|:xFACTOR], e.g. -s 1-1024:x2 -w 0,2-5.\n"
+"           Every combination is measured in this process, into its\n"
+"           own file (-n or an -o template); -x and -y lists pair up\n"
+"           (e.g., -x 0,1000 -y 1000,2000).\n"
+"       -a: Access pattern: seq (default), stride, random (random\n"
+"           permutation of cache lines), or chase (dependent loads\n"
+"           through a shuffled ring of cache lines).\n"
+"       -S: Stride in bytes for the stride pattern (default 256).\n"
+"       -k: Touch the working set with vector loads/stores: sse2, avx2,\n"
+"           avx512, or auto (widest supported by this CPU). Default is\n"
+"           scalar. Vector kernels write every WRITECYCLE-th vector.\n"
+"           Not available for the chase pattern.\n"
+"       -N: With -k, write with non-temporal (streaming) stores.\n"
+"       -M: Memory backing of the working sets: anon-4k (default),\n"
+"           thp (transparent huge pages), hugetlb-2m, hugetlb-1g\n"
+"           (need reserved huge pages), shm (POSIX shared memory),\n"
+"           file (temporary file) or file:PATH.\n"
+"       -A: Place the working sets on NUMA node NODE, by binding them\n"
+"           to it (bind:, the default) or by first touch from a CPU\n"
+"           of the node (touch:; -T needs -M shm or file). The home\n"
+"           node of each sample is recorded (NODE). NUMA flags samples\n"
+"           during which NUMA balancing moved pages (1; MOVED counts\n"
+"           them) or with pages off NODE (2).\n"
+"       -C: Build the working sets from pages of the LLC page colors\n"
+"           COLORS (e.g., 0-7,16), in round-robin order. NUM is the\n"
+"           number of colors (default: from the LLC geometry). The\n"
+"           arena shrinks to what the scarcest color provides. Needs\n"
+"           4 KB backing pages and root; -T needs -M shm or file.\n"
+"       -E: Record performance counter deltas of each timed phase:\n"
+"           LLC misses, dTLB load misses, instructions and reference\n"
+"           cycles (user space only). Without a hardware PMU, context\n"
+"           switches, page faults, CPU migrations and task clock (ns)\n"
+"           are recorded instead; the column names tell which. The\n"
+"           timed phases run with interrupts off, so the counters\n"
+"           must be readable with rdpmc unless -b is given.\n"
+"       -K: Self-check: print the cycles per cache line of each touch\n"
+"           kernel on an L1-resident buffer, then exit.\n"
+"       -F: Preempt with a SCHED_FIFO thread of higher priority that\n"
+"           wakes up on the target CPU halfway through each sleep and\n"
+"           traverses its own KB-sized footprint with PATTERN (default\n"
+"           seq) and WRITECYCLE (default 0, read-only) before it\n"
+"           blocks again. Without -F, only other load on the host\n"
+"           evicts cache contents during the sleep.\n"
+"       -G: Start a polluter thread on each CPU that neither measures\n"
+"           (see -m) nor runs the writer (-H). Each traverses its own\n"
+"           KB-sized footprint with PATTERN (default seq) and\n"
+"           WRITECYCLE (default 0) over and over, paced to RATE\n"
+"           (default 0: as fast as it can) in UNIT: mbps (MB/s, the\n"
+"           default) or llc (thousands of LLC misses per second,\n"
+"           needs a PMU). The bandwidth they achieve is printed\n"
+"           after each configuration and appended to CSV traces\n"
+"           (# polluter_mbps).\n"
+"       -X: Migrate by handoff: one measuring thread is pinned to each\n"
+"           CPU and spins until it is handed the working set, instead\n"
+"           of one thread that calls sched_setaffinity(). The cycles\n"
+"           the handoff takes are recorded (HANDOFF). The spinning\n"
+"           threads occupy their CPUs, so the trace writer needs\n"
+"           one of the others (-H, by default the last CPU).\n"
+"       -D: Stratified CPU pairs: sort the (source, target) pairs by\n"
+"           the closest cache they share (preemption, L1, L2, ...,\n"
+"           memory) and always serve the class with the fewest\n"
+"           samples, using its least covered pair. -c SAMPLES is then\n"
+"           the number of samples per class.\n"
+"       -V: With -D, keep per-pair coverage counts in FILE across\n"
+"           runs (implies -D).\n"
+"       -Q: Stop once STAT (mean, p99 or max) of the CPMD of every\n"
+"           migration class is known to within WIDTH (relative, e.g.\n"
+"           0.05): the 95%% confidence interval of the mean or of the\n"
+"           99th percentile, or, for max, the growth of the maximum\n"
+"           over the second half of the samples. Intervals narrower\n"
+"           than the timer jitter always suffice. -c and -l remain\n"
+"           hard caps; why the run stopped is printed at the end.\n"
 "       -x: Minimum sleep time between preemptions/migrations.\n"
 "       -y: Maximum sleep time between preemptions/migrations.\n"
 "       -n: Automatically name output files.\n"
 "       -P: Prefix automatically generated name with PREFIX.\n"
 "       -c: Number of generated samples of preemptions and migrations.\n"
 "       -l: Duration of the execution in seconds.\n"
-"       -o: Name of output file.\n"
+"       -o: Name of output file. In a sweep, {wss}, {wcycle}, {smin}\n"
+"           and {smax} are replaced by the values of each configuration.\n"
+"       -u: Skip configurations whose output file already exists.\n"
+"       -Y: Keep streaming statistics per migration class and phase\n"
+"           (count, min, max, mean, variance and a log-linear\n"
+"           histogram) and merge them into FILE, every %d seconds\n"
+"           and at the end. Entries are per WSS, write cycle, sleep\n"
+"           range and access pattern; those of other configurations\n"
+"           stay. FILE takes the same template as -o.\n"
+"       -z: Summary only: with -Y, write no samples to the trace.\n"
+"       -B: Write a binary trace (convert it to CSV with trace2csv).\n"
+"       -H: Housekeeping CPU that the trace writer thread runs on.\n"
+"           Default: the last online CPU if it does not measure,\n"
+"           otherwise the writer is not pinned.\n"
 "       -R: repeat the experiment several times\n"
-"       -h: Show this message.\n");
+"       -T: Topology-partitioned campaign: measure in parallel in each\n"
+"           LLC domain among the first PROCS processors, then perform\n"
+"           cross-domain migrations in a separate, exclusive phase.\n"
+"           With -l, the duration applies to each phase.\n"
+"       -h: Show this message.\n", SUMMARY_INTERVAL);
 	exit(1);
 }
 
 
-#define OPTSTR "m:w:l:s:o:x:y:nc:hbR:P:"
+#define OPTSTR "m:w:l:s:o:x:y:nc:hbR:P:Ta:S:Kk:NBH:M:A:C:EF:G:XDV:Q:uY:z"
 
 int main(int argc, char** argv)
 {
 	int num_cpus = 1; /* only do preemptions by default */
-	int wss = 64;     /* working set size, in kb */
-	int sleep_min = 0;
-	int sleep_max = 1000;
+	struct experiment exp = {
+		.wss = 64,
+		.sleep_min = 0,
+		.sleep_max = 1000,
+		.write_cycle = 0,
+		.sample_count = 0,
+		.best_effort = 0,
+		.pattern = PATTERN_SEQ,
+		.stride = 256,
+		.isa = ISA_SCALAR,
+		.nontemporal = 0,
+		.backing = BACKING_ANON,
+		.numa_node = -1,
+		.numa_touch = 0,
+		.colors = NULL,
+		.counters = 0,
+		.preempt_kb = 0,
+		.preempt_pattern = PATTERN_SEQ,
+		.preempt_wcycle = 0,
+		.pollute = {
+			.footprint = 0,
+			.pattern = PATTERN_SEQ,
+			.write_cycle = 0,
+			.unit = RATE_MBPS,
+			.rate = 0,
+		},
+		.handoff = 0,
+		.stratified = 0,
+		.coverage_file = NULL,
+		.adaptive = 0,
+		.summary_file = NULL,
+		.summary_only = 0,
+	};
+	const char *backing_path = NULL;
 	int exit_after = 0; /* seconds */
-	int write_cycle = 0; /* every nth cycle is a write; 0 means read-only  */
 	FILE* out = stdout;
+	const char *out_name = NULL;
 	char fname[255];
 	char *prefix = "pmo";
-	struct utsname utsname;
 	int auto_name_file = 0;
-	int sample_count = 0;
+	int keep_existing = 0;
 	int opt;
-	int best_effort = 0;
 	int repetitions = 1;
-	int i;
+	int campaign = 0;
+	enum trace_format format = TRACE_CSV;
+	int writer_cpu = -1;
+	static struct sweep wss_values = {1, {64}};
+	static struct sweep wcycle_values = {1, {0}};
+	static struct sweep sleep_mins = {1, {0}};
+	static struct sweep sleep_maxs = {1, {1000}};
+	int num_sleeps, si, wi, ki, i;
 
 	srand (time(NULL));
 
@@ -392,21 +1758,31 @@ int main(int argc, char** argv)
 			num_cpus = atoi(optarg);
 			break;
 		case 'c':
-			sample_count = atoi(optarg);
+			exp.sample_count = atoi(optarg);
 			break;
 		case 's':
-			wss = atoi(optarg);
+			if (parse_sweep(optarg, &wss_values))
+				usage("Invalid WSS list.");
 			break;
 		case 'w':
-			write_cycle = atoi(optarg);
+			if (parse_sweep(optarg, &wcycle_values))
+				usage("Invalid write cycle list.");
+			break;
+		case 'a':
+			if (parse_access_pattern(optarg, &exp.pattern))
+				usage("Unknown access pattern.");
+			break;
+		case 'S':
+			exp.stride = atoi(optarg);
 			break;
 		case 'l':
 			exit_after = atoi(optarg);
 			break;
 		case 'o':
-			out = fopen(optarg, "w");
-			if (out == NULL)
-				usage("could not open file");
+			out_name = optarg;
+			break;
+		case 'u':
+			keep_existing = 1;
 			break;
 		case 'n':
 			auto_name_file = 1;
@@ -415,19 +1791,94 @@ int main(int argc, char** argv)
 			prefix = optarg;
 			break;
 		case 'x':
-			sleep_min = atoi(optarg);
+			if (parse_sweep(optarg, &sleep_mins))
+				usage("Invalid minimum sleep time list.");
 			break;
 		case 'y':
-			sleep_max = atoi(optarg);
+			if (parse_sweep(optarg, &sleep_maxs))
+				usage("Invalid maximum sleep time list.");
 			break;
 		case 'b':
-			best_effort = 1;
+			exp.best_effort = 1;
 			break;
 		case 'R':
 			repetitions = atoi(optarg);
 			if (repetitions <= 0)
 				usage("invalid number of repetitions");
 			break;
+		case 'T':
+			campaign = 1;
+			break;
+		case 'k':
+			if (parse_touch_isa(optarg, &exp.isa))
+				usage("Unknown ISA.");
+			if (!touch_isa_supported(exp.isa))
+				usage("ISA not supported by this CPU.");
+			break;
+		case 'N':
+			exp.nontemporal = 1;
+			break;
+		case 'B':
+			format = TRACE_BINARY;
+			break;
+		case 'M':
+			if (parse_backing(optarg, &exp.backing, &backing_path))
+				usage("Unknown backing mode.");
+			break;
+		case 'A':
+			if (!strncmp(optarg, "touch:", 6)) {
+				exp.numa_touch = 1;
+				optarg += 6;
+			} else if (!strncmp(optarg, "bind:", 5))
+				optarg += 5;
+			exp.numa_node = atoi(optarg);
+			if (exp.numa_node < 0 ||
+			    exp.numa_node >= numa_num_nodes())
+				usage("Invalid NUMA node.");
+			break;
+		case 'C':
+			exp.colors = optarg;
+			break;
+		case 'E':
+			exp.counters = 1;
+			break;
+		case 'F':
+			if (parse_preemptor(optarg, &exp))
+				usage("Invalid preemptor.");
+			break;
+		case 'G':
+			if (parse_polluter_spec(optarg, &exp.pollute))
+				usage("Invalid polluter.");
+			break;
+		case 'X':
+			exp.handoff = 1;
+			break;
+		case 'D':
+			exp.stratified = 1;
+			break;
+		case 'V':
+			exp.stratified = 1;
+			exp.coverage_file = optarg;
+			break;
+		case 'Q':
+			if (parse_stop_rule(optarg, &exp.stop))
+				usage("Invalid stop rule.");
+			exp.adaptive = 1;
+			break;
+		case 'Y':
+			exp.summary_file = optarg;
+			break;
+		case 'z':
+			exp.summary_only = 1;
+			break;
+		case 'H':
+			writer_cpu = atoi(optarg);
+			if (writer_cpu < 0 || writer_cpu >= num_online_cpus())
+				usage("Invalid housekeeping CPU.");
+			break;
+		case 'K':
+			kernel_self_check(stdout);
+			exit(0);
 		case 'h':
 			usage(NULL);
 			break;
@@ -444,57 +1895,157 @@ int main(int argc, char** argv)
 	if (num_cpus <= 0)
 		usage("Number of CPUs must be positive.");
 
-	if (wss <= 0)
-		usage("The working set size must be positive.");
+	for (i = 0; i < wss_values.num; i++)
+		if (wss_values.values[i] <= 0)
+			usage("The working set size must be positive.");
+
+	/* sleep ranges pair up */
+	if (sleep_mins.num > 1 && sleep_maxs.num > 1 &&
+	    sleep_mins.num != sleep_maxs.num)
+		usage("-x and -y lists must be of equal length.");
+	num_sleeps = sleep_mins.num > sleep_maxs.num ?
+		sleep_mins.num : sleep_maxs.num;
+	for (i = 0; i < num_sleeps; i++) {
+		exp.sleep_min = sleep_mins.values[sleep_mins.num > 1 ? i : 0];
+		exp.sleep_max = sleep_maxs.values[sleep_maxs.num > 1 ? i : 0];
+		if (exp.sleep_min < 0 || exp.sleep_min > exp.sleep_max)
+			usage("Invalid minimum sleep time");
+	}
+
+	for (i = 0; i < wcycle_values.num; i++)
+		if (wcycle_values.values[i] < 0)
+			usage("Write cycle may not be negative.");
 
-	if (sleep_min < 0 || sleep_min > sleep_max)
-		usage("Invalid minimum sleep time");
+	if (exp.summary_only && !exp.summary_file)
+		usage("Summary only (-z) needs a summary file (-Y).");
 
-	if (write_cycle < 0)
-		usage("Write cycle may not be negative.");
+	/* a sweep writes one file per configuration */
+	if (wss_values.num * wcycle_values.num * num_sleeps > 1 &&
+	    !auto_name_file &&
+	    (!out_name || !strchr(out_name, '{')))
+		usage("A sweep needs -n or an -o template.");
 
-	if (sample_count < 0)
+	if (exp.sample_count < 0)
 		usage("Sample count may not be negative.");
 
+	if (exp.stride <= 0 || exp.stride % CACHE_LINE_SIZE)
+		usage("The stride must be a positive multiple of the cache line size.");
+
 	if (check_migrations(num_cpus) != 0)
 		usage("Invalid CPU range.");
 
-	if (!best_effort && become_posix_realtime_task() != 0)
+	/* keep the trace writer away from the measuring CPUs if possible */
+	if (writer_cpu < 0 && num_online_cpus() > num_cpus)
+		writer_cpu = num_online_cpus() - 1;
+	/* real-time threads spin on all of them: the writer would starve */
+	if (exp.handoff && writer_cpu < num_cpus)
+		usage("Handoff (-X) needs a CPU outside the measuring CPUs "
+		      "for the trace writer (-H).");
+
+	if (exp.isa == ISA_SCALAR) {
+		if (exp.nontemporal)
+			usage("Non-temporal stores need a vector ISA (-k).");
+	} else {
+		exp.kernel = select_simd_kernel(exp.isa, exp.pattern,
+						exp.nontemporal);
+		if (!exp.kernel)
+			usage("No vector kernel for this access pattern.");
+	}
+
+	/* before we become a real-time task: this sleeps */
+	if (tsc_calibrate(&tsc))
+		die("could not calibrate the TSC");
+	if (!tsc.invariant)
+		fprintf(stderr, "Warning: the TSC is not invariant; "
+			"cycles may not be comparable across CPUs.\n");
+	/* the timer cannot resolve narrower intervals */
+	exp.stop.floor = tsc.jitter;
+
+	/* copy-on-write would put the pages of workers on their own node */
+	if (exp.numa_touch && campaign && exp.backing != BACKING_SHM &&
+	    exp.backing != BACKING_FILE)
+		usage("First-touch placement with -T needs -M shm or -M file.");
+	map_arena(exp.backing, backing_path);
+	if (exp.numa_node >= 0)
+		place_arena(exp.numa_node, exp.numa_touch);
+	if (exp.colors) {
+		if (arena_backing.page_size != (size_t) getpagesize())
+			usage("Page coloring needs 4 KB backing pages.");
+		/* copy-on-write would give workers pages of any color */
+		if (campaign && exp.backing == BACKING_ANON)
+			usage("Page coloring with -T needs -M shm or -M file.");
+		color_arena(exp.colors);
+	}
+	if (numa_balancing_enabled())
+		fprintf(stderr, "Warning: automatic NUMA balancing is on; "
+			"samples after page moves are flagged (NUMA).\n");
+
+	if (!exp.best_effort && become_posix_realtime_task() != 0)
 		die("Could not become real-time task.");
 
-	if (!best_effort && lock_memory() != 0)
+	if (!exp.best_effort && lock_memory() != 0)
 		die("Could not lock memory.");
 
-	if (auto_name_file) {
-		uname(&utsname);
-		snprintf(fname, 255,
-			 "%s_host=%s_wss=%d_wcycle=%d_smin=%d_smax=%d.csv",
-			 prefix,
-			 utsname.nodename, wss, write_cycle, sleep_min, sleep_max);
-		out = fopen(fname, "w");
-		if (out == NULL) {
-			fprintf(stderr, "Can't open %s.", fname);
-			die("I/O");
-		}
-	}
-
-	if (exit_after > 0) {
+	if (exit_after > 0)
 		signal(SIGALRM, on_sigalarm);
-		alarm(exit_after);
-	}
 
-	if (best_effort) {
-		fprintf(out, "\n[!!!] WARNING: running in best-effort mode "
-		             "=> all measurements are unreliable!\n\n");
+	open_pagemap();
+	if (exp.counters) {
+		open_counters();
+#if defined(__i386__) || defined(__x86_64__)
+		if (!exp.best_effort && !perf.rdpmc)
+			usage("Counters that rdpmc cannot read (-E without a "
+			      "PMU) need best effort mode (-b).");
+#endif
 	}
 
+	exp.pollute.stride = exp.stride;
+	if (exp.pollute.footprint)
+		start_polluters(&exp, num_cpus, writer_cpu);
+
+	/* the matrix of configurations */
+	for (si = 0; si < wss_values.num; si++)
+	for (wi = 0; wi < wcycle_values.num; wi++)
+	for (ki = 0; ki < num_sleeps; ki++) {
+		exp.wss = wss_values.values[si];
+		exp.write_cycle = wcycle_values.values[wi];
+		exp.sleep_min = sleep_mins.values[sleep_mins.num > 1 ? ki : 0];
+		exp.sleep_max = sleep_maxs.values[sleep_maxs.num > 1 ? ki : 0];
+		if (exp.isa == ISA_SCALAR)
+			exp.kernel = select_touch_kernel(exp.pattern,
+							 exp.write_cycle);
+
+		if (auto_name_file || out_name) {
+			if (auto_name_file)
+				auto_name(fname, sizeof(fname), prefix, &exp,
+					  format);
+			else
+				expand_name(fname, sizeof(fname), out_name,
+					    &exp);
+			if (keep_existing && access(fname, F_OK) == 0) {
+				fprintf(stderr, "Skipped: %s exists.\n", fname);
+				continue;
+			}
+			out = fopen(fname, "w");
+			if (out == NULL) {
+				fprintf(stderr, "Can't open %s.", fname);
+				die("I/O");
+			}
+		}
+
+		run_configuration(out, &exp, format, num_cpus, campaign,
+				  repetitions, exit_after, writer_cpu);
+
+		if (fclose(out))
+			die("could not write trace");
+	}
 
-	for (i = 0; i < repetitions; i++)
-		do_random_experiment(out,
-			             num_cpus, wss, sleep_min,
-			             sleep_max, write_cycle,
-			             sample_count,
-			             best_effort);
-	fclose(out);
+	if (exp.pollute.footprint)
+		stop_polluters();
+	pagemap_close(&pagemap);
+	if (exp.counters)
+		perf_group_close(&perf);
+	color_region_free(&arena_colors);
+	backing_unmap(&arena_backing);
 	return 0;
 }
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE /* for mremap() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "topology.h"
+#include "pagemap.h"
+#include "color.h"
+
+/* mappings to leave for everything else */
+#define MAP_COUNT_SLACK 4096
+
+int llc_page_colors(int cpu, size_t page_size)
+{
+	int sets, line_size, colors = 1;
+	unsigned long bytes;
+
+	if (get_llc_geometry(cpu, &sets, &line_size))
+		return 1;
+	bytes = (unsigned long) sets * line_size;
+	while (colors * 2 * page_size <= bytes)
+		colors *= 2;
+	return colors;
+}
+
+static unsigned long max_map_count(void)
+{
+	unsigned long count = 65530; /* kernel default */
+	FILE *f;
+
+	f = fopen("/proc/sys/vm/max_map_count", "r");
+	if (f) {
+		if (fscanf(f, "%lu", &count) != 1)
+			count = 65530;
+		fclose(f);
+	}
+	return count;
+}
+
+/* every moved page is a mapping in the region and leaves a hole in the pool */
+static unsigned long map_count_limit(void)
+{
+	unsigned long count = max_map_count();
+
+	return count > MAP_COUNT_SLACK ? (count - MAP_COUNT_SLACK) / 2 : 0;
+}
+
+int color_region_build(struct color_region *region, void *pool,
+		       size_t pool_len, size_t page_size, int num_colors,
+		       const int *colors, int num, unsigned long max_pages)
+{
+	unsigned long pool_pages = pool_len / page_size;
+	unsigned long *phys = NULL, *next = NULL, *count = NULL;
+	unsigned long i, p, per_color, limit;
+	int *slot = NULL;
+	char *base = MAP_FAILED;
+	void *to;
+	int j, err = ENOMEM;
+
+	phys = malloc(sizeof(unsigned long) * pool_pages);
+	next = malloc(sizeof(unsigned long) * num);
+	count = calloc(num, sizeof(unsigned long));
+	slot = malloc(sizeof(int) * num_colors);
+	if (!phys || !next || !count || !slot)
+		goto out;
+
+	/* fault in the pool */
+	for (p = 0; p < pool_pages; p++)
+		((volatile char *) pool)[p * page_size] = 0;
+	if (get_phys_addrs(0, (unsigned long) pool,
+			   (unsigned long) pool + pool_len,
+			   phys, pool_pages) != pool_pages) {
+		err = errno ? errno : EIO;
+		goto out;
+	}
+
+	/* slot[color]: index of color in colors[], -1 if not chosen */
+	for (j = 0; j < num_colors; j++)
+		slot[j] = -1;
+	for (j = 0; j < num; j++) {
+		if (colors[j] < 0 || colors[j] >= num_colors) {
+			err = EINVAL;
+			goto out;
+		}
+		slot[colors[j]] = j;
+	}
+
+	for (p = 0; p < pool_pages; p++) {
+		/* no PFNs without CAP_SYS_ADMIN */
+		if (!phys[p]) {
+			err = EPERM;
+			goto out;
+		}
+		j = slot[page_color(phys[p], page_size, num_colors)];
+		if (j >= 0)
+			count[j]++;
+	}
+
+	per_color = pool_pages;
+	for (j = 0; j < num; j++)
+		if (count[j] < per_color)
+			per_color = count[j];
+	limit = map_count_limit();
+	if (max_pages && max_pages < limit)
+		limit = max_pages;
+	if (per_color * num > limit)
+		per_color = limit / num;
+	if (!per_color) {
+		err = ENOSPC;
+		goto out;
+	}
+
+	region->pages = per_color * num;
+	region->len = region->pages * page_size;
+	region->page_size = page_size;
+	base = mmap(NULL, region->len, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		err = errno;
+		goto out;
+	}
+
+	/* next[j]: next pool page to look at for color colors[j] */
+	for (j = 0; j < num; j++)
+		next[j] = 0;
+	for (i = 0; i < region->pages; i++) {
+		j = i % num;
+		p = next[j];
+		while (slot[page_color(phys[p], page_size, num_colors)] != j)
+			p++;
+		next[j] = p + 1;
+		to = mremap((char *) pool + p * page_size, page_size,
+			    page_size, MREMAP_MAYMOVE | MREMAP_FIXED,
+			    base + i * page_size);
+		if (to == MAP_FAILED) {
+			err = errno;
+			munmap(base, region->len);
+			base = MAP_FAILED;
+			goto out;
+		}
+	}
+
+	/* the pages that were not picked */
+	munmap(pool, pool_len);
+	region->base = base;
+	err = 0;
+out:
+	free(phys);
+	free(next);
+	free(count);
+	free(slot);
+	errno = err;
+	return err ? -1 : 0;
+}
+
+void color_region_free(struct color_region *region)
+{
+	if (region->base)
+		munmap(region->base, region->len);
+	region->base = NULL;
+}
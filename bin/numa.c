@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "topology.h"
+#include "numa.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+
+/* from linux/mempolicy.h */
+#define MPOL_BIND	2
+#define MPOL_MF_STRICT	(1 << 0)
+#define MPOL_MF_MOVE	(1 << 1)
+
+#define MAX_NODES 1024
+#define MAX_CPUS 4096
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+
+static int read_file(const char *fname, char *buf, size_t len)
+{
+	FILE *f;
+	size_t n;
+
+	f = fopen(fname, "r");
+	if (!f)
+		return -1;
+	n = fread(buf, 1, len - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+	return 0;
+}
+
+int numa_num_nodes(void)
+{
+	char buf[256];
+	int nodes[MAX_NODES];
+	int n;
+
+	if (read_file(NODE_DIR "/possible", buf, sizeof(buf)))
+		return 1;
+	n = parse_cpu_list(buf, nodes, MAX_NODES);
+	return n > 0 ? nodes[n - 1] + 1 : 1;
+}
+
+int numa_node_cpus(int node, int *cpus, int max_cpus)
+{
+	char fname[128];
+	char buf[4096];
+
+	snprintf(fname, sizeof(fname), NODE_DIR "/node%d/cpulist", node);
+	if (read_file(fname, buf, sizeof(buf)))
+		return -1;
+	/* memory-only nodes have an empty list */
+	if (buf[0] == '\n' || buf[0] == '\0')
+		return 0;
+	return parse_cpu_list(buf, cpus, max_cpus);
+}
+
+int numa_node_of_cpu(int cpu)
+{
+	static int cpus[MAX_CPUS];
+	int node, i, n, num_nodes = numa_num_nodes();
+
+	for (node = 0; node < num_nodes; node++) {
+		n = numa_node_cpus(node, cpus, MAX_CPUS);
+		for (i = 0; i < n; i++)
+			if (cpus[i] == cpu)
+				return node;
+	}
+	return 0;
+}
+
+int numa_distance(int from, int to)
+{
+	char fname[128];
+	char buf[4096];
+	char *pos, *end;
+	long dist = -1;
+	int i;
+
+	snprintf(fname, sizeof(fname), NODE_DIR "/node%d/distance", from);
+	if (read_file(fname, buf, sizeof(buf)))
+		return from == to ? 10 : -1;
+
+	/* one distance per node, in node order */
+	pos = buf;
+	for (i = 0; i <= to; i++) {
+		dist = strtol(pos, &end, 10);
+		if (end == pos)
+			return -1;
+		pos = end;
+	}
+	return dist;
+}
+
+int numa_bind(void *addr, size_t len, int node)
+{
+	unsigned long mask[MAX_NODES / BITS_PER_LONG];
+
+	if (node < 0 || node >= MAX_NODES) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(mask, 0, sizeof(mask));
+	mask[node / BITS_PER_LONG] = 1UL << (node % BITS_PER_LONG);
+	return syscall(SYS_mbind, addr, len, MPOL_BIND, mask,
+		       (unsigned long) MAX_NODES + 1,
+		       MPOL_MF_MOVE | MPOL_MF_STRICT);
+}
+
+int numa_page_nodes(void **pages, unsigned long count, int *nodes)
+{
+	/* without target nodes, move_pages() only reports */
+	return syscall(SYS_move_pages, 0, count, pages, NULL, nodes, 0)
+		? -1 : 0;
+}
+
+int numa_balancing_enabled(void)
+{
+	char buf[16];
+
+	if (read_file("/proc/sys/kernel/numa_balancing", buf, sizeof(buf)))
+		return 0;
+	return atoi(buf) != 0;
+}
+
+unsigned long numa_pages_migrated(void)
+{
+	char line[128];
+	unsigned long value = 0;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "numa_pages_migrated %lu", &value) == 1)
+			break;
+	fclose(f);
+	return value;
+}
@@ -1,7 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdint.h>
 
+#include "pagemap.h"
+
 #define PAGEMAP_ENTRY_LEN 8 /* 8 bytes = 64 bits */
 
 /* From Documentation/vm/pagemap.txt:
@@ -18,7 +23,34 @@
 
 #define PFN_MASK 0x7FFFFFFFFFFFFF
 
-static FILE* open_pagemap(pid_t target)
+#define PM_EXCLUSIVE	(1ULL << 56)
+#define PM_FILE		(1ULL << 61)
+#define PM_SWAPPED	(1ULL << 62)
+#define PM_PRESENT	(1ULL << 63)
+
+/* /proc/kpageflags has one 64-bit entry per PFN */
+#define KPF_HUGE	(1ULL << 17)
+#define KPF_THP		(1ULL << 22)
+
+/* cache_flags entries of cached pages have this bit set. Only present
+ * pages are cached: a first-touch fault bumps no vmstat counter.
+ */
+#define PAGE_CACHED	0x80
+
+/* kpageflags entries read with one pread */
+#define KPF_BATCH 512
+
+/* /proc/vmstat events after which cached translations may be stale */
+static const char *remap_events[] = {
+	"pgmigrate_success",
+	"pswpout",
+	"thp_split_pmd",
+	"thp_collapse_alloc",
+	"thp_migration_success",
+	NULL
+};
+
+static int open_pagemap_fd(pid_t target)
 {
 	char fname[64];
 
@@ -29,52 +61,254 @@ static FILE* open_pagemap(pid_t target)
 		snprintf(fname, sizeof(fname), "/proc/%d/pagemap", (int) target);
 	}
 
-	return fopen(fname, "r");
+	return open(fname, O_RDONLY);
 }
 
-static unsigned long get_desc(FILE* pmap, size_t pagesize, unsigned long virt_addr)
+static int read_all(int fd, void *buf, size_t len, off_t offset)
 {
-	unsigned long virt_page_num;
-	off_t offset;
-	uint64_t page_desc;
-
-	virt_page_num  = virt_addr / pagesize;
-	offset = virt_page_num * PAGEMAP_ENTRY_LEN;
-	if (fseek(pmap, offset, SEEK_SET)) {
-		perror("fseek");
-		return 0;
+	char *pos = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, pos, len, offset);
+		if (n <= 0)
+			return -1;
+		pos += n;
+		len -= n;
+		offset += n;
 	}
+	return 0;
+}
+
+/* sum of the remap event counters; changes whenever pages may have moved */
+static uint64_t vm_generation(struct pagemap *pm)
+{
+	char buf[16384];
+	char *line, *value;
+	uint64_t sum = 0;
+	ssize_t n;
+	int i;
 
-	if (fread(&page_desc, PAGEMAP_ENTRY_LEN, 1, pmap) != 1) {
-		perror("fread");
+	if (pm->vmstat_fd < 0)
 		return 0;
+	n = pread(pm->vmstat_fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+
+	for (line = strtok(buf, "\n"); line; line = strtok(NULL, "\n")) {
+		value = strchr(line, ' ');
+		if (!value)
+			continue;
+		*value++ = '\0';
+		for (i = 0; remap_events[i]; i++)
+			if (!strcmp(line, remap_events[i]))
+				sum += strtoull(value, NULL, 10);
 	}
+	return sum;
+}
 
-	return page_desc;
+static unsigned char entry_flags(uint64_t entry)
+{
+	unsigned char flags = 0;
+
+	if (entry & PM_PRESENT)
+		flags |= PAGE_PRESENT;
+	if (entry & PM_SWAPPED)
+		flags |= PAGE_SWAPPED;
+	if (entry & PM_FILE)
+		flags |= PAGE_FILE;
+	if (entry & PM_EXCLUSIVE)
+		flags |= PAGE_EXCLUSIVE;
+	return flags;
 }
 
-unsigned long get_phys_addr(pid_t target, unsigned long virt_addr)
+/* Translate count raw entries into PAGE_* flags. Runs of contiguous
+ * PFNs (e.g., huge pages) share one pread of /proc/kpageflags.
+ */
+static void lookup_flags(struct pagemap *pm, const uint64_t *entries,
+			 unsigned char *flags, size_t count)
 {
-	FILE *pmap;
-	size_t pagesize = getpagesize();
-	unsigned long phys_page_num;
-	unsigned long offset_in_page;
-	uint64_t page_desc;
+	uint64_t kpf[KPF_BATCH];
+	uint64_t pfn;
+	size_t i, j, run;
 
+	for (i = 0; i < count; i++)
+		flags[i] = entry_flags(entries[i]);
 
-	pmap = open_pagemap(target);
-	if (!pmap) {
-		perror("fopen");
-		return 0;
+	if (pm->kpageflags_fd < 0)
+		return;
+
+	for (i = 0; i < count; i += run) {
+		run = 1;
+		pfn = entries[i] & PFN_MASK;
+		if (!(entries[i] & PM_PRESENT) || !pfn)
+			continue;
+		while (i + run < count && run < KPF_BATCH &&
+		       (entries[i + run] & PM_PRESENT) &&
+		       (entries[i + run] & PFN_MASK) == pfn + run)
+			run++;
+		if (read_all(pm->kpageflags_fd, kpf, run * sizeof(uint64_t),
+			     pfn * sizeof(uint64_t)))
+			continue;
+		for (j = 0; j < run; j++) {
+			if (kpf[j] & KPF_THP)
+				flags[i + j] |= PAGE_THP;
+			if (kpf[j] & KPF_HUGE)
+				flags[i + j] |= PAGE_HUGE;
+		}
 	}
+}
 
-	offset_in_page = virt_addr % pagesize;
-	page_desc = get_desc(pmap, pagesize, virt_addr);
-	phys_page_num = page_desc & PFN_MASK;
+int pagemap_open(struct pagemap *pm, pid_t target)
+{
+	memset(pm, 0, sizeof(*pm));
+	pm->page_size = getpagesize();
+	pm->fd = open_pagemap_fd(target);
+	if (pm->fd < 0)
+		return -1;
+	/* both are optional */
+	pm->kpageflags_fd = open("/proc/kpageflags", O_RDONLY);
+	pm->vmstat_fd = open("/proc/vmstat", O_RDONLY);
+	return 0;
+}
 
-	fclose(pmap);
+void pagemap_close(struct pagemap *pm)
+{
+	close(pm->fd);
+	if (pm->kpageflags_fd >= 0)
+		close(pm->kpageflags_fd);
+	if (pm->vmstat_fd >= 0)
+		close(pm->vmstat_fd);
+	free(pm->cache_entries);
+	free(pm->cache_flags);
+	free(pm->buf);
+	pm->cache_entries = NULL;
+	pm->cache_flags = NULL;
+	pm->buf = NULL;
+}
+
+int pagemap_cache_range(struct pagemap *pm, unsigned long start, size_t len)
+{
+	unsigned long first = start / pm->page_size;
+	unsigned long last = (start + len - 1) / pm->page_size;
 
-	return (phys_page_num * pagesize) + offset_in_page;
+	free(pm->cache_entries);
+	free(pm->cache_flags);
+	pm->cache_pages = last - first + 1;
+	pm->cache_first = first;
+	pm->cache_entries = malloc(sizeof(uint64_t) * pm->cache_pages);
+	pm->cache_flags = calloc(pm->cache_pages, 1);
+	if (!pm->cache_entries || !pm->cache_flags) {
+		free(pm->cache_entries);
+		free(pm->cache_flags);
+		pm->cache_entries = NULL;
+		pm->cache_flags = NULL;
+		pm->cache_pages = 0;
+		return -1;
+	}
+	pm->generation = vm_generation(pm);
+	return 0;
+}
+
+void pagemap_invalidate(struct pagemap *pm)
+{
+	if (pm->cache_flags)
+		memset(pm->cache_flags, 0, pm->cache_pages);
+}
+
+/* Point *entries and *flags at count translations starting at
+ * virtual page first, reading them from the pagemap if necessary.
+ */
+static int get_entries(struct pagemap *pm, unsigned long first, size_t count,
+		       uint64_t **entries, unsigned char **flags)
+{
+	unsigned long idx = first - pm->cache_first;
+	uint64_t generation;
+	size_t i;
+
+	if (first >= pm->cache_first &&
+	    first + count <= pm->cache_first + pm->cache_pages) {
+		generation = vm_generation(pm);
+		if (generation != pm->generation) {
+			pagemap_invalidate(pm);
+			pm->generation = generation;
+		}
+		*entries = pm->cache_entries + idx;
+		*flags = pm->cache_flags + idx;
+		for (i = 0; i < count && ((*flags)[i] & PAGE_CACHED); i++)
+			;
+		if (i == count)
+			return 0;
+	} else {
+		if (pm->buf_len < count) {
+			free(pm->buf);
+			/* entries first, then the flags */
+			pm->buf = malloc((sizeof(uint64_t) + 1) * count);
+			pm->buf_len = pm->buf ? count : 0;
+			if (!pm->buf)
+				return -1;
+		}
+		*entries = pm->buf;
+		*flags = (unsigned char *) (pm->buf + count);
+	}
+
+	if (read_all(pm->fd, *entries, count * PAGEMAP_ENTRY_LEN,
+		     first * PAGEMAP_ENTRY_LEN)) {
+		perror("pread");
+		memset(*flags, 0, count);
+		return -1;
+	}
+	lookup_flags(pm, *entries, *flags, count);
+	for (i = 0; i < count; i++)
+		if ((*entries)[i] & PM_PRESENT)
+			(*flags)[i] |= PAGE_CACHED;
+	return 0;
+}
+
+size_t pagemap_resolve(struct pagemap *pm,
+		       unsigned long virt_addr_start,
+		       unsigned long virt_addr_end,
+		       unsigned long *phys_addr,
+		       unsigned int *flags,
+		       size_t num_addr)
+{
+	unsigned long offset_in_page = virt_addr_start % pm->page_size;
+	uint64_t *entries;
+	unsigned char *page_flags;
+	size_t i, count;
+
+	if (virt_addr_end <= virt_addr_start)
+		return 0;
+	/* one page per page_size step, as in get_phys_addrs() */
+	count = (virt_addr_end - virt_addr_start + pm->page_size - 1)
+		/ pm->page_size;
+	if (count > num_addr)
+		count = num_addr;
+
+	if (get_entries(pm, virt_addr_start / pm->page_size, count,
+			&entries, &page_flags))
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		if (entries[i] & PM_PRESENT)
+			phys_addr[i] = (entries[i] & PFN_MASK) * pm->page_size
+				+ offset_in_page;
+		else
+			phys_addr[i] = 0;
+		if (flags)
+			flags[i] = page_flags[i] & ~PAGE_CACHED;
+	}
+	return count;
+}
+
+unsigned long get_phys_addr(pid_t target, unsigned long virt_addr)
+{
+	unsigned long phys_addr;
+
+	if (!get_phys_addrs(target, virt_addr, virt_addr + 1, &phys_addr, 1))
+		return 0;
+	return phys_addr;
 }
 
 size_t get_phys_addrs(
@@ -84,30 +318,20 @@ size_t get_phys_addrs(
 	unsigned long *phys_addr,
 	size_t num_addr)
 {
-	FILE *pmap;
-	size_t pagesize = getpagesize();
-	unsigned long phys_page_num;
-	unsigned long offset_in_page;
-	uint64_t page_desc;
-	unsigned long virt_addr;
-	size_t count = 0;
-
-	pmap = open_pagemap(target);
-	if (!pmap) {
-		perror("fopen");
+	struct pagemap pm;
+	size_t count;
+
+	if (pagemap_open(&pm, target)) {
+		perror("open");
 		return 0;
 	}
-
-	virt_addr = virt_addr_start;
-	while (virt_addr < virt_addr_end && count < num_addr) {
-		offset_in_page = virt_addr % pagesize;
-		page_desc = get_desc(pmap, pagesize, virt_addr);
-		phys_page_num = page_desc & PFN_MASK;
-		phys_addr[count++] = (phys_page_num * pagesize) + offset_in_page;
-		virt_addr += pagesize;
+	/* no flags: don't bother with kpageflags */
+	if (pm.kpageflags_fd >= 0) {
+		close(pm.kpageflags_fd);
+		pm.kpageflags_fd = -1;
 	}
-
-
-	fclose(pmap);
+	count = pagemap_resolve(&pm, virt_addr_start, virt_addr_end,
+				phys_addr, NULL, num_addr);
+	pagemap_close(&pm);
 	return count;
 }
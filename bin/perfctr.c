@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+struct perf_event_desc {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+};
+
+static const struct perf_event_desc hw_events[NUM_PERF_SLOTS] = {
+	[PERF_LLC_MISSES] = { "LLC", PERF_TYPE_HARDWARE,
+			      PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_DTLB_MISSES] = { "DTLB", PERF_TYPE_HW_CACHE,
+			       PERF_COUNT_HW_CACHE_DTLB |
+			       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	[PERF_INSTRUCTIONS] = { "INSTR", PERF_TYPE_HARDWARE,
+				PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_REF_CYCLES] = { "REFCYC", PERF_TYPE_HARDWARE,
+			      PERF_COUNT_HW_REF_CPU_CYCLES },
+};
+
+static const struct perf_event_desc sw_events[NUM_PERF_SLOTS] = {
+	[PERF_LLC_MISSES] = { "CSW", PERF_TYPE_SOFTWARE,
+			      PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[PERF_DTLB_MISSES] = { "PGFLT", PERF_TYPE_SOFTWARE,
+			       PERF_COUNT_SW_PAGE_FAULTS },
+	[PERF_INSTRUCTIONS] = { "MIGR", PERF_TYPE_SOFTWARE,
+				PERF_COUNT_SW_CPU_MIGRATIONS },
+	[PERF_REF_CYCLES] = { "TCLK", PERF_TYPE_SOFTWARE,
+			      PERF_COUNT_SW_TASK_CLOCK },
+};
+
+static int open_event(const struct perf_event_desc *desc, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = desc->type;
+	attr.config = desc->config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	/* the leader starts the whole group once it is complete */
+	attr.disabled = group_fd == -1;
+	/* the timed phases run in user space; this also works with
+	 * perf_event_paranoid = 2
+	 */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0 /* this thread */,
+		       -1 /* any CPU */, group_fd, 0);
+}
+
+int perf_group_open(struct perf_group *group, int software_only)
+{
+	int slot, leader = -1, err;
+	void *page;
+
+	for (slot = 0; slot < NUM_PERF_SLOTS; slot++) {
+		group->fd[slot] = -1;
+		group->page[slot] = NULL;
+	}
+	group->rdpmc = 0;
+
+	for (slot = 0; slot < NUM_PERF_SLOTS; slot++) {
+		group->software[slot] = 1;
+		if (!software_only) {
+			group->fd[slot] = open_event(&hw_events[slot], leader);
+			group->software[slot] = group->fd[slot] < 0;
+		}
+		if (group->fd[slot] < 0)
+			group->fd[slot] = open_event(&sw_events[slot], leader);
+		if (group->fd[slot] < 0)
+			goto fail;
+		if (slot == 0)
+			leader = group->fd[0];
+	}
+
+	/* rdpmc needs the mmap'ed control page of every counter */
+	group->rdpmc = 1;
+	for (slot = 0; slot < NUM_PERF_SLOTS; slot++) {
+		if (group->software[slot]) {
+			group->rdpmc = 0;
+			break;
+		}
+		page = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED,
+			    group->fd[slot], 0);
+		if (page == MAP_FAILED) {
+			group->rdpmc = 0;
+			break;
+		}
+		group->page[slot] = page;
+		if (!group->page[slot]->cap_user_rdpmc)
+			group->rdpmc = 0;
+	}
+
+	if (ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP))
+		goto fail;
+	return 0;
+
+fail:
+	err = errno;
+	perf_group_close(group);
+	errno = err;
+	return -1;
+}
+
+void perf_group_close(struct perf_group *group)
+{
+	int slot;
+
+	/* siblings first, so that they are not promoted to single events */
+	for (slot = NUM_PERF_SLOTS - 1; slot >= 0; slot--) {
+		if (group->page[slot])
+			munmap(group->page[slot], getpagesize());
+		if (group->fd[slot] >= 0)
+			close(group->fd[slot]);
+		group->page[slot] = NULL;
+		group->fd[slot] = -1;
+	}
+	group->rdpmc = 0;
+}
+
+const char *perf_slot_name(struct perf_group *group, int slot)
+{
+	return group->software[slot] ? sw_events[slot].name :
+		hw_events[slot].name;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static inline uint64_t rdpmc(uint32_t counter)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdpmc" : "=a" (lo), "=d" (hi) : "c" (counter));
+	return lo | ((uint64_t) hi << 32);
+}
+
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+/* Self-monitoring as described in linux/perf_event.h. Returns -1 if
+ * the counter is not on the PMU right now.
+ */
+static int read_user(struct perf_event_mmap_page *pc, uint64_t *value)
+{
+	uint32_t seq, idx, width;
+	uint64_t count;
+	int64_t pmc;
+
+	do {
+		seq = pc->lock;
+		barrier();
+		idx = pc->index;
+		count = pc->offset;
+		if (!pc->cap_user_rdpmc || !idx)
+			return -1;
+		width = pc->pmc_width;
+		pmc = rdpmc(idx - 1);
+		/* sign-extend the width-bit counter */
+		pmc <<= 64 - width;
+		pmc >>= 64 - width;
+		count += pmc;
+		barrier();
+	} while (pc->lock != seq);
+
+	*value = count;
+	return 0;
+}
+#endif
+
+int perf_group_read_user(struct perf_group *group, uint64_t *values)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	int slot;
+
+	if (group->rdpmc) {
+		for (slot = 0; slot < NUM_PERF_SLOTS; slot++)
+			if (read_user(group->page[slot], &values[slot]))
+				return -1;
+		return 0;
+	}
+#endif
+	return -1;
+}
+
+void perf_group_read(struct perf_group *group, uint64_t *values)
+{
+	uint64_t buf[1 + NUM_PERF_SLOTS];
+	int slot;
+
+	if (!perf_group_read_user(group, values))
+		return;
+	/* { nr, values[nr] } with PERF_FORMAT_GROUP */
+	if (read(group->fd[0], buf, sizeof(buf)) != sizeof(buf)) {
+		memset(values, 0, sizeof(uint64_t) * NUM_PERF_SLOTS);
+		return;
+	}
+	for (slot = 0; slot < NUM_PERF_SLOTS; slot++)
+		values[slot] = buf[1 + slot];
+}
@@ -5,9 +5,10 @@
  * Perform first elaboration on the (possibily big) samples set
  */
 #include "pm_common.h"
+#include "pm_store.h"
 
-#define BLOCK_MUL 500
-#define SBLOCK_SIZE 1024
+/* initial room of the output arrays of get_valid_ovd() */
+#define MIN_VALID 1024
 
 /* the number of hot reads that we can find is the same
  * as the number of iterations we performed in pm_task
@@ -24,7 +25,7 @@
 #define WANT_STATISTICS
 #ifdef WANT_STATISTICS
 #include <math.h>
-#define CFREQ 2128.207
+#include "tsc.h"
 #endif
 
 #ifdef DEBUG
@@ -33,158 +34,21 @@
 #define dprintf(arg...)
 #endif
 
-/* simple sequential write on disk.
- * (concurrent writes must be protected)
- *
- * saved_data_entry is ~ 20 B; so 100000 Datapoinst are ~ 2MB
- */
-int serialize_data_entry(char *filename, struct data_entry *samples, int num)
-{
-	int fd;
-	int i, j;
-
-	/* buffer some data in memory before writing */
-	struct saved_data_entry to_save[SBLOCK_SIZE];
-
-	fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0660);
-	if (fd == -1){
-		perror("open");
-		return -1;
-	}
-
-	for (i = 0; i < num / SBLOCK_SIZE; i++) {
-		memset(to_save, 0, sizeof(struct saved_data_entry) * SBLOCK_SIZE);
-		for (j = 0; j < SBLOCK_SIZE; j++) {
-			to_save[j].access_type = samples[j].access_type;
-			to_save[j].access_time =
-				samples[j].access_time;
-			to_save[j].cpu = samples[j].cpu;
-			to_save[j].preemption_length =
-				samples[j].preemption_length;
-		}
-
-		samples = &samples[j];
-
-		if (write(fd, to_save, sizeof(struct saved_data_entry) * SBLOCK_SIZE) == -1) {
-			close(fd);
-			perror("Write failed\n");
-			return -1;
-		}
-	}
-
-	memset(to_save, 0, sizeof(struct saved_data_entry) * SBLOCK_SIZE);
-	for (j = 0; j < num % SBLOCK_SIZE; j++) {
-		to_save[j].access_type = samples[j].access_type;
-		to_save[j].access_time =
-			samples[j].access_time;
-		to_save[j].cpu = samples[j].cpu;
-		to_save[j].preemption_length =
-			samples[j].preemption_length;
-	}
-
-	if (write(fd, to_save, sizeof(struct saved_data_entry) * j) == -1) {
-		close(fd);
-		perror("Write failed\n");
-		return -1;
-	}
-
-	dprintf("Written %d entries\n", i*SBLOCK_SIZE + j);
-
-	close(fd);
-	return 0;
-}
-
-/*
- * Presumably, all data will be written on little endian machines.
- * I assume the binary format is little endian
- *
- * return -1 on error
- * return number of samples on success
- */
-int read_sdata_entry(const char *filename, struct saved_data_entry **samples)
-{
-	int fd;
-	int i,j;
-
-	int num_samples, file_size;
-	struct saved_data_entry block_read[BLOCK_MUL];
-
-	int bytes_read;
-
-	fd = open(filename, O_RDONLY);
-	if(fd == -1){
-		perror("open");
-		return -1;
-	}
-
-	/* Compute file size */
-	file_size = lseek(fd, 0, SEEK_END);
-	if(file_size == -1){
-		close(fd);
-		perror("lseek");
-		return -1;
-	}
-
-	/* Return to start position */
-	if(lseek(fd, 0, SEEK_SET) == -1){
-		close(fd);
-		perror("lseek");
-		return -1;
-	}
-
-	num_samples = file_size / sizeof(struct saved_data_entry);
-	dprintf("N entries: %d\n", num_samples);
-
-	/* Allocate memory for data_entry samples */
-	*samples = (struct saved_data_entry *) (malloc(num_samples *
-					sizeof(struct saved_data_entry)));
-	if(*samples == NULL){
-		close(fd);
-		perror("malloc");
-		return -1;
-	}
-
-	/* Read all the file */
-	j = 0;
-	do {
-		/* Read file (in BLOCK_MUL * sizeof(saved_data_entrty) block size) */
-		bytes_read = read(fd, &block_read, sizeof(struct saved_data_entry) * BLOCK_MUL);
-		if (bytes_read == -1) {
-			perror("Cannot read\n");
-			close(fd);
-			free(*samples);
-			return -1;
-		}
-
-		for (i = 0; i < (bytes_read / sizeof(struct saved_data_entry)); i++, j++)
-			(*samples)[j] = block_read[i];
-
-	} while(bytes_read > 0);
-
-	close(fd);
-
-#ifdef VERBOSE_DEBUG
-	for (i = 0; i < num_samples; i++)
-		fprintf(stderr,"(%c) - ACC %llu, CPU %u, PLEN %llu\n",
-				(*samples)[i].access_type,
-				(*samples)[i].access_time, (*samples)[i].cpu,
-				(*samples)[i].preemption_length);
-#endif
-	return num_samples;
-}
-
 #ifdef WANT_STATISTICS
 /*
  * print min, max, avg, stddev for the vector
  * samples is the size of the population
  * cpufreq is in MHz
  */
-void print_rough_stats(unsigned long long *vector, int samples, double cpufreq,
+void print_rough_stats(unsigned long long *vector, long samples, double cpufreq,
 		int wss, int tss)
 {
 	unsigned long long min, max;
 	long double mi, qi, num_diff;
-	int i;
+	long i;
+
+	 if (samples <= 0)
+		 return;
 
 	 /* manage first value */
 	 mi = vector[0];
@@ -220,6 +84,46 @@ void print_rough_stats(unsigned long long *vector, int samples, double cpufreq,
 }
 #endif
 
+#ifdef WANT_STATISTICS
+/* TSC frequency recorded in a sample store, that of this machine for
+ * older sample files
+ */
+static double sample_mhz(const char *filename)
+{
+	struct pm_store_header header;
+	double mhz = 0;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd != -1) {
+		if (!pm_store_info(fd, &header, NULL))
+			mhz = header.tsc_mhz;
+		close(fd);
+	}
+	return mhz > 0 ? mhz : tsc_mhz();
+}
+#endif
+
+/* Make room for at least one more element of size bytes in *vector,
+ * which has room for *room; doubles it (MIN_VALID at first).
+ * return -1 on error
+ */
+static int grow(void *vector, long *room, long count, size_t size)
+{
+	void *v;
+	long n;
+
+	if (count < *room)
+		return 0;
+	n = *room ? 2 * *room : MIN_VALID;
+	v = realloc(*(void **) vector, n * size);
+	if (v == NULL)
+		return -1;
+	*(void **) vector = v;
+	*room = n;
+	return 0;
+}
+
 /*
  * get_valid_ovd(): get valid overheads from trace file
  *
@@ -228,25 +132,24 @@ void print_rough_stats(unsigned long long *vector, int samples, double cpufreq,
  *
  * output:
  * @full_costs: array of all overheads and preemption length associated
- * 		with valid measures
+ * 		with valid measures (malloc'ed here, free it)
  *
- * full_costs MUST be initialized before entering this function and MUST
- * be at least DATAPOINTS long
+ * The samples are read in place from the (mapped) file, one at a time,
+ * so that traces larger than memory can be analyzed: only the valid
+ * measures are kept.
  *
  * @return:	number of valid measures read (implicit "true" length of
  *		output array.)
  *		If error return < 0
  */
-int get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
+long get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
 		int wss, int tss)
 {
-	struct saved_data_entry *samples;
-	/* total number of samples */
-	int num_samples;
-	/* number of valid samples */
-	int scount = 0;
-
-	int i;
+	struct pm_reader reader;
+	const struct saved_data_entry *s;
+	/* number of valid samples, and room for them in full_costs */
+	long scount = 0;
+	long room = 0;
 
 	/* do we have a valid hot read? */
 	int valid_hot_reads = 0;
@@ -259,95 +162,55 @@ int get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
 	/* what is the last cpu seen so far? */
 	unsigned int l_cpu = 0;
 
-	unsigned long long hot_cost;
+	unsigned long long hot_cost = 0;
 #ifdef WANT_STATISTICS
-	unsigned long long *valid_c_samples;
-	unsigned long long *valid_h_samples;
-	unsigned long long *valid_p_samples;
-	int c_count;
-	int h_count;
-	int p_count;
+	unsigned long long *valid_c_samples = NULL;
+	unsigned long long *valid_h_samples = NULL;
+	unsigned long long *valid_p_samples = NULL;
+	long c_count = 0, c_room = 0;
+	long h_count = 0, h_room = 0;
+	long p_count = 0, p_room = 0;
+	double mhz;
 #endif
 
-	if ((num_samples = read_sdata_entry(filename, &samples)) < 0) {
+	*full_costs = NULL;
+	if (pm_reader_open(&reader, filename)) {
+		perror("open");
 		fprintf(stderr, "Cannot read %s\n", filename);
 		return -1;
 	}
+	if (reader.dropped)
+		fprintf(stderr, "%s: %llu samples did not fit in the store\n",
+			filename, (unsigned long long) reader.dropped);
 
-	/* alloc an upper bound of the number of valid samples we can have */
-	*full_costs = (struct full_ovd_plen*) malloc(num_samples *
-					sizeof(struct full_ovd_plen));
-	if (*full_costs == NULL) {
-		fprintf(stderr, "Cannot allocate overhead array\n");
-		free(samples);
-		return -1;
-	}
-	memset(*full_costs, 0, num_samples * sizeof(struct full_ovd_plen));
-
-#ifdef WANT_STATISTICS
-	valid_c_samples = (unsigned long long *) malloc(num_samples *
-			sizeof(unsigned long long));
-	if (valid_c_samples == NULL) {
-		fprintf(stderr, "Cannot allocate overhead array\n");
-		free(samples);
-		return -1;
-	}
-	valid_h_samples = (unsigned long long *) malloc(num_samples *
-			sizeof(unsigned long long));
-	if (valid_h_samples == NULL) {
-		fprintf(stderr, "Cannot allocate overhead array\n");
-		free(valid_c_samples);
-		free(samples);
-		return -1;
-	}
-	valid_p_samples = (unsigned long long *) malloc(num_samples *
-			sizeof(unsigned long long));
-	if (valid_p_samples == NULL) {
-		fprintf(stderr, "Cannot allocate overhead array\n");
-		free(valid_h_samples);
-		free(valid_c_samples);
-		free(samples);
-		return -1;
-	}
-	memset(valid_c_samples, 0, num_samples * sizeof(unsigned long long));
-	memset(valid_h_samples, 0, num_samples * sizeof(unsigned long long));
-	memset(valid_p_samples, 0, num_samples * sizeof(unsigned long long));
-
-	c_count = 0;
-	h_count = 0;
-	p_count = 0;
-#endif
 #ifdef VERBOSE_DEBUG
 	fprintf(stderr, "Start collected overhead\n");
-	/* write this on stderr so we can redirect it on a different stream */
-	for (i = 0; i < num_samples; i++)
-		fprintf(stderr, "(%c) - ACC %llu, CPU %u, PLEN %llu\n",
-				samples[i].access_type,
-				samples[i].access_time, samples[i].cpu,
-				samples[i].preemption_length);
-	fprintf(stderr, "End collected ovrhead\n");
 #endif
-	hot_cost = samples[0].access_time;
-
 	/* get valid overheads reads */
-	for (i = 0; i < num_samples; i++) {
+	while ((s = pm_reader_next(&reader))) {
+#ifdef VERBOSE_DEBUG
+		/* write this on stderr so we can redirect it on a different stream */
+		fprintf(stderr, "(%c) - ACC %llu, CPU %u, PLEN %llu\n",
+				s->access_type, s->access_time, s->cpu,
+				s->preemption_length);
+#endif
 
-		if (samples[i].access_type == 'H' ||
-			samples[i].access_type == 'h') {
+		if (s->access_type == 'H' ||
+			s->access_type == 'h') {
 			/* NUMHOTREADS consecutive 'H' hot reads should
 			 * (hopefully) appear. Take the minimum
 			 * of all valid reads up to when the first
 			 * invalid 'h' read appears.
 			 */
 			total_hot_reads++;
-			if (no_invalid_reads && samples[i].access_type == 'H') {
+			if (no_invalid_reads && s->access_type == 'H') {
 
 				valid_hot_reads++;
 				if(valid_hot_reads == 1) {
-					hot_cost = samples[i].access_time;
+					hot_cost = s->access_time;
 				}
 				else {
-					hot_cost = min(hot_cost, samples[i].access_time);
+					hot_cost = min(hot_cost, s->access_time);
 				}
 
 			} else {
@@ -369,26 +232,29 @@ int get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
 			}
 
 			/* update last seen cpu */
-			l_cpu = samples[i].cpu;
+			l_cpu = s->cpu;
 
 		} else {
-			if (samples[i].access_type == 'P' ||
-				samples[i].access_type == 'p') {
+			if (s->access_type == 'P' ||
+				s->access_type == 'p') {
 
 				/* this may be a preemption or a migration
 				 * but we do not care now: just report it
 				 * if it happened after a valid hot read
 				 * and the preemption measure is valid
 				 */
-				if (valid_hot_cost && samples[i].access_type == 'P') {
+				if (valid_hot_cost && s->access_type == 'P') {
 
-					(*full_costs)[scount].curr_cpu = samples[i].cpu;
+					if (grow(full_costs, &room, scount,
+						 sizeof(struct full_ovd_plen)))
+						goto nomem;
+					(*full_costs)[scount].curr_cpu = s->cpu;
 					(*full_costs)[scount].last_cpu = l_cpu;
 					(*full_costs)[scount].ovd = (long long)
-						samples[i].access_time - hot_cost;
+						s->access_time - hot_cost;
 
 					(*full_costs)[scount].plen = (long long)
-						samples[i].preemption_length;
+						s->preemption_length;
 
 					dprintf("%u %u %lld %lld\n", (*full_costs)[scount].curr_cpu,
 							(*full_costs)[scount].last_cpu,
@@ -398,28 +264,48 @@ int get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
 				}
 
 				/* update last seen cpu */
-				l_cpu = samples[i].cpu;
+				l_cpu = s->cpu;
 			}
 		}
 #ifdef WANT_STATISTICS
-		if (samples[i].access_type == 'C')
-			valid_c_samples[c_count++] = samples[i].access_time;
-		else if (samples[i].access_type == 'H')
-			valid_h_samples[h_count++] = samples[i].access_time;
-		else if (samples[i].access_type == 'P')
-			valid_p_samples[p_count++] = samples[i].access_time;
+		if (s->access_type == 'C') {
+			if (grow(&valid_c_samples, &c_room, c_count,
+				 sizeof(unsigned long long)))
+				goto nomem;
+			valid_c_samples[c_count++] = s->access_time;
+		} else if (s->access_type == 'H') {
+			if (grow(&valid_h_samples, &h_room, h_count,
+				 sizeof(unsigned long long)))
+				goto nomem;
+			valid_h_samples[h_count++] = s->access_time;
+		} else if (s->access_type == 'P') {
+			if (grow(&valid_p_samples, &p_room, p_count,
+				 sizeof(unsigned long long)))
+				goto nomem;
+			valid_p_samples[p_count++] = s->access_time;
+		}
+#endif
+	}
+#ifdef VERBOSE_DEBUG
+	fprintf(stderr, "End collected ovrhead\n");
 #endif
+	if (reader.err) {
+		errno = reader.err;
+		perror("Cannot read");
+		goto err;
 	}
+	pm_reader_close(&reader);
 
 	dprintf("End of valid entries\n");
 #ifdef WANT_STATISTICS
+	mhz = sample_mhz(filename);
 	fprintf(stderr, "# Cold cache\n");
-	print_rough_stats(valid_c_samples, c_count, CFREQ, wss, tss);
+	print_rough_stats(valid_c_samples, c_count, mhz, wss, tss);
 	fprintf(stderr, "# Hot cache\n");
-	print_rough_stats(valid_h_samples, h_count, CFREQ, wss, tss);
+	print_rough_stats(valid_h_samples, h_count, mhz, wss, tss);
 	fprintf(stderr, "# After preemption\n");
-	print_rough_stats(valid_p_samples, p_count, CFREQ, wss, tss);
-	fprintf(stderr, "## Nsamples(c,h,p): %d, %d, %d\n",
+	print_rough_stats(valid_p_samples, p_count, mhz, wss, tss);
+	fprintf(stderr, "## Nsamples(c,h,p): %ld, %ld, %ld\n",
 			c_count, h_count, p_count);
 
 	free(valid_p_samples);
@@ -427,8 +313,20 @@ int get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
 	free(valid_c_samples);
 #endif
 
-	free(samples);
 	return scount;
+
+nomem:
+	fprintf(stderr, "Cannot allocate overhead array\n");
+err:
+	pm_reader_close(&reader);
+#ifdef WANT_STATISTICS
+	free(valid_p_samples);
+	free(valid_h_samples);
+	free(valid_c_samples);
+#endif
+	free(*full_costs);
+	*full_costs = NULL;
+	return -1;
 }
 
 /*
@@ -469,14 +367,14 @@ int get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
  * if samel2 is NULL, then L3 is not present and samel2 is equivalent to
  * samechip. cores_per_l2 should be equal to cores_per_chip, but is not used.
  */
-void get_ovd_plen(struct full_ovd_plen *full_costs, int num_samples,
+void get_ovd_plen(struct full_ovd_plen *full_costs, long num_samples,
 		unsigned int cores_per_l2, unsigned int cores_per_chip,
-		struct ovd_plen *preempt, int *pcount,
-		struct ovd_plen *samel2, int *l2count,
-		struct ovd_plen *samechip, int *chipcount,
-		struct ovd_plen *offchip, int *offcount)
+		struct ovd_plen *preempt, long *pcount,
+		struct ovd_plen *samel2, long *l2count,
+		struct ovd_plen *samechip, long *chipcount,
+		struct ovd_plen *offchip, long *offcount)
 {
-	int i;
+	long i;
 	*pcount = 0;
 	*l2count = 0;
 	*chipcount = 0;
@@ -486,7 +384,7 @@ void get_ovd_plen(struct full_ovd_plen *full_costs, int num_samples,
 	unsigned int last_cpu;
 
 	for (i = 0; i < num_samples; i++) {
-		dprintf("i = %d\n", i);
+		dprintf("i = %ld\n", i);
 		curr_cpu = full_costs[i].curr_cpu;
 		last_cpu = full_costs[i].last_cpu;
 
@@ -543,10 +441,10 @@ void get_ovd_plen(struct full_ovd_plen *full_costs, int num_samples,
 		offchip[*offcount].plen = full_costs[i].plen;
 		(*offcount)++;
 	}
-	dprintf("pcount = %d\n", *pcount);
-	dprintf("chipcount = %d\n", *chipcount);
-	dprintf("l2count = %d\n", *l2count);
-	dprintf("offcount = %d\n", *offcount);
+	dprintf("pcount = %ld\n", *pcount);
+	dprintf("chipcount = %ld\n", *chipcount);
+	dprintf("l2count = %ld\n", *l2count);
+	dprintf("offcount = %ld\n", *offcount);
 }
 
 /*
@@ -573,14 +471,14 @@ void get_ovd_plen(struct full_ovd_plen *full_costs, int num_samples,
  * if samel2 is NULL, then L3 is not present and samel2 is equivalent to
  * samechip. cores_per_l2 should be equal to cores_per_chip, but is not used.
  */
-void get_ovd_plen_umaxeon(struct full_ovd_plen *full_costs, int num_samples,
+void get_ovd_plen_umaxeon(struct full_ovd_plen *full_costs, long num_samples,
 		unsigned int cores_per_l2, unsigned int num_phys_cpu,
-		struct ovd_plen *preempt, int *pcount,
-		struct ovd_plen *samel2, int *l2count,
-		struct ovd_plen *samechip, int *chipcount,
-		struct ovd_plen *offchip, int *offcount)
+		struct ovd_plen *preempt, long *pcount,
+		struct ovd_plen *samel2, long *l2count,
+		struct ovd_plen *samechip, long *chipcount,
+		struct ovd_plen *offchip, long *offcount)
 {
-	int i;
+	long i;
 	*pcount = 0;
 	*l2count = 0;
 	*chipcount = 0;
@@ -591,7 +489,7 @@ void get_ovd_plen_umaxeon(struct full_ovd_plen *full_costs, int num_samples,
 
 	for (i = 0; i < num_samples; i++) {
 
-		dprintf("i = %d\n", i);
+		dprintf("i = %ld\n", i);
 		curr_cpu = full_costs[i].curr_cpu;
 		last_cpu = full_costs[i].last_cpu;
 
@@ -644,9 +542,9 @@ void get_ovd_plen_umaxeon(struct full_ovd_plen *full_costs, int num_samples,
 		offchip[*offcount].plen = full_costs[i].plen;
 		(*offcount)++;
 	}
-	dprintf("pcount = %d\n", *pcount);
-	dprintf("chipcount = %d\n", *chipcount);
-	dprintf("l2count = %d\n", *l2count);
-	dprintf("offcount = %d\n", *offcount);
+	dprintf("pcount = %ld\n", *pcount);
+	dprintf("chipcount = %ld\n", *chipcount);
+	dprintf("l2count = %ld\n", *l2count);
+	dprintf("offcount = %ld\n", *offcount);
 }
 
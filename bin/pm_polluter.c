@@ -2,39 +2,286 @@
  * pm_be_polluter.c
  *
  * Best Effort Cache Polluter Task
+ *
+ * One polluter thread per CPU of a list, each traversing its own
+ * footprint with a given access pattern and write cycle, optionally
+ * paced to a target bandwidth or LLC miss rate. The achieved rates
+ * are exported in shared memory; "pm_polluter -q" prints them.
  */
 #include "pm_common.h"
-#include "pm_arch.h"
-#include "asm.h"
 
-int mem_block[NUMWS][INTS_PER_WSS] __attribute__ ((aligned(CACHEALIGNMENT)));
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
 
-int main(int argc, char **argv)
-{
-	int read, *loc_ptr;
+#include "polluter.h"
+#include "topology.h"
+#include "touch.h"
 
-	memset(&mem_block, 0, sizeof(int) * NUMWS * INTS_PER_WSS);
+#define DEFAULT_SHM_NAME "/pm_polluter"
+#define MAX_POLLUTERS 1024
 
-	/* Initialize random library for read/write ratio enforcement. */
-	srandom(SEEDVAL);
+static volatile sig_atomic_t stopped = 0;
 
-	while(1) {
-		read = (random() % 100) < READRATIO;
-		loc_ptr = &mem_block[random() % NUMWS][0];
-		loc_ptr += (random() % INTS_PER_WSS);
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: pm_polluter [-c CPUS] [-f KB] [-a PATTERN] "
+		"[-w WRITECYCLE]\n"
+		"                   [-k ISA] [-N] [-r RATE] [-u UNIT] "
+		"[-s NAME] [-i MS]\n"
+		"       pm_polluter -q [NAME]\n"
+		"       -c: CPUs to pollute from, e.g. 0-3,6 "
+		"(default: all online)\n"
+		"       -f: footprint of each polluter in KB "
+		"(default: %d)\n"
+		"       -a: seq, stride, random (default) or chase\n"
+		"       -w: every WRITECYCLE-th access is a write "
+		"(default 4, 0: read-only)\n"
+		"       -k: vector kernels: sse2, avx2, avx512 or auto\n"
+		"       -N: with -k, non-temporal (streaming) stores\n"
+		"       -r: target rate of each polluter (default 0: "
+		"as fast as it can)\n"
+		"       -u: unit of RATE: mbps (MB/s, default) or llc "
+		"(K LLC misses/s)\n"
+		"       -s: shared memory to export the achieved rates to "
+		"(default %s)\n"
+		"       -i: update interval of the rates in ms "
+		"(default 1000)\n"
+		"       -q: print the rates of a running pm_polluter "
+		"and exit\n",
+		2 * CACHESIZE, DEFAULT_SHM_NAME);
+}
 
-		barrier();
+static void on_signal(int signo)
+{
+	stopped = 1;
+}
 
-		if (read)
-			read_mem(loc_ptr);
-		else
-			write_mem(loc_ptr);
+static struct polluter_stats* map_stats(const char *name, int create)
+{
+	struct polluter_stats *stats;
+	int fd;
 
-		/* FIXME is really needed? */
-		usleep(40);
+	fd = shm_open(name, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY,
+		      0644);
+	if (fd < 0)
+		return NULL;
+	if (create && ftruncate(fd, sizeof(*stats))) {
+		close(fd);
+		return NULL;
 	}
+	stats = mmap(NULL, sizeof(*stats),
+		     create ? PROT_READ | PROT_WRITE : PROT_READ,
+		     MAP_SHARED, fd, 0);
+	close(fd);
+	return stats == MAP_FAILED ? NULL : stats;
+}
 
-	/* never reached */
+static int query(const char *name)
+{
+	struct polluter_stats *stats, copy;
+	uint64_t seq;
+
+	stats = map_stats(name, 0);
+	if (!stats) {
+		perror("Cannot open the polluter statistics");
+		return -1;
+	}
+	if (stats->version != POLLUTER_STATS_VERSION) {
+		fprintf(stderr, "pm_polluter: %s has version %u, not %d\n",
+			name, stats->version, POLLUTER_STATS_VERSION);
+		return -1;
+	}
+	do {
+		seq = stats->seq;
+		__sync_synchronize();
+		copy = *stats;
+		__sync_synchronize();
+	} while ((seq & 1) || seq != stats->seq);
+
+	printf("cpus=%u mbps=%.1f llc_kps=%.1f bytes=%llu misses=%llu "
+	       "target=%lld unit=%s counting=%u\n",
+	       copy.cpus, copy.mbps, copy.llc_kps,
+	       (unsigned long long) copy.bytes,
+	       (unsigned long long) copy.misses, (long long) copy.target,
+	       rate_unit_name(copy.target_unit), copy.counting);
+	munmap(stats, sizeof(*stats));
 	return 0;
 }
 
+/* Totals and rates since the previous update, under the seqlock. */
+static void update_stats(struct polluter_stats *stats,
+			 struct polluter *polluters, int num,
+			 struct polluter_mark *marks)
+{
+	uint64_t bytes = 0, misses = 0;
+	double mbps = 0, llc_kps = 0;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		mbps += polluter_rate(&polluters[i], &marks[i], RATE_MBPS);
+		llc_kps += polluter_rate(&polluters[i], &marks[i], RATE_LLC);
+		polluter_mark(&polluters[i], &marks[i]);
+		bytes += marks[i].bytes;
+		misses += marks[i].misses;
+	}
+
+	stats->seq++;
+	__sync_synchronize();
+	stats->bytes = bytes;
+	stats->misses = misses;
+	stats->mbps = mbps;
+	stats->llc_kps = llc_kps;
+	__sync_synchronize();
+	stats->seq++;
+}
+
+int main(int argc, char **argv)
+{
+	static int cpus[MAX_POLLUTERS];
+	static struct polluter polluters[MAX_POLLUTERS];
+	static struct polluter_mark marks[MAX_POLLUTERS];
+	struct polluter_spec spec = {
+		.footprint = 2 * CACHESIZE,
+		.pattern = PATTERN_RANDOM,
+		.stride = 256,
+		.write_cycle = 100 / (100 - READRATIO),
+		.kernel = NULL,
+		.unit = RATE_MBPS,
+		.rate = 0,
+	};
+	enum touch_isa isa = ISA_SCALAR;
+	int nontemporal = 0;
+	const char *shm_name = DEFAULT_SHM_NAME;
+	struct polluter_stats *stats;
+	struct timespec interval = {1, 0};
+	int num_cpus = 0, num = 0, ms, opt, err, i;
+
+	while ((opt = getopt(argc, argv, "c:f:a:w:k:Nr:u:s:i:q")) != -1) {
+		switch (opt) {
+		case 'c':
+			num_cpus = parse_cpu_list(optarg, cpus, MAX_POLLUTERS);
+			if (num_cpus <= 0) {
+				fprintf(stderr, "pm_polluter: bad CPU list %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 'f':
+			spec.footprint = atoi(optarg);
+			break;
+		case 'a':
+			if (parse_access_pattern(optarg, &spec.pattern)) {
+				fprintf(stderr, "pm_polluter: unknown pattern "
+					"%s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'w':
+			spec.write_cycle = atoi(optarg);
+			break;
+		case 'k':
+			if (parse_touch_isa(optarg, &isa) ||
+			    !touch_isa_supported(isa)) {
+				fprintf(stderr, "pm_polluter: ISA %s not "
+					"supported\n", optarg);
+				return -1;
+			}
+			break;
+		case 'N':
+			nontemporal = 1;
+			break;
+		case 'r':
+			spec.rate = atol(optarg);
+			break;
+		case 'u':
+			if (parse_rate_unit(optarg, &spec.unit)) {
+				fprintf(stderr, "pm_polluter: unknown unit "
+					"%s\n", optarg);
+				return -1;
+			}
+			break;
+		case 's':
+			shm_name = optarg;
+			break;
+		case 'i':
+			ms = atoi(optarg);
+			if (ms <= 0) {
+				usage();
+				return -1;
+			}
+			interval.tv_sec = ms / 1000;
+			interval.tv_nsec = (ms % 1000) * 1000000L;
+			break;
+		case 'q':
+			return query(optind < argc ? argv[optind] :
+				     DEFAULT_SHM_NAME);
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (spec.footprint <= 0 || spec.write_cycle < 0 || spec.rate < 0) {
+		usage();
+		return -1;
+	}
+	if (isa != ISA_SCALAR) {
+		spec.kernel = select_simd_kernel(isa, spec.pattern,
+						 nontemporal);
+		if (!spec.kernel) {
+			fprintf(stderr, "pm_polluter: no vector kernel for "
+				"this pattern\n");
+			return -1;
+		}
+	} else if (nontemporal) {
+		fprintf(stderr, "pm_polluter: -N needs a vector ISA (-k)\n");
+		return -1;
+	}
+
+	if (!num_cpus) {
+		num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (num_cpus > MAX_POLLUTERS)
+			num_cpus = MAX_POLLUTERS;
+		for (i = 0; i < num_cpus; i++)
+			cpus[i] = i;
+	}
+
+	stats = map_stats(shm_name, 1);
+	if (!stats) {
+		perror("Cannot create the polluter statistics");
+		return -1;
+	}
+	stats->target = spec.rate;
+	stats->target_unit = spec.unit;
+
+	signal(SIGTERM, on_signal);
+	signal(SIGINT, on_signal);
+
+	for (i = 0; i < num_cpus && !stopped; i++) {
+		err = polluter_start(&polluters[num], cpus[i], &spec);
+		if (err) {
+			fprintf(stderr, "pm_polluter: CPU %d: %s\n", cpus[i],
+				strerror(err));
+			continue;
+		}
+		polluter_mark(&polluters[num], &marks[num]);
+		num++;
+	}
+	stats->cpus = num;
+	stats->counting = num && polluters[0].counting;
+	__sync_synchronize();
+	stats->version = POLLUTER_STATS_VERSION;
+
+	while (num && !stopped) {
+		nanosleep(&interval, NULL);
+		update_stats(stats, polluters, num, marks);
+	}
+
+	for (i = 0; i < num; i++)
+		polluter_stop(&polluters[i]);
+	munmap(stats, sizeof(*stats));
+	shm_unlink(shm_name);
+	return num ? 0 : -1;
+}
@@ -0,0 +1,564 @@
+/*
+ * pm_store.c
+ *
+ * Shared sample store of the pm_tasks of a task set
+ */
+/* 64-bit file offsets on 32-bit machines too */
+#define _FILE_OFFSET_BITS 64
+
+#include "pm_store.h"
+
+#include <time.h>
+#include <sys/stat.h>
+
+/* how long to wait for the creator to set up the store, in ms */
+#define OPEN_TIMEOUT_MS 10000
+/* window of a reader that cannot map the file */
+#define READ_BLOCK (1 << 20)
+
+/* Stores of version 1 (plain struct saved_data_entry records, no
+ * description of the experiment) can still be read, not written.
+ */
+struct pm_store_header_v1 {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;		/* sizeof(struct saved_data_entry) */
+	uint32_t max_tasks;
+	uint32_t num_tasks;
+	uint64_t capacity;
+	uint64_t segment_size;
+	uint64_t data_offset;
+};
+
+struct pm_store_segment_v1 {
+	int32_t pid;
+	uint32_t pad;
+	uint64_t count;
+	uint64_t dropped;
+};
+
+static size_t page_round(size_t len)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (len + page - 1) / page * page;
+}
+
+static struct pm_store_segment* segment_table(struct pm_store_header *h)
+{
+	return (struct pm_store_segment *) (h + 1);
+}
+
+static size_t cpu_table_offset(const struct pm_store_header *h)
+{
+	return sizeof(*h) + h->max_tasks * sizeof(struct pm_store_segment);
+}
+
+static int valid_header(const struct pm_store_header *h)
+{
+	return !memcmp(h->magic, PM_STORE_MAGIC, sizeof(h->magic)) &&
+		h->version == PM_STORE_VERSION &&
+		h->record_size == sizeof(struct pm_record);
+}
+
+/* bytes per record that segments are sized by */
+static size_t record_avg(unsigned int flags)
+{
+	int counters = flags & PM_STORE_COUNTERS;
+
+	if (flags & PM_STORE_DELTA)
+		return PM_DELTA_AVG + (counters ? PM_COUNTERS_DELTA_AVG : 0);
+	return sizeof(struct pm_record) + (counters ? PM_COUNTERS_SIZE : 0);
+}
+
+static int create(struct pm_store *store, const struct pm_store_params *p)
+{
+	struct pm_store_header *h;
+	size_t len = page_round(sizeof(*h) +
+				p->max_tasks * sizeof(struct pm_store_segment) +
+				p->num_cpus * sizeof(struct pm_store_cpu));
+	uint64_t segment_size = page_round(p->capacity * record_avg(p->flags));
+
+	if (ftruncate(store->fd, len + p->max_tasks * segment_size))
+		return -1;
+	h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+	if (h == MAP_FAILED)
+		return -1;
+
+	h->version = PM_STORE_VERSION;
+	h->flags = p->flags;
+	h->record_size = sizeof(struct pm_record);
+	h->max_tasks = p->max_tasks;
+	h->num_tasks = 0;
+	h->num_cpus = p->num_cpus;
+	h->capacity = p->capacity;
+	h->segment_size = segment_size;
+	h->data_offset = len;
+	h->tsc_mhz = p->tsc_mhz;
+	h->wss = p->wss;
+	h->cachesize = p->cachesize;
+	h->num_ws = p->num_ws;
+	gethostname(h->host, sizeof(h->host) - 1);
+	memcpy((char *) h + cpu_table_offset(h), p->cpus,
+	       p->num_cpus * sizeof(struct pm_store_cpu));
+	/* whoever sees the magic sees the rest */
+	__sync_synchronize();
+	memcpy(h->magic, PM_STORE_MAGIC, sizeof(h->magic));
+
+	store->header = h;
+	store->header_len = len;
+	return 0;
+}
+
+/* Map the header that another task is setting up. */
+static int attach(struct pm_store *store)
+{
+	struct pm_store_header *h;
+	struct timespec wait = {0, 1000000};
+	struct stat st;
+	size_t len;
+	int ms;
+
+	for (ms = 0; ms < OPEN_TIMEOUT_MS; ms++, nanosleep(&wait, NULL)) {
+		if (fstat(store->fd, &st))
+			return -1;
+		if (st.st_size < sizeof(*h))
+			continue;
+		h = mmap(NULL, sizeof(*h), PROT_READ, MAP_SHARED, store->fd, 0);
+		if (h == MAP_FAILED)
+			return -1;
+		if (memcmp(h->magic, PM_STORE_MAGIC, sizeof(h->magic))) {
+			munmap(h, sizeof(*h));
+			continue;
+		}
+		__sync_synchronize();
+		if (!valid_header(h)) {
+			munmap(h, sizeof(*h));
+			errno = EINVAL;
+			return -1;
+		}
+		len = h->data_offset;
+		munmap(h, sizeof(*h));
+
+		h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 store->fd, 0);
+		if (h == MAP_FAILED)
+			return -1;
+		store->header = h;
+		store->header_len = len;
+		return 0;
+	}
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+int pm_store_open(struct pm_store *store, const char *filename,
+		  const struct pm_store_params *params)
+{
+	struct pm_store_header *h;
+	unsigned int idx;
+	off_t offset;
+	int err;
+
+	memset(store, 0, sizeof(*store));
+	if (!params->max_tasks || !params->capacity) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	store->fd = open(filename, O_RDWR | O_CREAT | O_EXCL, 0660);
+	if (store->fd >= 0)
+		err = create(store, params);
+	else if (errno == EEXIST) {
+		store->fd = open(filename, O_RDWR);
+		if (store->fd < 0)
+			return -1;
+		err = attach(store);
+	} else
+		return -1;
+	if (err)
+		goto fail;
+	h = store->header;
+
+	idx = __sync_fetch_and_add(&h->num_tasks, 1);
+	if (idx >= h->max_tasks) {
+		errno = ENOSPC;
+		goto fail;
+	}
+	store->segment = &segment_table(h)[idx];
+	store->segment->pid = getpid();
+	store->limit = h->segment_size;
+
+	/* reserve the blocks now rather than fail on a write fault */
+	offset = h->data_offset + idx * h->segment_size;
+	err = posix_fallocate(store->fd, offset, h->segment_size);
+	if (err && err != EOPNOTSUPP) {
+		errno = err;
+		goto fail;
+	}
+	/* populated, not write-faulted: shared file pages fault again
+	 * on the first write (page_mkwrite)
+	 */
+	store->data = mmap(NULL, h->segment_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, store->fd, offset);
+	if (store->data == MAP_FAILED) {
+		store->data = NULL;
+		goto fail;
+	}
+	return 0;
+
+fail:
+	err = errno;
+	if (store->header)
+		munmap(store->header, store->header_len);
+	close(store->fd);
+	errno = err;
+	return -1;
+}
+
+void pm_store_set_task(struct pm_store *store, uint64_t period,
+		       uint64_t exec_cost)
+{
+	store->segment->period = period;
+	store->segment->exec_cost = exec_cost;
+}
+
+void pm_store_close(struct pm_store *store)
+{
+	size_t len = store->header->segment_size;
+
+	msync(store->data, len, MS_SYNC);
+	msync(store->header, store->header_len, MS_SYNC);
+	munmap(store->data, len);
+	munmap(store->header, store->header_len);
+	close(store->fd);
+}
+
+int pm_store_check(int fd)
+{
+	char magic[8];
+
+	return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+		!memcmp(magic, PM_STORE_MAGIC, sizeof(magic));
+}
+
+/* The header of a version 1 store, in the form of the current one */
+static int read_v1_header(int fd, struct pm_store_header *header)
+{
+	struct pm_store_header_v1 h;
+
+	if (pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+	    memcmp(h.magic, PM_STORE_MAGIC, sizeof(h.magic)) ||
+	    h.version != 1 || h.record_size != sizeof(struct saved_data_entry))
+		return -1;
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, h.magic, sizeof(h.magic));
+	header->version = h.version;
+	header->record_size = h.record_size;
+	header->max_tasks = h.max_tasks;
+	header->num_tasks = h.num_tasks;
+	header->capacity = h.capacity;
+	header->segment_size = h.segment_size;
+	header->data_offset = h.data_offset;
+	return 0;
+}
+
+int pm_store_info(int fd, struct pm_store_header *header,
+		  struct pm_store_cpu **cpus)
+{
+	size_t len;
+
+	if (pread(fd, header, sizeof(*header), 0) != sizeof(*header))
+		return -1;
+	if (header->version == 1) {
+		if (read_v1_header(fd, header))
+			return -1;
+	} else if (!valid_header(header)) {
+		return -1;
+	}
+	if (!cpus)
+		return 0;
+
+	len = header->num_cpus * sizeof(struct pm_store_cpu);
+	*cpus = malloc(len + 1);
+	if (!*cpus)
+		return -1;
+	if (pread(fd, *cpus, len, cpu_table_offset(header)) != len) {
+		free(*cpus);
+		return -1;
+	}
+	return 0;
+}
+
+static const unsigned char* get_varint(const unsigned char *pos,
+				       const unsigned char *end, uint64_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while (pos < end && shift < 64) {
+		*v |= (uint64_t) (*pos & 0x7f) << shift;
+		if (!(*pos++ & 0x80))
+			return pos;
+		shift += 7;
+	}
+	return NULL;
+}
+
+/* Segments of a version 1 store: plain records, count of each */
+static int find_v1_segments(struct pm_reader *r, uint64_t file_size)
+{
+	struct pm_store_header *h = &r->header;
+	struct pm_store_segment_v1 seg;
+	size_t rec = sizeof(struct saved_data_entry);
+	unsigned int i;
+
+	r->format = PM_FORMAT_PLAIN;
+	r->num_segments = h->num_tasks < h->max_tasks ?
+		h->num_tasks : h->max_tasks;
+	r->segments = malloc(r->num_segments * sizeof(*r->segments) + 1);
+	if (!r->segments)
+		return -1;
+
+	for (i = 0; i < r->num_segments; i++) {
+		if (pread(r->fd, &seg, sizeof(seg),
+			  sizeof(struct pm_store_header_v1) + i * sizeof(seg))
+		    != sizeof(seg))
+			return -1;
+		r->segments[i].offset = h->data_offset + i * h->segment_size;
+		r->segments[i].count = seg.count < h->capacity ?
+			seg.count : h->capacity;
+		r->segments[i].len = r->segments[i].count * rec;
+		if (r->segments[i].offset + r->segments[i].len > file_size)
+			r->segments[i].count = r->segments[i].len = 0;
+		r->num_samples += r->segments[i].count;
+		r->dropped += seg.dropped;
+	}
+	return 0;
+}
+
+/* Segments of a store, or the whole of a plain file as one segment. */
+static int find_segments(struct pm_reader *r, uint64_t file_size)
+{
+	struct pm_store_header *h = &r->header;
+	struct pm_store_segment seg;
+	size_t rec;
+	unsigned int i;
+
+	if (!pm_store_check(r->fd)) {
+		r->format = PM_FORMAT_PLAIN;
+		r->num_segments = 1;
+		r->segments = malloc(sizeof(*r->segments));
+		if (!r->segments)
+			return -1;
+		rec = sizeof(struct saved_data_entry);
+		r->segments[0].offset = 0;
+		r->segments[0].count = file_size / rec;
+		r->segments[0].len = r->segments[0].count * rec;
+		r->num_samples = r->segments[0].count;
+		return 0;
+	}
+
+	if (pm_store_info(r->fd, h, NULL)) {
+		fprintf(stderr, "Not a sample store of version 1 to %d\n",
+			PM_STORE_VERSION);
+		errno = EINVAL;
+		return -1;
+	}
+	if (h->version == 1)
+		return find_v1_segments(r, file_size);
+	r->format = h->flags & PM_STORE_DELTA ? PM_FORMAT_DELTA :
+		PM_FORMAT_PACKED;
+	/* packed records have a fixed size */
+	rec = pm_store_record_max(h);
+	r->num_segments = h->num_tasks < h->max_tasks ?
+		h->num_tasks : h->max_tasks;
+	r->segments = malloc(r->num_segments * sizeof(*r->segments) + 1);
+	if (!r->segments)
+		return -1;
+
+	for (i = 0; i < r->num_segments; i++) {
+		if (pread(r->fd, &seg, sizeof(seg), sizeof(*h) +
+			  i * sizeof(seg)) != sizeof(seg))
+			return -1;
+		r->segments[i].offset = h->data_offset + i * h->segment_size;
+		r->segments[i].len = seg.used < h->segment_size ?
+			seg.used : h->segment_size;
+		if (r->segments[i].offset + r->segments[i].len > file_size)
+			r->segments[i].len = 0;
+		/* a record may be written but not counted yet */
+		if (r->format == PM_FORMAT_PACKED)
+			r->segments[i].count = r->segments[i].len / rec;
+		else
+			r->segments[i].count = seg.count;
+		r->num_samples += r->segments[i].count;
+		r->dropped += seg.dropped;
+	}
+	return 0;
+}
+
+int pm_reader_open(struct pm_reader *r, const char *filename)
+{
+	struct stat st;
+	int err;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = open(filename, O_RDONLY);
+	if (r->fd == -1)
+		return -1;
+	if (fstat(r->fd, &st) || find_segments(r, st.st_size))
+		goto fail;
+	r->seg = -1;
+
+	if (st.st_size > 0 && (uint64_t) st.st_size == (size_t) st.st_size) {
+		r->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+			      r->fd, 0);
+		if (r->map == MAP_FAILED)
+			r->map = NULL;
+	}
+	if (r->map) {
+		r->map_len = st.st_size;
+		madvise((void *) r->map, r->map_len, MADV_SEQUENTIAL);
+	} else {
+		r->buf = malloc(READ_BLOCK);
+		if (!r->buf)
+			goto fail;
+		posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	return 0;
+
+fail:
+	err = errno;
+	free(r->segments);
+	close(r->fd);
+	errno = err;
+	return -1;
+}
+
+void pm_reader_close(struct pm_reader *r)
+{
+	if (r->map)
+		munmap((void *) r->map, r->map_len);
+	free(r->buf);
+	free(r->segments);
+	close(r->fd);
+}
+
+static void start_segment(struct pm_reader *r)
+{
+	struct pm_reader_segment *s = &r->segments[r->seg];
+
+	r->left = s->count;
+	memset(r->last, 0, sizeof(r->last));
+	if (r->map) {
+		r->pos = r->map + s->offset;
+		r->end = r->pos + s->len;
+		/* segments start at page boundaries */
+		if (s->len)
+			madvise((void *) r->pos, s->len, MADV_WILLNEED);
+	} else {
+		r->pos = r->end = r->buf;
+		r->next = s->offset;
+		r->seg_end = s->offset + s->len;
+	}
+}
+
+/* Make sure that need bytes are in the window, if the segment has them
+ * (streaming only). Returns -1 on a read error.
+ */
+static int refill(struct pm_reader *r, size_t need)
+{
+	size_t keep = r->end - r->pos, len;
+	ssize_t got;
+
+	if (r->map || keep >= need || r->next >= r->seg_end)
+		return 0;
+	memmove(r->buf, r->pos, keep);
+	r->pos = r->buf;
+	r->end = r->buf + keep;
+	len = READ_BLOCK - keep;
+	if (len > r->seg_end - r->next)
+		len = r->seg_end - r->next;
+	while (len) {
+		got = pread(r->fd, (unsigned char *) r->end, len, r->next);
+		if (got <= 0) {
+			r->err = got ? errno : EIO;
+			return -1;
+		}
+		r->end += got;
+		r->next += got;
+		len -= got;
+	}
+	return 0;
+}
+
+const struct saved_data_entry* pm_reader_next(struct pm_reader *r)
+{
+	const struct saved_data_entry *plain;
+	const struct pm_record *rec;
+	const unsigned char *pos;
+	size_t len = pm_store_record_max(&r->header);
+	uint64_t zigzag, cpu, plen = 0;
+	int kind, slot;
+
+	while (!r->left) {
+		if (r->seg + 1 >= (int) r->num_segments)
+			return NULL;
+		r->seg++;
+		start_segment(r);
+	}
+	r->left--;
+
+	switch (r->format) {
+	case PM_FORMAT_PLAIN:
+		if (refill(r, sizeof(*plain)) ||
+		    r->end - r->pos < sizeof(*plain))
+			break;
+		/* records are aligned in the map and in the window */
+		plain = (const struct saved_data_entry *) r->pos;
+		r->pos += sizeof(*plain);
+		return plain;
+
+	case PM_FORMAT_PACKED:
+		if (refill(r, len) || r->end - r->pos < len)
+			break;
+		rec = (const struct pm_record *) r->pos;
+		if (r->header.flags & PM_STORE_COUNTERS)
+			memcpy(r->counters, rec + 1, PM_COUNTERS_SIZE);
+		r->pos += len;
+		r->sample.access_type = rec->access_type;
+		r->sample.access_time = rec->access_time;
+		r->sample.cpu = rec->cpu;
+		r->sample.preemption_length = rec->preemption_length;
+		return &r->sample;
+
+	case PM_FORMAT_DELTA:
+		if (refill(r, len) || r->pos >= r->end)
+			break;
+		r->sample.access_type = *r->pos;
+		kind = pm_delta_kind(r->sample.access_type);
+		pos = get_varint(r->pos + 1, r->end, &zigzag);
+		if (pos)
+			pos = get_varint(pos, r->end, &cpu);
+		if (pos && kind == 2)
+			pos = get_varint(pos, r->end, &plen);
+		if (r->header.flags & PM_STORE_COUNTERS)
+			for (slot = 0; pos && slot < NUM_PERF_SLOTS; slot++)
+				pos = get_varint(pos, r->end,
+						 &r->counters[slot]);
+		if (!pos)
+			break;
+		r->pos = pos;
+		r->last[kind] += (zigzag >> 1) ^ -(zigzag & 1);
+		r->sample.access_time = r->last[kind];
+		r->sample.cpu = cpu;
+		r->sample.preemption_length = plen;
+		return &r->sample;
+	}
+
+	/* truncated: skip the rest of the segment */
+	r->left = 0;
+	r->pos = r->end;
+	r->next = r->seg_end;
+	return r->err ? NULL : pm_reader_next(r);
+}
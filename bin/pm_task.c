@@ -21,9 +21,170 @@
 /* architectural dependend code for pm measurement */
 #include "pm_arch.h"
 
+#include "backing.h"
+#include "numa.h"
+#include "perfctr.h"
+#include "pm_store.h"
+#include "topology.h"
+#include "tsc.h"
+
 #include <sys/io.h>
 
-int mem_block[NUMWS][INTS_PER_WSS] __attribute__ ((aligned(CACHEALIGNMENT)));
+/* sysfs cache levels to look for the LLC in */
+#define MAX_CACHE_LEVEL 4
+/* CPUs described in the header of the sample store */
+#define MAX_STORE_CPUS 1024
+
+/* Accesses that keep the working set warm between jobs, precomputed so
+ * that the polling loop touches nothing but the working set, the
+ * stream and the control page (random() takes the glibc lock and
+ * touches its state). Entries are int offsets into the working set,
+ * shifted left by one, with the low bit set for writes; READRATIO
+ * percent of them are reads. The whole stream is rotated by a new
+ * random offset each time it wraps around, so that it covers the
+ * working set over time.
+ */
+#define WARM_STREAM_LEN	1024	/* a power of two: 4 KB */
+/* offsets must fit in 31 bits */
+#define MAX_WSS		(2 * 1024 * 1024 * 4)
+
+/* num_ws working sets of ints_per_ws ints each, back to back in one
+ * region mapped according to the backing mode (-M)
+ */
+int *mem_block;
+unsigned long num_ws;
+size_t ints_per_ws;
+
+/* our segment of the sample store of the task set */
+static struct pm_store store;
+
+/* Performance counters of this task (-E). The timed phases run with
+ * interrupts off, so they are read with rdpmc only.
+ */
+static struct perf_group perf;
+static int use_counters;
+
+/* Counter deltas of a timed phase from the counters before (start)
+ * and after (stop) it, 0 if a counter was off the PMU.
+ */
+static inline void phase_counters(uint64_t *deltas, const uint64_t *start,
+				  const uint64_t *stop, int unread)
+{
+	int slot;
+
+	for (slot = 0; slot < NUM_PERF_SLOTS; slot++)
+		deltas[slot] = unread ? 0 : stop[slot] - start[slot];
+}
+
+static inline int read_counters(uint64_t *values)
+{
+	return use_counters ? perf_group_read_user(&perf, values) : 0;
+}
+
+static uint32_t warm_stream[WARM_STREAM_LEN];
+static uint32_t warm_state = SEEDVAL;
+
+/* xorshift32: our own PRNG, no locks and no shared state */
+static inline uint32_t xorshift(void)
+{
+	warm_state ^= warm_state << 13;
+	warm_state ^= warm_state >> 17;
+	warm_state ^= warm_state << 5;
+	return warm_state;
+}
+
+static void init_warm_stream(void)
+{
+	uint32_t tmp;
+	int i, j;
+
+	for (i = 0; i < WARM_STREAM_LEN; i++)
+		warm_stream[i] = (xorshift() % ints_per_ws) << 1 |
+			(i >= WARM_STREAM_LEN * READRATIO / 100);
+	/* shuffle the reads and writes */
+	for (i = WARM_STREAM_LEN - 1; i > 0; i--) {
+		j = xorshift() % (i + 1);
+		tmp = warm_stream[i];
+		warm_stream[i] = warm_stream[j];
+		warm_stream[j] = tmp;
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: pm_task [-M BACKING] [-w WSS] [-c CACHESIZE] "
+		"[-n NUMWS] [-S TASKS] [-d SAMPLES] [-D] [-E]\n"
+		"               [-b BUDGET] FILENAME\n"
+		"       BACKING: anon-4k (default), thp, hugetlb-2m, "
+		"hugetlb-1g, shm, file, file:PATH\n"
+		"       WSS: working set size in KB, a multiple of 4 "
+		"(default %d)\n"
+		"       CACHESIZE: in KB (default: the LLC in sysfs, "
+		"or %d)\n"
+		"       NUMWS: working sets to cycle through "
+		"(default: 2 * CACHESIZE / WSS + 2)\n"
+		"       FILENAME: sample store shared by the TASKS tasks "
+		"of the task set\n"
+		"       (default 1), SAMPLES each (default %d)\n"
+		"       -D: delta encode the samples (when creating "
+		"the store); SAMPLES\n"
+		"       then sizes the segments at %d bytes a sample, "
+		"and how many fit\n"
+		"       depends on how well they compress\n"
+		"       -E: record LLC misses, dTLB load misses, "
+		"instructions and reference\n"
+		"       cycles of each timed access (when creating the "
+		"store; needs rdpmc)\n"
+		"       BUDGET: accesses that keep the working set warm "
+		"per poll of the\n"
+		"       control page (default 1)\n",
+		WSS, CACHESIZE, DATAPOINTS, PM_DELTA_AVG);
+}
+
+/* size of the LLC of cpu 0 in KB, CACHESIZE if sysfs does not know */
+static int llc_size(void)
+{
+	int sizes[MAX_CACHE_LEVEL + 1];
+	int level = get_cache_sizes(0, sizes, MAX_CACHE_LEVEL);
+
+	return level && sizes[level] ? sizes[level] : CACHESIZE;
+}
+
+/* Caches and nodes of the CPUs, for the header of the sample store.
+ * Returns the number of CPUs described.
+ */
+static int get_topology(struct pm_store_cpu *cpus, int max_cpus)
+{
+	static int llc_of[MAX_STORE_CPUS], first_of_l2[MAX_STORE_CPUS];
+	int sizes[MAX_CACHE_LEVEL + 1];
+	int known = get_cache_sizes(0, sizes, MAX_CACHE_LEVEL);
+	int num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	int cpu, l2, level, num_l2 = 0;
+
+	if (num_cpus > max_cpus)
+		num_cpus = max_cpus;
+	get_llc_domains(num_cpus, llc_of);
+
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		cpus[cpu].l2 = cpus[cpu].llc = UINT16_MAX;
+		cpus[cpu].node = numa_node_of_cpu(cpu);
+		cpus[cpu].pad = 0;
+		if (!known)
+			continue;
+		cpus[cpu].llc = llc_of[cpu];
+		/* the L2 (or closer) of an earlier CPU, or a new one */
+		for (l2 = 0; l2 < num_l2; l2++) {
+			level = get_shared_cache_level(cpu, first_of_l2[l2]);
+			if (level && level <= 2)
+				break;
+		}
+		if (l2 == num_l2)
+			first_of_l2[num_l2++] = cpu;
+		cpus[cpu].l2 = l2;
+	}
+	return num_cpus;
+}
 
 /* Setup flags, then enter loop to measure costs. */
 int main(int argc, char **argv)
@@ -37,7 +198,6 @@ int main(int argc, char **argv)
 	unsigned long curr_job_count = 0;
 	unsigned long curr_sched_count = 0;
 	unsigned int curr_cpu = 0;
-	unsigned long curr_last_rt_task = 0;
 	unsigned long curr_ws = 0;
 
 	unsigned long long curr_preemption_length = 0;
@@ -47,36 +207,171 @@ int main(int argc, char **argv)
 	int *mem_ptr = NULL;
 	int *mem_ptr_end = NULL;
 
-	struct data_entry data_points[DATAPOINTS];
-	int data_count = 0;
-	int data_wrapped = 0;
+	char access_type;
+	/* C, H, H of a job, recorded after the NP section */
+	char access_types[1 + REFTOTAL];
+	unsigned long long access_times[1 + REFTOTAL];
+	uint64_t counters[1 + REFTOTAL][NUM_PERF_SLOTS];
+	uint64_t ctr_start[NUM_PERF_SLOTS], ctr_stop[NUM_PERF_SLOTS];
+	int unread;
 
 	int refcount;
 
 	int task_pid = gettid();
 	int task_period;
-	int read, *loc_ptr;
+	int *loc_ptr;
+	uint32_t warm_pos = 0, warm_rot = 0, warm;
+	unsigned int warm_budget = 1, n;
 	struct rt_task param;
 
 	char *filename;
-#ifdef DEBUG
-	int i;
-#endif
+	int opt;
+	enum backing_mode backing = BACKING_ANON;
+	const char *backing_path = NULL;
+	struct backing ws_backing;
+	/* timing overhead is subtracted from the access times */
+	struct tsc_calibration tsc;
+	int wss = WSS, cachesize = 0;
+	size_t ws_bytes;
+	static struct pm_store_cpu store_cpus[MAX_STORE_CPUS];
+	struct pm_store_params store_params = {
+		.max_tasks = 1,
+		.capacity = DATAPOINTS,
+		.flags = 0,
+	};
+
+	while ((opt = getopt(argc, argv, "M:w:c:n:S:d:DEb:")) != -1) {
+		switch (opt) {
+		case 'M':
+			if (parse_backing(optarg, &backing, &backing_path)) {
+				fprintf(stderr, "pm_task: unknown backing %s\n",
+					optarg);
+				usage();
+				return -1;
+			}
+			break;
+		case 'w':
+			wss = atoi(optarg);
+			break;
+		case 'c':
+			cachesize = atoi(optarg);
+			if (cachesize <= 0) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'n':
+			num_ws = atol(optarg);
+			if (!num_ws) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'S':
+			store_params.max_tasks = atoi(optarg);
+			if (!store_params.max_tasks) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'd':
+			store_params.capacity = atol(optarg);
+			if (!store_params.capacity) {
+				usage();
+				return -1;
+			}
+			break;
+		case 'D':
+			store_params.flags |= PM_STORE_DELTA;
+			break;
+		case 'E':
+			store_params.flags |= PM_STORE_COUNTERS;
+			break;
+		case 'b':
+			warm_budget = atoi(optarg);
+			if (!warm_budget) {
+				usage();
+				return -1;
+			}
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
 
-	if (argc < 2) {
+	/* readwrite_one_thousand_ints() touches 4 KB at a time */
+	if (wss <= 0 || wss % 4 || wss >= MAX_WSS) {
+		fprintf(stderr, "pm_task: bad working set size %d\n", wss);
+		usage();
+		return -1;
+	}
+	if (!cachesize)
+		cachesize = llc_size();
+	if (!num_ws)
+		num_ws = NUMWS(cachesize, wss);
+	ints_per_ws = INTS_PER_WSS(wss);
+	ws_bytes = sizeof(int) * num_ws * ints_per_ws;
+
+	if (optind >= argc) {
 		printf("pm_task: need a filename\n");
 		return -1;
 	}
 
-	filename = argv[1];
+	filename = argv[optind];
 #ifdef DEBUG
 	fprintf(stderr, "Saving on %s\n",filename);
+	fprintf(stderr, "WSS %d KB, cache %d KB, %lu working sets\n",
+		wss, cachesize, num_ws);
+#endif
+
+	if (tsc_calibrate(&tsc)) {
+		perror("Cannot calibrate the TSC");
+		return -1;
+	}
+#ifdef DEBUG
+	fprintf(stderr, "TSC %.3f MHz, timer overhead %llu, jitter %llu\n",
+		tsc.mhz, (unsigned long long) tsc.overhead,
+		(unsigned long long) tsc.jitter);
 #endif
 
-	/* Initialize random library for read/write ratio enforcement. */
-	srandom(SEEDVAL);
+	/* Precompute the accesses, with the read/write ratio enforced. */
+	init_warm_stream();
+
+	if (backing_map(&ws_backing, backing, ws_bytes, backing_path)) {
+		perror("Cannot map the working sets");
+		return -1;
+	}
+	mem_block = ws_backing.base;
+
+	store_params.tsc_mhz = tsc.mhz;
+	store_params.wss = wss;
+	store_params.cachesize = cachesize;
+	store_params.num_ws = num_ws;
+	store_params.num_cpus = get_topology(store_cpus, MAX_STORE_CPUS);
+	store_params.cpus = store_cpus;
+	if (pm_store_open(&store, filename, &store_params)) {
+		perror("Cannot open the sample store");
+		return -1;
+	}
+
+	/* the creator of the store decides whether there are counters */
+	if (store.header->flags & PM_STORE_COUNTERS) {
+		if (perf_group_open(&perf, 0)) {
+			perror("Cannot open the performance counters");
+			return -1;
+		}
+		if (!perf.rdpmc) {
+			fprintf(stderr, "pm_task: -E needs hardware counters "
+				"readable with rdpmc\n");
+			return -1;
+		}
+		use_counters = 1;
+	}
 
-	/* this will lock all pages and will call init_kernel_iface */
+	/* this will lock all pages (the working sets too) and will call
+	 * init_kernel_iface
+	 */
 	init_litmus();
 
 	/* Ensure that the pages that we care about, either because they
@@ -85,7 +380,7 @@ int main(int argc, char **argv)
 	 */
 	memset(&param, 0, sizeof(struct rt_task));
 
-	memset(&mem_block, 0, sizeof(int) * NUMWS * INTS_PER_WSS);
+	memset(mem_block, 0, ws_bytes);
 
 	memset(&mem_ptr, 0, sizeof(int*));
 	memset(&mem_ptr_end, 0, sizeof(int*));
@@ -97,6 +392,7 @@ int main(int argc, char **argv)
 	}
 
 	task_period = param.period / NS_PER_MS;
+	pm_store_set_task(&store, param.period, param.exec_cost);
 
 	/* get the shared control page for this task */
 	if (!(ctrl = get_ctrl_page())) {
@@ -128,88 +424,71 @@ int main(int argc, char **argv)
 			curr_job_count = ctrl->job_count;
 			curr_sched_count = ctrl->sched_count;
 			curr_cpu = ctrl->cpu;
-			curr_last_rt_task = ctrl->last_rt_task;
 
 			barrier();
 
 			/* job's portion of the mem_block */
-			curr_ws = curr_job_count % NUMWS;
+			curr_ws = curr_job_count % num_ws;
 
-			mem_ptr = &mem_block[curr_ws][0];
-			mem_ptr_end = mem_ptr + INTS_PER_WSS;
+			mem_ptr = mem_block + curr_ws * ints_per_ws;
+			mem_ptr_end = mem_ptr + ints_per_ws;
 
 			/* Access WS when cache cold, then immediately
 			 * re-access to calculate "cache-hot" access time.
 			 */
 
 			/* Cache-cold accesses. */
-			start_time = get_cycles();
+			unread = read_counters(ctr_start);
+			start_time = tsc_begin();
 			for (; mem_ptr < mem_ptr_end; mem_ptr += 1024)
 				readwrite_one_thousand_ints(mem_ptr);
-			end_time = get_cycles();
-
-                        data_points[data_count].timestamp = end_time;
+			end_time = tsc_end();
+			unread |= read_counters(ctr_stop);
 
 			/* Am I the same I was before? */
 			if (curr_job_count != ctrl->job_count ||
 					curr_sched_count != ctrl->sched_count ||
 					curr_cpu != ctrl->cpu)
 				/* fishiness */
-				data_points[data_count].access_type = 'c';
+				access_type = 'c';
 			else
 				/* okay */
-				data_points[data_count].access_type = 'C';
-
-			data_points[data_count].access_time =
-				end_time - start_time;
-			data_points[data_count].cpu = curr_cpu;
-			data_points[data_count].job_count = curr_job_count;
-			data_points[data_count].sched_count = curr_sched_count;
-			data_points[data_count].last_rt_task = curr_last_rt_task;
-			data_points[data_count].preemption_length = 0;
+				access_type = 'C';
 
-                        data_wrapped = ((data_count+1) / DATAPOINTS > 0);
-                        data_count = (data_count+1) % DATAPOINTS;
+			access_types[0] = access_type;
+			access_times[0] = tsc_cycles(&tsc, start_time,
+						     end_time);
+			phase_counters(counters[0], ctr_start, ctr_stop,
+				       unread);
 
 			barrier();
 
 			/* "Best case". Read multiple times. */
 			for (refcount = 0; refcount < REFTOTAL; refcount++) {
 
-				mem_ptr = &mem_block[curr_ws][0];
+				mem_ptr = mem_block + curr_ws * ints_per_ws;
 
-				start_time = get_cycles();
+				unread = read_counters(ctr_start);
+				start_time = tsc_begin();
 				for (; mem_ptr < mem_ptr_end; mem_ptr += 1024)
 					readwrite_one_thousand_ints(mem_ptr);
-				end_time = get_cycles();
-
-				data_points[data_count].timestamp = end_time;
+				end_time = tsc_end();
+				unread |= read_counters(ctr_stop);
 
 				if (curr_job_count != ctrl->job_count ||
 				   curr_sched_count != ctrl->sched_count ||
 				   curr_cpu != ctrl->cpu)
 					/* fishiness */
-					data_points[data_count].
-						access_type = 'h';
+					access_type = 'h';
 				else
 					/* okay */
-					data_points[data_count].
-						access_type = 'H';
-
-				data_points[data_count].access_time =
-					end_time - start_time;
-				data_points[data_count].cpu = curr_cpu;
-				data_points[data_count].job_count =
-					curr_job_count;
-				data_points[data_count].sched_count =
-					curr_sched_count;
-				data_points[data_count].last_rt_task =
-					curr_last_rt_task;
-				data_points[data_count].preemption_length = 0;
-
-				data_wrapped =
-					((data_count+1) / DATAPOINTS > 0);
-				data_count = (data_count+1) % DATAPOINTS;
+					access_type = 'H';
+
+				access_types[1 + refcount] = access_type;
+				access_times[1 + refcount] =
+					tsc_cycles(&tsc, start_time, end_time);
+				phase_counters(counters[1 + refcount],
+					       ctr_start, ctr_stop, unread);
 			}
 
 			/* C, H, H, now exit the NP section
@@ -218,6 +497,17 @@ int main(int argc, char **argv)
 			 */
 			sti();
 
+			/* the first write to a page of the store faults,
+			 * so record them only now; keep C, H, H together:
+			 * drop them all if they do not fit
+			 */
+			if (pm_store_room(&store) < 1 + REFTOTAL)
+				pm_store_seal(&store);
+			for (refcount = 0; refcount <= REFTOTAL; refcount++)
+				pm_store_append(&store, access_types[refcount],
+						access_times[refcount],
+						curr_cpu, 0, counters[refcount]);
+
 		} else if (mem_ptr && mem_ptr_end &&
 			   (curr_sched_count != ctrl->sched_count ||
 			    curr_cpu != ctrl->cpu)) {
@@ -235,45 +525,38 @@ int main(int argc, char **argv)
 			curr_job_count = ctrl->job_count;
 			curr_sched_count = ctrl->sched_count;
 			curr_cpu = ctrl->cpu;
-			curr_last_rt_task = ctrl->last_rt_task;
 
 			barrier();
 
 			/* Measure preemption or migration cost. */
-			mem_ptr = &mem_block[curr_ws][0];
+			mem_ptr = mem_block + curr_ws * ints_per_ws;
 
-			start_time = get_cycles();
+			unread = read_counters(ctr_start);
+			start_time = tsc_begin();
 			for (; mem_ptr < mem_ptr_end; mem_ptr += 1024)
 				readwrite_one_thousand_ints(mem_ptr);
-			end_time = get_cycles();
-
-			data_points[data_count].timestamp = end_time;
+			end_time = tsc_end();
+			unread |= read_counters(ctr_stop);
 
 			/* just record pP, we tell the difference later */
                         if (curr_job_count != ctrl->job_count ||
                             curr_sched_count != ctrl->sched_count ||
                             curr_cpu != ctrl->cpu)
 				/* fishiness */
-                                data_points[data_count].access_type = 'p';
+                                access_type = 'p';
                         else
                                 /* okay */
-                                data_points[data_count].access_type = 'P';
+                                access_type = 'P';
 
 			/* exit NP now */
 			sti();
 
-                        data_points[data_count].access_time =
-                                                        end_time - start_time;
-                        data_points[data_count].cpu = curr_cpu;
-                        data_points[data_count].job_count = curr_job_count;
-                        data_points[data_count].sched_count = curr_sched_count;
-			data_points[data_count].last_rt_task =
-				curr_last_rt_task;
-			data_points[data_count].preemption_length =
-				curr_preemption_length;
-
-			data_wrapped = ((data_count+1) / DATAPOINTS > 0);
-			data_count = (data_count+1) % DATAPOINTS;
+			phase_counters(counters[0], ctr_start, ctr_stop,
+				       unread);
+			pm_store_append(&store, access_type,
+					tsc_cycles(&tsc, start_time, end_time),
+					curr_cpu, curr_preemption_length,
+					counters[0]);
 
 		} else if (mem_ptr && mem_ptr_end) {
 			/*
@@ -284,30 +567,39 @@ int main(int argc, char **argv)
 			 * do not want to skew the "cold" read of the WS
 			 * on the first job.
 			 */
-			read = (random() % 100) < READRATIO;
-			loc_ptr = &mem_block[curr_ws][0];
-			loc_ptr += (random() % INTS_PER_WSS);
+			for (n = 0; n < warm_budget; n++) {
+				warm = (warm_stream[warm_pos] >> 1) + warm_rot;
+				if (warm >= ints_per_ws)
+					warm -= ints_per_ws;
+				loc_ptr = mem_block + curr_ws * ints_per_ws + warm;
 
-			barrier();
+				barrier();
 
-			if (read)
-				read_mem(loc_ptr);
-			else
-				write_mem(loc_ptr);
+				if (warm_stream[warm_pos] & 1)
+					write_mem(loc_ptr);
+				else
+					read_mem(loc_ptr);
+
+				warm_pos = (warm_pos + 1) & (WARM_STREAM_LEN - 1);
+				if (!warm_pos)
+					warm_rot = xorshift() % ints_per_ws;
+			}
 		}
 	}
 
 #ifdef DEBUG
-	/* Print (most recent) results. */
-	for (i = 0; i < (data_wrapped ? DATAPOINTS : data_count) ; i++)
-		fprintf(stderr, "(%c) - ACC %llu, CPU %u, PLEN %llu\n",
-		       data_points[i].access_type,
-		       data_points[i].access_time, data_points[i].cpu,
-		       data_points[i].preemption_length);
+	fprintf(stderr, "Recorded %llu samples (%llu bytes)\n",
+		(unsigned long long) store.segment->count,
+		(unsigned long long) store.segment->used);
 #endif
-	serialize_data_entry(filename, data_points,
-			(data_wrapped ? DATAPOINTS : data_count));
-
+	if (store.segment->dropped)
+		fprintf(stderr, "pm_task: %llu samples did not fit in %s\n",
+			(unsigned long long) store.segment->dropped, filename);
+	pm_store_close(&store);
+	if (use_counters)
+		perf_group_close(&perf);
+
+	backing_unmap(&ws_backing);
 	return 0;
 }
 
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE /* for pthread_attr_setaffinity_np */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "polluter.h"
+
+#define NSEC_PER_SEC 1000000000LL
+/* a paced polluter that falls further behind than this (e.g., because
+ * it was preempted) resumes its rate instead of catching up in a burst
+ */
+#define PACE_SLACK_NS 10000000LL
+
+static const char *unit_names[NUM_RATE_UNITS] = {
+	[RATE_MBPS] = "mbps",
+	[RATE_LLC]  = "llc",
+};
+
+int parse_rate_unit(const char *name, enum polluter_unit *unit)
+{
+	int i;
+
+	for (i = 0; i < NUM_RATE_UNITS; i++)
+		if (!strcmp(name, unit_names[i])) {
+			*unit = i;
+			return 0;
+		}
+	return -1;
+}
+
+const char *rate_unit_name(enum polluter_unit unit)
+{
+	return unit_names[unit];
+}
+
+int parse_polluter_spec(const char *spec, struct polluter_spec *out)
+{
+	char buf[256], *field[5];
+	int i, num = 0;
+
+	if (strlen(spec) >= sizeof(buf))
+		return -1;
+	strcpy(buf, spec);
+	field[num++] = buf;
+	for (i = 0; buf[i] && num < 5; i++)
+		if (buf[i] == ':') {
+			buf[i] = '\0';
+			field[num++] = buf + i + 1;
+		}
+
+	out->footprint = atoi(field[0]);
+	if (num > 1 && parse_access_pattern(field[1], &out->pattern))
+		return -1;
+	if (num > 2)
+		out->write_cycle = atoi(field[2]);
+	if (num > 3)
+		out->rate = atol(field[3]);
+	if (num > 4 && parse_rate_unit(field[4], &out->unit))
+		return -1;
+	return out->footprint > 0 && out->write_cycle >= 0 &&
+		out->rate >= 0 ? 0 : -1;
+}
+
+static long long elapsed_ns(const struct timespec *from,
+			    const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * NSEC_PER_SEC +
+		(to->tv_nsec - from->tv_nsec);
+}
+
+static unsigned long long progress(struct polluter *p)
+{
+	return p->spec.unit == RATE_LLC ? p->misses : p->bytes;
+}
+
+/* The schedule of a paced polluter: from since on, progress is due at
+ * the target rate on top of done.
+ */
+struct pace {
+	struct timespec since;
+	unsigned long long done;
+};
+
+/* Sleep until the progress of p is on schedule again. */
+static void pace(struct polluter *p, struct pace *pace)
+{
+	unsigned long long ahead = progress(p) - pace->done;
+	struct timespec now, until;
+	long long due, late;
+
+	/* 1 MB/s is 10^6 bytes, 1 K misses/s 10^3 misses in 10^9 ns */
+	if (p->spec.unit == RATE_LLC)
+		due = ahead * 1000000 / p->spec.rate;
+	else
+		due = ahead * 1000 / p->spec.rate;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	late = elapsed_ns(&pace->since, &now) - due;
+	if (late > PACE_SLACK_NS) {
+		pace->since = now;
+		pace->done = progress(p);
+		return;
+	}
+	if (late >= 0)
+		return;
+
+	until.tv_sec = pace->since.tv_sec + due / NSEC_PER_SEC;
+	until.tv_nsec = pace->since.tv_nsec + due % NSEC_PER_SEC;
+	if (until.tv_nsec >= NSEC_PER_SEC) {
+		until.tv_sec++;
+		until.tv_nsec -= NSEC_PER_SEC;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			       &until, NULL) == EINTR)
+		;
+}
+
+static int build_chunks(struct polluter *p)
+{
+	int i, kb, left = p->spec.footprint;
+	int *mem = p->mem;
+
+	for (i = 0; i < p->num_chunks; i++) {
+		kb = left < POLLUTER_CHUNK_KB ? left : POLLUTER_CHUNK_KB;
+		if (build_layout(&p->chunks[i], p->spec.pattern,
+				 p->spec.stride, mem, kb))
+			return -1;
+		mem += (size_t) kb * 1024 / sizeof(int);
+		left -= kb;
+	}
+	return 0;
+}
+
+static void* polluter_thread(void *arg)
+{
+	struct polluter *p = arg;
+	size_t len = (size_t) p->spec.footprint * 1024;
+	uint64_t values[NUM_PERF_SLOTS];
+	unsigned long long base = 0;
+	struct pace schedule;
+	sigset_t all;
+	size_t i;
+	int c;
+
+	/* signals are for the measuring thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	/* Map and first touch from our CPU, so that the pages come from our
+	 * node. If the process has locked its future memory, mmap() itself
+	 * faults them in, in our context.
+	 */
+	p->mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p->mem == MAP_FAILED) {
+		p->mem = NULL;
+		p->err = errno;
+		p->ready = 1;
+		return NULL;
+	}
+	for (i = 0; i < len / sizeof(int); i++)
+		p->mem[i] = i;
+	if (build_chunks(p)) {
+		p->err = ENOMEM;
+		p->ready = 1;
+		return NULL;
+	}
+
+	if (!perf_group_open(&p->perf, 0)) {
+		p->counting = !p->perf.software[PERF_LLC_MISSES];
+		if (!p->counting)
+			perf_group_close(&p->perf);
+	}
+	if (p->spec.unit == RATE_LLC && !p->counting) {
+		p->err = ENOTSUP;
+		p->ready = 1;
+		return NULL;
+	}
+	if (p->counting) {
+		perf_group_read(&p->perf, values);
+		base = values[PERF_LLC_MISSES];
+	}
+	p->ready = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &schedule.since);
+	schedule.done = 0;
+	while (!p->stop) {
+		for (c = 0; c < p->num_chunks && !p->stop; c++) {
+			p->mem[0] += p->spec.kernel(&p->chunks[c],
+						    p->spec.write_cycle);
+			p->bytes += (unsigned long long)
+				p->chunks[c].num_lines * CACHE_LINE_SIZE;
+			if (p->counting) {
+				perf_group_read(&p->perf, values);
+				p->misses = values[PERF_LLC_MISSES] - base;
+			}
+			if (p->spec.rate)
+				pace(p, &schedule);
+		}
+	}
+	if (p->counting)
+		perf_group_close(&p->perf);
+	return NULL;
+}
+
+static int create_thread(struct polluter *p)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpus;
+	int err;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(p->cpu, &cpus);
+	pthread_attr_init(&attr);
+	/* not the real-time priority of the measuring thread */
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	param.sched_priority = 0;
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	err = pthread_create(&p->thread, &attr, polluter_thread, p);
+	pthread_attr_destroy(&attr);
+	return err;
+}
+
+static void free_chunks(struct polluter *p)
+{
+	int i;
+
+	for (i = 0; i < p->num_chunks; i++)
+		free_layout(&p->chunks[i]);
+	free(p->chunks);
+	p->chunks = NULL;
+}
+
+int polluter_start(struct polluter *p, int cpu,
+		   const struct polluter_spec *spec)
+{
+	size_t len = (size_t) spec->footprint * 1024;
+	struct timespec wait = {0, 1000000};
+	int err;
+
+	memset(p, 0, sizeof(*p));
+	p->cpu = cpu;
+	p->spec = *spec;
+	if (!p->spec.kernel)
+		p->spec.kernel = select_touch_kernel(spec->pattern,
+						     spec->write_cycle);
+	p->num_chunks = (spec->footprint + POLLUTER_CHUNK_KB - 1) /
+		POLLUTER_CHUNK_KB;
+	p->chunks = calloc(p->num_chunks, sizeof(*p->chunks));
+	if (!p->chunks)
+		return ENOMEM;
+
+	err = create_thread(p);
+	if (err)
+		goto fail;
+	while (!p->ready)
+		nanosleep(&wait, NULL);
+	if (p->err) {
+		err = p->err;
+		pthread_join(p->thread, NULL);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	free_chunks(p);
+	if (p->mem)
+		munmap(p->mem, len);
+	p->mem = NULL;
+	return err;
+}
+
+void polluter_mark(struct polluter *p, struct polluter_mark *mark)
+{
+	mark->bytes = p->bytes;
+	mark->misses = p->misses;
+	clock_gettime(CLOCK_MONOTONIC, &mark->time);
+}
+
+double polluter_rate(struct polluter *p, const struct polluter_mark *mark,
+		     enum polluter_unit unit)
+{
+	struct polluter_mark now;
+	long long ns;
+
+	polluter_mark(p, &now);
+	ns = elapsed_ns(&mark->time, &now.time);
+	if (ns <= 0)
+		return 0;
+	/* per ns, bytes are 1000 MB/s and misses 10^6 K misses/s */
+	if (unit == RATE_LLC)
+		return (now.misses - mark->misses) * 1000000.0 / ns;
+	return (now.bytes - mark->bytes) * 1000.0 / ns;
+}
+
+void polluter_stop(struct polluter *p)
+{
+	p->stop = 1;
+	pthread_join(p->thread, NULL);
+	free_chunks(p);
+	munmap(p->mem, (size_t) p->spec.footprint * 1024);
+	p->mem = NULL;
+}
@@ -0,0 +1,142 @@
+#define _GNU_SOURCE /* for pthread_setaffinity_np */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "preemptor.h"
+
+static void wait_sem(sem_t *sem)
+{
+	while (sem_wait(sem) && errno == EINTR)
+		;
+}
+
+static void* preemptor_thread(void *arg)
+{
+	struct preemptor *p = arg;
+	sigset_t all;
+
+	/* signals are for the measuring thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	for (;;) {
+		wait_sem(&p->start);
+		if (p->stop)
+			break;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &p->release, NULL) == EINTR)
+			;
+		p->mem[0] += p->kernel(&p->layout, p->write_cycle);
+		p->runs++;
+		sem_post(&p->done);
+	}
+	return NULL;
+}
+
+static int create_thread(struct preemptor *p, int priority)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	int err;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	if (priority > 0) {
+		param.sched_priority = priority;
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	} else {
+		param.sched_priority = 0;
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	}
+	pthread_attr_setschedparam(&attr, &param);
+	err = pthread_create(&p->thread, &attr, preemptor_thread, p);
+	pthread_attr_destroy(&attr);
+
+	/* e.g., best-effort runs without CAP_SYS_NICE */
+	if (err == EPERM && priority > 0)
+		return create_thread(p, 0);
+	return err;
+}
+
+int preemptor_start(struct preemptor *p, int footprint,
+		    enum access_pattern pattern, int stride,
+		    int write_cycle, int priority)
+{
+	size_t len = (size_t) footprint * 1024;
+	size_t i;
+	int err;
+
+	memset(p, 0, sizeof(*p));
+	p->footprint = footprint;
+	p->pattern = pattern;
+	p->write_cycle = write_cycle;
+	p->kernel = select_touch_kernel(pattern, write_cycle);
+
+	p->mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p->mem == MAP_FAILED) {
+		p->mem = NULL;
+		return errno;
+	}
+	for (i = 0; i < len / sizeof(int); i++)
+		p->mem[i] = i;
+	if (build_layout(&p->layout, pattern, stride, p->mem, footprint)) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	sem_init(&p->start, 0, 0);
+	sem_init(&p->done, 0, 0);
+	err = create_thread(p, priority);
+	if (err) {
+		sem_destroy(&p->start);
+		sem_destroy(&p->done);
+		free_layout(&p->layout);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	munmap(p->mem, len);
+	p->mem = NULL;
+	return err;
+}
+
+int preemptor_release(struct preemptor *p, int cpu,
+		      const struct timespec *release)
+{
+	cpu_set_t cpus;
+	int err;
+
+	/* it is blocked, so it moves right away */
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	err = pthread_setaffinity_np(p->thread, sizeof(cpus), &cpus);
+	if (err)
+		return err;
+	p->release = *release;
+	sem_post(&p->start);
+	return 0;
+}
+
+void preemptor_wait(struct preemptor *p)
+{
+	wait_sem(&p->done);
+}
+
+void preemptor_stop(struct preemptor *p)
+{
+	p->stop = 1;
+	sem_post(&p->start);
+	pthread_join(p->thread, NULL);
+	sem_destroy(&p->start);
+	sem_destroy(&p->done);
+	free_layout(&p->layout);
+	munmap(p->mem, (size_t) p->footprint * 1024);
+	p->mem = NULL;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "stopping.h"
+
+/* two-sided 95% */
+#define Z_95 1.96
+/* fewer samples say nothing about the spread */
+#define STOP_MIN_SAMPLES 30
+
+static const char *statistic_names[NUM_STOP_STATISTICS] = {
+	[STOP_MEAN] = "mean",
+	[STOP_P99]  = "p99",
+	[STOP_MAX]  = "max",
+};
+
+const char *stop_statistic_name(enum stop_statistic statistic)
+{
+	return statistic_names[statistic];
+}
+
+int parse_stop_rule(const char *spec, struct stop_rule *rule)
+{
+	const char *colon = strchr(spec, ':');
+	char *end;
+	int i;
+
+	if (!colon)
+		return -1;
+	for (i = 0; i < NUM_STOP_STATISTICS; i++)
+		if (strlen(statistic_names[i]) == (size_t) (colon - spec) &&
+		    !strncmp(spec, statistic_names[i], colon - spec))
+			break;
+	if (i == NUM_STOP_STATISTICS)
+		return -1;
+
+	rule->statistic = i;
+	rule->width = strtod(colon + 1, &end);
+	rule->floor = 0;
+	return *end || rule->width <= 0 ? -1 : 0;
+}
+
+int stop_series_add(struct stop_series *series, double value)
+{
+	double delta, *values;
+	unsigned long size;
+
+	if (series->n == series->size) {
+		size = series->size ? 2 * series->size : 1024;
+		values = realloc(series->values, sizeof(double) * size);
+		if (!values)
+			return -1;
+		series->values = values;
+		series->size = size;
+	}
+	series->values[series->n++] = value;
+
+	delta = value - series->mean;
+	series->mean += delta / series->n;
+	series->m2 += delta * (value - series->mean);
+	if (series->n == 1 || value > series->max)
+		series->max = value;
+	return 0;
+}
+
+void stop_series_free(struct stop_series *series)
+{
+	free(series->values);
+	free(series->sorted);
+	memset(series, 0, sizeof(*series));
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void interval_mean(struct stop_series *series)
+{
+	double sd = sqrt(series->m2 / (series->n - 1));
+	double half = Z_95 * sd / sqrt(series->n);
+
+	series->estimate = series->mean;
+	series->lo = series->mean - half;
+	series->hi = series->mean + half;
+}
+
+/* distribution-free: the ranks that bracket the quantile with 95%
+ * probability; returns -1 while the upper rank is beyond the data
+ */
+static int interval_quantile(struct stop_series *series, double p)
+{
+	unsigned long n = series->n;
+	double spread = Z_95 * sqrt(n * p * (1 - p));
+	long lo = floor(n * p - spread);
+	long hi = ceil(n * p + spread);
+	double *sorted;
+
+	if (hi >= (long) n)
+		return -1;
+	if (lo < 0)
+		lo = 0;
+
+	sorted = realloc(series->sorted, sizeof(double) * series->size);
+	if (!sorted)
+		return -1;
+	series->sorted = sorted;
+	memcpy(sorted, series->values, sizeof(double) * n);
+	qsort(sorted, n, sizeof(double), cmp_double);
+
+	series->estimate = sorted[(unsigned long) (p * (n - 1))];
+	series->lo = sorted[lo];
+	series->hi = sorted[hi];
+	return 0;
+}
+
+/* the tail is stable if the second half of the series did not raise
+ * the maximum by much
+ */
+static void interval_max(struct stop_series *series)
+{
+	unsigned long i, half = series->n / 2;
+	double max = series->values[0];
+
+	for (i = 1; i < half; i++)
+		if (series->values[i] > max)
+			max = series->values[i];
+	series->estimate = series->max;
+	series->lo = max;
+	series->hi = series->max;
+}
+
+int stop_series_converged(const struct stop_rule *rule,
+			  struct stop_series *series)
+{
+	unsigned long grown = series->n - series->checked;
+	double width;
+
+	if (series->n < STOP_MIN_SAMPLES)
+		return 0;
+	/* re-check after ~6% more samples, but not after every sample */
+	if (series->checked && (grown < 16 || grown < series->checked / 16))
+		return series->converged;
+	series->checked = series->n;
+
+	switch (rule->statistic) {
+	case STOP_MEAN:
+		interval_mean(series);
+		break;
+	case STOP_P99:
+		if (interval_quantile(series, 0.99))
+			return series->converged = 0;
+		break;
+	case STOP_MAX:
+		if (series->n < 2 * STOP_MIN_SAMPLES)
+			return series->converged = 0;
+		interval_max(series);
+		break;
+	default:
+		return series->converged = 0;
+	}
+
+	series->valid = 1;
+	width = rule->width * fabs(series->estimate);
+	if (width < rule->floor)
+		width = rule->floor;
+	series->converged = series->hi - series->lo <= width;
+	return series->converged;
+}
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include "topology.h"
+#include "strata.h"
+
+static const char *class_names[NUM_CLASSES] = {
+	[CLASS_PREEMPTION] = "PREEMPTION",
+	[CLASS_L1]         = "L1",
+	[CLASS_L2]         = "L2",
+	[CLASS_L3]         = "L3",
+	[CLASS_L4]         = "L4",
+	[CLASS_MEMORY]     = "MEMORY",
+};
+
+const char *strata_class_name(int cls)
+{
+	return cls >= 0 && cls < NUM_CLASSES ? class_names[cls] : "NONE";
+}
+
+/* Classes of the pairs of all CPUs, looked up in sysfs once per process
+ * rather than on every strata_init(); NUM_CLASSES until looked up.
+ */
+static signed char *known_class;
+static int known_cpus;
+
+static int pair_class(int src, int tgt)
+{
+	signed char *known = NULL;
+	int level, cls;
+
+	if (src == tgt)
+		return CLASS_PREEMPTION;
+	if (!known_cpus) {
+		known_cpus = sysconf(_SC_NPROCESSORS_CONF);
+		if (known_cpus > 0)
+			known_class = malloc((size_t) known_cpus * known_cpus);
+		if (known_class)
+			memset(known_class, NUM_CLASSES,
+			       (size_t) known_cpus * known_cpus);
+	}
+	if (known_class && src < known_cpus && tgt < known_cpus) {
+		known = &known_class[src * known_cpus + tgt];
+		if (*known != NUM_CLASSES)
+			return *known;
+	}
+
+	level = get_shared_cache_level(src, tgt);
+	if (level < CLASS_L1 || level > CLASS_L4)
+		cls = CLASS_MEMORY;
+	else
+		cls = CLASS_L1 + level - 1;
+	if (known)
+		*known = cls;
+	return cls;
+}
+
+int strata_init(struct strata *strata, const int *cpus, int num,
+		const int *domain_of, unsigned long quota)
+{
+	int i, j, cls, cpu;
+	size_t pairs = (size_t) num * num;
+
+	memset(strata, 0, sizeof(*strata));
+	strata->num = num;
+	strata->quota = quota;
+	for (i = 0; i < num; i++)
+		if (cpus[i] > strata->max_cpu)
+			strata->max_cpu = cpus[i];
+
+	strata->cpus = malloc(sizeof(int) * num);
+	strata->index_of = malloc(sizeof(int) * (strata->max_cpu + 1));
+	strata->pair_class = malloc(pairs);
+	strata->coverage = calloc(pairs, sizeof(unsigned long));
+	strata->taken = calloc(pairs, sizeof(unsigned long));
+	if (!strata->cpus || !strata->index_of || !strata->pair_class ||
+	    !strata->coverage || !strata->taken) {
+		strata_free(strata);
+		return -1;
+	}
+
+	for (cpu = 0; cpu <= strata->max_cpu; cpu++)
+		strata->index_of[cpu] = -1;
+	memcpy(strata->cpus, cpus, sizeof(int) * num);
+	for (i = 0; i < num; i++)
+		strata->index_of[cpus[i]] = i;
+
+	for (i = 0; i < num; i++)
+		for (j = 0; j < num; j++) {
+			if (domain_of && domain_of[cpus[i]] == domain_of[cpus[j]])
+				cls = -1;
+			else
+				cls = pair_class(cpus[i], cpus[j]);
+			strata->pair_class[i * num + j] = cls;
+			if (cls >= 0)
+				strata->pairs[cls]++;
+		}
+	return 0;
+}
+
+void strata_free(struct strata *strata)
+{
+	free(strata->cpus);
+	free(strata->index_of);
+	free(strata->pair_class);
+	free(strata->coverage);
+	free(strata->taken);
+	memset(strata, 0, sizeof(*strata));
+}
+
+static int class_full(struct strata *strata, int cls)
+{
+	return strata->closed[cls] ||
+		(strata->quota && strata->samples[cls] >= strata->quota);
+}
+
+void strata_close(struct strata *strata, int cls)
+{
+	strata->closed[cls] = 1;
+}
+
+/* samples per pair that make up the quota of its class */
+static unsigned long pair_quota(struct strata *strata, int cls)
+{
+	unsigned long pairs = strata->pairs[cls];
+
+	return (strata->quota + pairs - 1) / pairs;
+}
+
+/* class with the fewest samples among those reachable from row i */
+static int pick_class(struct strata *strata, int i, int skip_full)
+{
+	int reachable[NUM_CLASSES];
+	int j, k, cls, best = -1;
+
+	memset(reachable, 0, sizeof(reachable));
+	for (j = 0; j < strata->num; j++) {
+		cls = strata->pair_class[i * strata->num + j];
+		if (cls >= 0)
+			reachable[cls] = 1;
+	}
+
+	for (k = 0; k < NUM_CLASSES; k++) {
+		cls = (strata->next_class + k) % NUM_CLASSES;
+		if (!reachable[cls] || (skip_full && class_full(strata, cls)))
+			continue;
+		if (best < 0 || strata->samples[cls] < strata->samples[best])
+			best = cls;
+	}
+	return best;
+}
+
+int strata_pick(struct strata *strata, int src)
+{
+	int i = strata->index_of[src];
+	int j, cls, best = -1, ties = 0, best_open = 0, open;
+	unsigned long quota, *taken, *coverage;
+
+	cls = pick_class(strata, i, 1);
+	if (cls < 0)
+		/* everything reachable is done; keep going regardless */
+		cls = pick_class(strata, i, 0);
+	if (cls < 0)
+		return src;
+	strata->next_class = (cls + 1) % NUM_CLASSES;
+
+	/* least covered pair, preferring those still short of their share */
+	quota = pair_quota(strata, cls);
+	taken = strata->taken + i * strata->num;
+	coverage = strata->coverage + i * strata->num;
+	for (j = 0; j < strata->num; j++) {
+		if (strata->pair_class[i * strata->num + j] != cls)
+			continue;
+		open = !strata->quota || taken[j] < quota;
+		if (best < 0 || open > best_open ||
+		    (open == best_open && coverage[j] < coverage[best])) {
+			best = j;
+			best_open = open;
+			ties = 1;
+		} else if (open == best_open && coverage[j] == coverage[best] &&
+			   random() % ++ties == 0)
+			best = j;
+	}
+	return strata->cpus[best];
+}
+
+int strata_record(struct strata *strata, int src, int tgt)
+{
+	int i = strata->index_of[src];
+	int j = strata->index_of[tgt];
+	int cls = strata->pair_class[i * strata->num + j];
+	int wanted;
+
+	if (cls < 0)
+		return 0;
+	wanted = !class_full(strata, cls);
+	strata->samples[cls]++;
+	strata->taken[i * strata->num + j]++;
+	strata->coverage[i * strata->num + j]++;
+	return wanted;
+}
+
+int strata_done(struct strata *strata)
+{
+	int cls;
+
+	for (cls = 0; cls < NUM_CLASSES; cls++)
+		if (strata->pairs[cls] && !class_full(strata, cls))
+			return 0;
+	return 1;
+}
+
+/* position of the pair (src, tgt) in our tables, or -1 */
+static long pair_index(struct strata *strata, int src, int tgt)
+{
+	if (src < 0 || tgt < 0 || src > strata->max_cpu || tgt > strata->max_cpu)
+		return -1;
+	if (strata->index_of[src] < 0 || strata->index_of[tgt] < 0)
+		return -1;
+	return (long) strata->index_of[src] * strata->num +
+		strata->index_of[tgt];
+}
+
+int strata_load(struct strata *strata, const char *fname)
+{
+	char line[128];
+	unsigned long count;
+	int src, tgt;
+	long pair;
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%d %d %*s %lu", &src, &tgt, &count) != 3)
+			continue;
+		pair = pair_index(strata, src, tgt);
+		if (pair >= 0)
+			strata->coverage[pair] += count;
+	}
+	fclose(f);
+	return 0;
+}
+
+struct coverage_entry {
+	int src;
+	int tgt;
+	char cls[16];
+	unsigned long count;
+};
+
+int strata_save(struct strata *strata, const char *fname)
+{
+	struct coverage_entry *entries = NULL, *e;
+	unsigned long *merged;
+	size_t num = 0, max = 0, k;
+	char line[128];
+	long pair;
+	int fd, i, j, err = 0;
+	FILE *f;
+
+	fd = open(fname, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -1;
+	f = fdopen(fd, "r+");
+	if (!f || flock(fd, LOCK_EX)) {
+		err = errno;
+		goto out;
+	}
+
+	merged = calloc((size_t) strata->num * strata->num,
+			sizeof(unsigned long));
+	if (!merged) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* keep the pairs of other groups, add ours to those we know */
+	while (fgets(line, sizeof(line), f)) {
+		if (num == max) {
+			max = max ? 2 * max : 256;
+			e = realloc(entries, sizeof(*entries) * max);
+			if (!e) {
+				err = ENOMEM;
+				goto out_merged;
+			}
+			entries = e;
+		}
+		e = &entries[num];
+		if (line[0] == '#' ||
+		    sscanf(line, "%d %d %15s %lu", &e->src, &e->tgt, e->cls,
+			   &e->count) != 4)
+			continue;
+		pair = pair_index(strata, e->src, e->tgt);
+		if (pair >= 0 && strata->pair_class[pair] >= 0)
+			merged[pair] += e->count;
+		else
+			num++;
+	}
+	for (pair = 0; pair < (long) strata->num * strata->num; pair++)
+		merged[pair] += strata->taken[pair];
+
+	rewind(f);
+	if (ftruncate(fd, 0)) {
+		err = errno;
+		goto out_merged;
+	}
+	fprintf(f, "# cache_cost CPU pair coverage\n");
+	fprintf(f, "# SRC TGT CLASS SAMPLES\n");
+	for (k = 0; k < num; k++)
+		fprintf(f, "%d %d %s %lu\n", entries[k].src, entries[k].tgt,
+			entries[k].cls, entries[k].count);
+	for (i = 0; i < strata->num; i++)
+		for (j = 0; j < strata->num; j++) {
+			pair = (long) i * strata->num + j;
+			if (merged[pair])
+				fprintf(f, "%d %d %s %lu\n", strata->cpus[i],
+					strata->cpus[j],
+					strata_class_name(strata->pair_class[pair]),
+					merged[pair]);
+		}
+	if (fflush(f))
+		err = errno;
+
+out_merged:
+	free(merged);
+out:
+	free(entries);
+	if (f)
+		fclose(f);	/* drops the lock */
+	else
+		close(fd);
+	errno = err;
+	return err ? -1 : 0;
+}
+
+void strata_print(FILE *out, struct strata *strata)
+{
+	int cls;
+
+	for (cls = 0; cls < NUM_CLASSES; cls++)
+		if (strata->pairs[cls])
+			fprintf(out, "# strata_%s=%d pairs, %lu samples\n",
+				class_names[cls], strata->pairs[cls],
+				strata->samples[cls]);
+}
+
+int strata_class_of(struct strata *strata, int src, int tgt)
+{
+	long pair = pair_index(strata, src, tgt);
+
+	return pair >= 0 ? strata->pair_class[pair] : -1;
+}
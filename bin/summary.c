@@ -0,0 +1,277 @@
+#define _GNU_SOURCE /* for getline() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "summary.h"
+
+static const char *series_names[NUM_SERIES] = {
+	[SERIES_COLD]      = "COLD",
+	[SERIES_HOT1]      = "HOT1",
+	[SERIES_HOT2]      = "HOT2",
+	[SERIES_HOT3]      = "HOT3",
+	[SERIES_WITH_CPMD] = "WITH-CPMD",
+	[SERIES_CPMD]      = "CPMD",
+};
+
+const char *summary_series_name(int series)
+{
+	return series_names[series];
+}
+
+int hist_bucket(uint64_t value)
+{
+	int msb, shift;
+
+	if (value < HIST_SUB)
+		return value;
+	msb = 63 - __builtin_clzll(value);
+	shift = msb - (HIST_SUB_BITS - 1);
+	return HIST_SUB + (shift - 1) * HIST_HALF +
+		(int) (value >> shift) - HIST_HALF;
+}
+
+uint64_t hist_bucket_low(int bucket)
+{
+	int shift;
+
+	if (bucket < HIST_SUB)
+		return bucket;
+	shift = (bucket - HIST_SUB) / HIST_HALF + 1;
+	return (uint64_t) ((bucket - HIST_SUB) % HIST_HALF + HIST_HALF)
+		<< shift;
+}
+
+void stat_series_add(struct stat_series *s, int64_t value)
+{
+	double delta = value - s->mean;
+
+	s->n++;
+	s->mean += delta / s->n;
+	s->m2 += delta * (value - s->mean);
+	if (s->n == 1 || value < s->min)
+		s->min = value;
+	if (s->n == 1 || value > s->max)
+		s->max = value;
+	s->hist[hist_bucket(value > 0 ? value : 0)]++;
+}
+
+void stat_series_merge(struct stat_series *into,
+		       const struct stat_series *from)
+{
+	uint64_t n = into->n + from->n;
+	double delta = from->mean - into->mean;
+	int i;
+
+	if (!from->n)
+		return;
+	if (!into->n || from->min < into->min)
+		into->min = from->min;
+	if (!into->n || from->max > into->max)
+		into->max = from->max;
+	into->m2 += from->m2 +
+		delta * delta * ((double) into->n * from->n / n);
+	into->mean += delta * from->n / n;
+	into->n = n;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		into->hist[i] += from->hist[i];
+}
+
+void summary_init(struct summary *summary, const struct summary_key *key)
+{
+	memset(summary, 0, sizeof(*summary));
+	summary->key = *key;
+}
+
+static int same_key(const struct summary_key *a, const struct summary_key *b)
+{
+	return a->wss == b->wss && a->write_cycle == b->write_cycle &&
+		a->sleep_min == b->sleep_min && a->sleep_max == b->sleep_max &&
+		!strcmp(a->pattern, b->pattern);
+}
+
+void summary_add(struct summary *summary, int cls, const uint64_t *cycles)
+{
+	struct stat_series *series = summary->series[cls];
+	uint64_t hot = cycles[PHASE_COLD];
+	int phase;
+
+	for (phase = 0; phase < NUM_PHASES; phase++)
+		stat_series_add(&series[phase], cycles[phase]);
+	/* as in build_cpmd_model.py */
+	for (phase = PHASE_HOT1; phase <= PHASE_HOT3; phase++)
+		if (cycles[phase] < hot)
+			hot = cycles[phase];
+	stat_series_add(&series[SERIES_CPMD],
+			(int64_t) cycles[PHASE_CPMD] - (int64_t) hot);
+}
+
+void summary_merge(struct summary *into, const struct summary *from)
+{
+	int cls, i;
+
+	for (cls = 0; cls < NUM_CLASSES; cls++)
+		for (i = 0; i < NUM_SERIES; i++)
+			stat_series_merge(&into->series[cls][i],
+					  &from->series[cls][i]);
+}
+
+static int class_index(const char *name)
+{
+	int cls;
+
+	for (cls = 0; cls < NUM_CLASSES; cls++)
+		if (!strcmp(name, strata_class_name(cls)))
+			return cls;
+	return -1;
+}
+
+static int series_index(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NUM_SERIES; i++)
+		if (!strcmp(name, series_names[i]))
+			return i;
+	return -1;
+}
+
+/* "WSS WCYCLE SMIN SMAX PATTERN CLASS SERIES N MIN MAX MEAN M2
+ * BUCKET:COUNT ..."
+ */
+static int parse_line(char *line, struct summary_key *key, int *cls,
+		      int *series, struct stat_series *s)
+{
+	char class_name[16], series_name[16];
+	unsigned long long n, count;
+	long long min, max;
+	int bucket, len;
+	char *pos;
+
+	memset(key, 0, sizeof(*key));
+	if (sscanf(line, "%d %d %d %d %15s %15s %15s %llu %lld %lld %lf %lf%n",
+		   &key->wss, &key->write_cycle, &key->sleep_min,
+		   &key->sleep_max, key->pattern, class_name, series_name,
+		   &n, &min, &max, &s->mean, &s->m2, &len) != 12)
+		return -1;
+	*cls = class_index(class_name);
+	*series = series_index(series_name);
+	if (*cls < 0 || *series < 0)
+		return -1;
+	s->n = n;
+	s->min = min;
+	s->max = max;
+	memset(s->hist, 0, sizeof(s->hist));
+
+	pos = line + len;
+	while (sscanf(pos, " %d:%llu%n", &bucket, &count, &len) == 2) {
+		if (bucket < 0 || bucket >= HIST_BUCKETS)
+			return -1;
+		s->hist[bucket] = count;
+		pos += len;
+	}
+	return 0;
+}
+
+int summary_load(struct summary *summary, const char *fname)
+{
+	static struct stat_series s;
+	struct summary_key key;
+	char *line = NULL;
+	size_t len = 0;
+	int cls, series, err = 0;
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : -1;
+	while (getline(&line, &len, f) > 0) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (parse_line(line, &key, &cls, &series, &s)) {
+			err = -1;
+			break;
+		}
+		if (same_key(&key, &summary->key))
+			stat_series_merge(&summary->series[cls][series], &s);
+	}
+	free(line);
+	fclose(f);
+	return err;
+}
+
+static void write_series(FILE *out, const struct summary_key *key, int cls,
+			 int series, const struct stat_series *s)
+{
+	int i;
+
+	fprintf(out, "%d %d %d %d %s %s %s %llu %lld %lld %.17g %.17g",
+		key->wss, key->write_cycle, key->sleep_min, key->sleep_max,
+		key->pattern, strata_class_name(cls), series_names[series],
+		(unsigned long long) s->n, (long long) s->min,
+		(long long) s->max, s->mean, s->m2);
+	for (i = 0; i < HIST_BUCKETS; i++)
+		if (s->hist[i])
+			fprintf(out, " %d:%llu", i,
+				(unsigned long long) s->hist[i]);
+	fprintf(out, "\n");
+}
+
+int summary_save(const struct summary *summary, const char *fname,
+		 double tsc_mhz)
+{
+	static struct stat_series s;
+	struct summary_key key;
+	char tmp[4096];
+	char *line = NULL;
+	size_t len = 0;
+	int cls, series, i, err = 0;
+	FILE *in, *out;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", fname, (int) getpid());
+	out = fopen(tmp, "w");
+	if (!out)
+		return -1;
+
+	fprintf(out, "# cache_cost summary\n");
+	fprintf(out, "# tsc_mhz=%.3f\n", tsc_mhz);
+	fprintf(out, "# hist_sub_bits=%d\n", HIST_SUB_BITS);
+	fprintf(out, "# WSS WCYCLE SMIN SMAX PATTERN CLASS SERIES "
+		"N MIN MAX MEAN M2 BUCKET:COUNT...\n");
+
+	/* keep the other configurations */
+	in = fopen(fname, "r");
+	if (in) {
+		while (getline(&line, &len, in) > 0) {
+			if (line[0] == '#' || line[0] == '\n')
+				continue;
+			if (parse_line(line, &key, &cls, &series, &s)) {
+				err = EINVAL;
+				break;
+			}
+			if (!same_key(&key, &summary->key))
+				fputs(line, out);
+		}
+		free(line);
+		fclose(in);
+	}
+
+	for (cls = 0; cls < NUM_CLASSES && !err; cls++)
+		for (i = 0; i < NUM_SERIES; i++)
+			if (summary->series[cls][i].n)
+				write_series(out, &summary->key, cls, i,
+					     &summary->series[cls][i]);
+
+	if (fclose(out) && !err)
+		err = errno;
+	else if (!err && rename(tmp, fname))
+		err = errno;
+	if (err) {
+		unlink(tmp);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "topology.h"
+
+#define CACHE_DIR "/sys/devices/system/cpu/cpu%d/cache/index%d/%s"
+/* no x86 or sparc part that we know of has more cache indices */
+#define MAX_CACHE_INDEX 16
+/* longest shared_cpu_list that we look at */
+#define CPU_LIST_MAX 4096
+
+static int read_sysfs(char *buf, size_t len, int cpu, int index,
+		      const char *attr)
+{
+	char fname[128];
+	FILE *f;
+	size_t n;
+
+	snprintf(fname, sizeof(fname), CACHE_DIR, cpu, index, attr);
+	f = fopen(fname, "r");
+	if (!f)
+		return -1;
+
+	n = fread(buf, 1, len - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+	/* strip trailing newline */
+	while (n > 0 && isspace((unsigned char) buf[n - 1]))
+		buf[--n] = '\0';
+	return 0;
+}
+
+int parse_cpu_list(const char *list, int *cpus, int max_cpus)
+{
+	const char *pos = list;
+	char *end;
+	long first, last, cpu;
+	int count = 0;
+
+	while (*pos) {
+		first = strtol(pos, &end, 10);
+		if (end == pos || first < 0)
+			return -1;
+		last = first;
+		pos = end;
+		if (*pos == '-') {
+			pos++;
+			last = strtol(pos, &end, 10);
+			if (end == pos || last < first)
+				return -1;
+			pos = end;
+		}
+		for (cpu = first; cpu <= last && count < max_cpus; cpu++)
+			cpus[count++] = cpu;
+		if (*pos == ',')
+			pos++;
+		else if (*pos && !isspace((unsigned char) *pos))
+			return -1;
+		else
+			break;
+	}
+	return count;
+}
+
+/* find the highest-level data or unified cache of cpu;
+ * returns its index or -1 if sysfs doesn't tell
+ */
+static int llc_index(int cpu)
+{
+	char buf[64];
+	int index, level, best = -1, best_level = 0;
+
+	for (index = 0; index < MAX_CACHE_INDEX; index++) {
+		if (read_sysfs(buf, sizeof(buf), cpu, index, "type"))
+			break;
+		if (!strcmp(buf, "Instruction"))
+			continue;
+		if (read_sysfs(buf, sizeof(buf), cpu, index, "level"))
+			continue;
+		level = atoi(buf);
+		if (level > best_level) {
+			best_level = level;
+			best = index;
+		}
+	}
+	return best;
+}
+
+int get_llc_domains(int num_cpus, int *domain_of)
+{
+	char buf[4096];
+	int *shared;
+	int cpu, i, n, index, num_domains = 0;
+
+	shared = malloc(sizeof(int) * num_cpus);
+	if (!shared) {
+		/* as if sysfs did not tell: one big domain */
+		for (cpu = 0; cpu < num_cpus; cpu++)
+			domain_of[cpu] = 0;
+		return 1;
+	}
+
+	for (cpu = 0; cpu < num_cpus; cpu++)
+		domain_of[cpu] = -1;
+
+	for (cpu = 0; cpu < num_cpus; cpu++) {
+		if (domain_of[cpu] != -1)
+			continue;
+
+		/* everyone sharing our LLC is in our domain */
+		domain_of[cpu] = num_domains;
+		index = llc_index(cpu);
+		if (index >= 0 &&
+		    !read_sysfs(buf, sizeof(buf), cpu, index, "shared_cpu_list")) {
+			n = parse_cpu_list(buf, shared, num_cpus);
+			for (i = 0; i < n; i++)
+				if (shared[i] < num_cpus && domain_of[shared[i]] == -1)
+					domain_of[shared[i]] = num_domains;
+		} else {
+			/* no topology information: one big domain */
+			for (i = cpu; i < num_cpus; i++)
+				domain_of[i] = num_domains;
+		}
+		num_domains++;
+	}
+
+	free(shared);
+	return num_domains;
+}
+
+int get_llc_geometry(int cpu, int *sets, int *line_size)
+{
+	char buf[64];
+	int index = llc_index(cpu);
+
+	if (index < 0)
+		return -1;
+	if (read_sysfs(buf, sizeof(buf), cpu, index, "number_of_sets"))
+		return -1;
+	*sets = atoi(buf);
+	if (read_sysfs(buf, sizeof(buf), cpu, index, "coherency_line_size"))
+		return -1;
+	*line_size = atoi(buf);
+	return *sets > 0 && *line_size > 0 ? 0 : -1;
+}
+
+int get_shared_cache_level(int cpu, int other)
+{
+	char buf[4096];
+	int shared[CPU_LIST_MAX];
+	int index, level, i, n, best = 0;
+
+	for (index = 0; index < MAX_CACHE_INDEX; index++) {
+		if (read_sysfs(buf, sizeof(buf), cpu, index, "type"))
+			break;
+		if (!strcmp(buf, "Instruction"))
+			continue;
+		if (read_sysfs(buf, sizeof(buf), cpu, index, "level"))
+			continue;
+		level = atoi(buf);
+		if (best && level >= best)
+			continue;
+		if (read_sysfs(buf, sizeof(buf), cpu, index, "shared_cpu_list"))
+			continue;
+		n = parse_cpu_list(buf, shared, CPU_LIST_MAX);
+		for (i = 0; i < n; i++)
+			if (shared[i] == other)
+				best = level;
+	}
+	return best;
+}
+
+int get_cache_sizes(int cpu, int *sizes, int max_level)
+{
+	char buf[64], *unit;
+	int index, level, highest = 0;
+	long size;
+
+	for (level = 0; level <= max_level; level++)
+		sizes[level] = 0;
+	for (index = 0; index < MAX_CACHE_INDEX; index++) {
+		if (read_sysfs(buf, sizeof(buf), cpu, index, "type"))
+			break;
+		if (!strcmp(buf, "Instruction"))
+			continue;
+		if (read_sysfs(buf, sizeof(buf), cpu, index, "level"))
+			continue;
+		level = atoi(buf);
+		if (level <= 0 || level > max_level ||
+		    read_sysfs(buf, sizeof(buf), cpu, index, "size"))
+			continue;
+		/* e.g., "32K" or "16M" */
+		size = strtol(buf, &unit, 10);
+		if (*unit == 'M')
+			size *= 1024;
+		else if (*unit == 'G')
+			size *= 1024 * 1024;
+		sizes[level] = size;
+		if (level > highest)
+			highest = level;
+	}
+	return highest;
+}
@@ -0,0 +1,386 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "touch.h"
+
+static const char *pattern_names[NUM_PATTERNS] = {
+	[PATTERN_SEQ]    = "seq",
+	[PATTERN_STRIDE] = "stride",
+	[PATTERN_RANDOM] = "random",
+	[PATTERN_CHASE]  = "chase",
+};
+
+int parse_access_pattern(const char *name, enum access_pattern *pattern)
+{
+	int i;
+
+	for (i = 0; i < NUM_PATTERNS; i++)
+		if (!strcmp(name, pattern_names[i])) {
+			*pattern = i;
+			return 0;
+		}
+	return -1;
+}
+
+const char *access_pattern_name(enum access_pattern pattern)
+{
+	return pattern_names[pattern];
+}
+
+static inline void flush_line(void *addr)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("clflush %0" : "+m" (*(char *) addr));
+#endif
+}
+
+static inline void flush_fence(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("mfence" ::: "memory");
+#endif
+}
+
+static void shuffle(unsigned int *order, size_t len)
+{
+	size_t i, j;
+	unsigned int tmp;
+
+	if (len < 2)
+		return;
+	for (i = len - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+int build_layout(struct access_layout *layout, enum access_pattern pattern,
+		 int stride, int *mem, int wss)
+{
+	size_t num_lines = (size_t) wss * 1024 / CACHE_LINE_SIZE;
+	size_t stride_lines, start, line, k;
+	unsigned int *order;
+
+	layout->pattern = pattern;
+	layout->stride = stride;
+	layout->mem = mem;
+	layout->num_lines = num_lines;
+
+	if (pattern == PATTERN_SEQ)
+		return 0;
+
+	if (layout->order_len < num_lines) {
+		order = realloc(layout->order, sizeof(unsigned int) * num_lines);
+		if (!order)
+			return -1;
+		layout->order = order;
+		layout->order_len = num_lines;
+	}
+	order = layout->order;
+
+	switch (pattern) {
+	case PATTERN_STRIDE:
+		stride_lines = stride / CACHE_LINE_SIZE;
+		if (!stride_lines)
+			stride_lines = 1;
+		k = 0;
+		for (start = 0; start < stride_lines; start++)
+			for (line = start; line < num_lines; line += stride_lines)
+				order[k++] = line;
+		break;
+
+	case PATTERN_RANDOM:
+		for (k = 0; k < num_lines; k++)
+			order[k] = k;
+		shuffle(order, num_lines);
+		break;
+
+	case PATTERN_CHASE:
+		/* ring through all lines, starting (and ending) at line 0 */
+		for (k = 0; k < num_lines; k++)
+			order[k] = k;
+		shuffle(order + 1, num_lines - 1);
+		for (k = 0; k < num_lines; k++)
+			mem[order[k] * INTS_PER_LINE + CHASE_LINK] =
+				order[(k + 1) % num_lines];
+		/* building the ring must not warm up the cache */
+		for (k = 0; k < num_lines; k++)
+			flush_line(mem + k * INTS_PER_LINE);
+		flush_fence();
+		break;
+
+	default:
+		break;
+	}
+	return 0;
+}
+
+void free_layout(struct access_layout *layout)
+{
+	free(layout->order);
+	layout->order = NULL;
+	layout->order_len = 0;
+}
+
+/* Generic kernels: any write cycle, starting anywhere in the traversal.
+ * The n-th int touched is a write iff n % write_cycle == write_cycle - 1.
+ */
+static int touch_seq_any(volatile int *mem, size_t from, size_t num_ints,
+			 int write_cycle)
+{
+	int sum = 0;
+	size_t i;
+
+	if (write_cycle > 0) {
+		for (i = from; i < num_ints; i++) {
+			if (i % write_cycle == (write_cycle - 1))
+				mem[i]++;
+			else
+				sum += mem[i];
+		}
+	} else {
+		/* sequential access, pure read */
+		for (i = from; i < num_ints; i++)
+			sum += mem[i];
+	}
+	return sum;
+}
+
+static int touch_ordered_any(struct access_layout *layout, size_t from,
+			     int write_cycle)
+{
+	volatile int *line;
+	int sum = 0;
+	size_t k, j, i = from * INTS_PER_LINE;
+
+	for (k = from; k < layout->num_lines; k++) {
+		line = layout->mem + layout->order[k] * INTS_PER_LINE;
+		for (j = 0; j < INTS_PER_LINE; j++, i++) {
+			if (write_cycle > 0 && i % write_cycle == (write_cycle - 1))
+				line[j]++;
+			else
+				sum += line[j];
+		}
+	}
+	return sum;
+}
+
+static int touch_chase_any(struct access_layout *layout, volatile int *line,
+			   size_t from, int write_cycle)
+{
+	int sum = 0;
+	unsigned int next;
+	size_t k, j, i = from * INTS_PER_LINE;
+
+	for (k = from; k < layout->num_lines; k++) {
+		next = line[CHASE_LINK];
+		for (j = 0; j < INTS_PER_LINE; j++, i++) {
+			if (j == CHASE_LINK)
+				continue;
+			if (write_cycle > 0 && i % write_cycle == (write_cycle - 1))
+				line[j]++;
+			else
+				sum += line[j];
+		}
+		line = layout->mem + next * INTS_PER_LINE;
+	}
+	return sum;
+}
+
+static int touch_seq_generic(struct access_layout *layout, int write_cycle)
+{
+	return touch_seq_any(layout->mem, 0,
+			     layout->num_lines * INTS_PER_LINE, write_cycle);
+}
+
+static int touch_ordered_generic(struct access_layout *layout, int write_cycle)
+{
+	return touch_ordered_any(layout, 0, write_cycle);
+}
+
+static int touch_chase_generic(struct access_layout *layout, int write_cycle)
+{
+	return touch_chase_any(layout, layout->mem, 0, write_cycle);
+}
+
+/* Specialized kernels.
+ *
+ * For a write cycle WC, the read/write mix repeats every GL(WC) =
+ * WC / gcd(WC, 16) cache lines. Each kernel touches groups of GL lines
+ * with every int access unrolled and the read/write decision resolved
+ * at compile time, so the timed loop contains no divisions. Accesses go
+ * through volatile pointers so that none of them can be elided. The
+ * remaining lines (if any) are handled by the generic code above.
+ */
+
+/* n: position of the int within the group */
+#define IS_WRITE(n, wc)	((wc) > 0 && (n) % (wc) == (wc) - 1)
+#define TOUCH_INT(p, n, wc, link, sum)					\
+	do {								\
+		if ((link) && (n) % INTS_PER_LINE == CHASE_LINK)	\
+			; /* ring link, never written */		\
+		else if (IS_WRITE(n, wc))				\
+			(p)[(n) % INTS_PER_LINE]++;			\
+		else							\
+			sum += (p)[(n) % INTS_PER_LINE];		\
+	} while (0)
+
+#define TOUCH_LINE(p, base, wc, link, sum)				\
+	do {								\
+		TOUCH_INT(p, (base) +  0, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  1, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  2, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  3, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  4, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  5, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  6, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  7, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  8, wc, link, sum);		\
+		TOUCH_INT(p, (base) +  9, wc, link, sum);		\
+		TOUCH_INT(p, (base) + 10, wc, link, sum);		\
+		TOUCH_INT(p, (base) + 11, wc, link, sum);		\
+		TOUCH_INT(p, (base) + 12, wc, link, sum);		\
+		TOUCH_INT(p, (base) + 13, wc, link, sum);		\
+		TOUCH_INT(p, (base) + 14, wc, link, sum);		\
+		TOUCH_INT(p, (base) + 15, wc, link, sum);		\
+	} while (0)
+
+/* STEP(g, base) touches the g-th line of a group */
+#define GROUP_1(STEP) STEP(0,   0)
+#define GROUP_3(STEP) STEP(0,   0) STEP(1,  16) STEP(2,  32)
+#define GROUP_5(STEP) GROUP_3(STEP) STEP(3,  48) STEP(4,  64)
+#define GROUP_7(STEP) GROUP_5(STEP) STEP(5,  80) STEP(6,  96)
+
+#define SEQ_STEP(g, base)   TOUCH_LINE(p + (base), base, WC, 0, sum);
+#define ORDER_STEP(g, base)						\
+	TOUCH_LINE(mem + order[k + (g)] * INTS_PER_LINE, base, WC, 0, sum);
+#define CHASE_STEP(g, base)						\
+	next = p[CHASE_LINK];						\
+	TOUCH_LINE(p, base, WC, 1, sum);				\
+	p = mem + next * INTS_PER_LINE;
+
+#define DEFINE_KERNELS(wc, gl)						\
+static int touch_seq_w##wc(struct access_layout *layout, int write_cycle) \
+{									\
+	enum { WC = wc };						\
+	volatile int *p = layout->mem;					\
+	size_t k, groups = layout->num_lines / gl;			\
+	int sum = 0;							\
+									\
+	for (k = 0; k < groups; k++) {					\
+		GROUP_##gl(SEQ_STEP)					\
+		p += gl * INTS_PER_LINE;				\
+	}								\
+	return sum + touch_seq_any(layout->mem,				\
+				   groups * gl * INTS_PER_LINE,		\
+				   layout->num_lines * INTS_PER_LINE, wc); \
+}									\
+									\
+static int touch_ordered_w##wc(struct access_layout *layout, int write_cycle) \
+{									\
+	enum { WC = wc };						\
+	volatile int *mem = layout->mem;				\
+	const unsigned int *order = layout->order;			\
+	size_t k, end = layout->num_lines - layout->num_lines % gl;	\
+	int sum = 0;							\
+									\
+	for (k = 0; k < end; k += gl) {					\
+		GROUP_##gl(ORDER_STEP)					\
+	}								\
+	return sum + touch_ordered_any(layout, end, wc);		\
+}									\
+									\
+static int touch_chase_w##wc(struct access_layout *layout, int write_cycle) \
+{									\
+	enum { WC = wc };						\
+	volatile int *mem = layout->mem, *p = mem;			\
+	size_t k, groups = layout->num_lines / gl;			\
+	unsigned int next;						\
+	int sum = 0;							\
+									\
+	for (k = 0; k < groups; k++) {					\
+		GROUP_##gl(CHASE_STEP)					\
+	}								\
+	return sum + touch_chase_any(layout, p, groups * gl, wc);	\
+}
+
+/* write cycle, lines per group */
+DEFINE_KERNELS(0, 1)
+DEFINE_KERNELS(1, 1)
+DEFINE_KERNELS(2, 1)
+DEFINE_KERNELS(3, 3)
+DEFINE_KERNELS(4, 1)
+DEFINE_KERNELS(5, 5)
+DEFINE_KERNELS(6, 3)
+DEFINE_KERNELS(7, 7)
+DEFINE_KERNELS(8, 1)
+
+#define KERNELS(wc) { \
+	[PATTERN_SEQ]    = touch_seq_w##wc,	\
+	[PATTERN_STRIDE] = touch_ordered_w##wc,	\
+	[PATTERN_RANDOM] = touch_ordered_w##wc,	\
+	[PATTERN_CHASE]  = touch_chase_w##wc,	\
+}
+
+static const touch_kernel_t kernels[MAX_KERNEL_WCYCLE + 1][NUM_PATTERNS] = {
+	KERNELS(0), KERNELS(1), KERNELS(2), KERNELS(3), KERNELS(4),
+	KERNELS(5), KERNELS(6), KERNELS(7), KERNELS(8),
+};
+
+static const touch_kernel_t generic_kernels[NUM_PATTERNS] = {
+	[PATTERN_SEQ]    = touch_seq_generic,
+	[PATTERN_STRIDE] = touch_ordered_generic,
+	[PATTERN_RANDOM] = touch_ordered_generic,
+	[PATTERN_CHASE]  = touch_chase_generic,
+};
+
+touch_kernel_t select_touch_kernel(enum access_pattern pattern,
+				   int write_cycle)
+{
+	if (write_cycle >= 0 && write_cycle <= MAX_KERNEL_WCYCLE)
+		return kernels[write_cycle][pattern];
+	return generic_kernels[pattern];
+}
+
+int touch_layout(struct access_layout *layout, int write_cycle)
+{
+	return select_touch_kernel(layout->pattern, write_cycle)(layout,
+								 write_cycle);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#include "x86-cycles.h"
+
+/* footprint of the self-check; should fit into any L1 */
+#define SELF_CHECK_KB 8
+#define SELF_CHECK_ROUNDS 100
+
+double kernel_cycles_per_line(touch_kernel_t kernel,
+			      enum access_pattern pattern, int write_cycle)
+{
+	static int buf[SELF_CHECK_KB * 1024 / sizeof(int)]
+		__attribute__ ((aligned(CACHE_LINE_SIZE)));
+	struct access_layout layout;
+	cycles_t start, stop, best = ~0ULL;
+	int i;
+
+	memset(&layout, 0, sizeof(layout));
+	if (build_layout(&layout, pattern, 2 * CACHE_LINE_SIZE, buf,
+			 SELF_CHECK_KB))
+		return -1.0;
+
+	/* warm up */
+	buf[0] += kernel(&layout, write_cycle);
+	for (i = 0; i < SELF_CHECK_ROUNDS; i++) {
+		start = get_cycles();
+		buf[0] += kernel(&layout, write_cycle);
+		stop = get_cycles();
+		if (stop - start < best)
+			best = stop - start;
+	}
+	free_layout(&layout);
+	return (double) best / layout.num_lines;
+}
+#endif
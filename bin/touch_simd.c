@@ -0,0 +1,240 @@
+/*
+ * Vector-width touch kernels, selected at runtime according to cpuid.
+ *
+ * Vector kernels move whole vectors: every write_cycle-th vector is
+ * incremented (read-modify-write), all others are read and accumulated.
+ * With non-temporal stores, the written vectors are streamed to memory
+ * without being read first.
+ */
+#include <string.h>
+
+#include "touch.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+
+#define DEFINE_SIMD_KERNELS(isa, isa_target, vec_t, load, store, stream,	\
+			    add, set1, zero, reduce)			\
+									\
+__attribute__ ((target(isa_target)))					\
+static int reduce_##isa(vec_t acc)					\
+{									\
+	reduce;								\
+}									\
+									\
+__attribute__ ((target(isa_target)))					\
+static int touch_seq_##isa(struct access_layout *layout,		\
+			   int write_cycle)				\
+{									\
+	vec_t *p = (vec_t *) layout->mem;				\
+	size_t i, n = layout->num_lines * CACHE_LINE_SIZE / sizeof(vec_t); \
+	vec_t acc = zero, one = set1(1);				\
+	int countdown = write_cycle;					\
+									\
+	for (i = 0; i < n; i++) {					\
+		if (write_cycle > 0 && --countdown == 0) {		\
+			countdown = write_cycle;			\
+			store(p + i, add(load(p + i), one));		\
+		} else							\
+			acc = add(acc, load(p + i));			\
+	}								\
+	return reduce_##isa(acc);					\
+}									\
+									\
+__attribute__ ((target(isa_target)))					\
+static int touch_seq_nt_##isa(struct access_layout *layout,		\
+			      int write_cycle)				\
+{									\
+	vec_t *p = (vec_t *) layout->mem;				\
+	size_t i, n = layout->num_lines * CACHE_LINE_SIZE / sizeof(vec_t); \
+	vec_t acc = zero, one = set1(1);				\
+	int countdown = write_cycle;					\
+									\
+	for (i = 0; i < n; i++) {					\
+		if (write_cycle > 0 && --countdown == 0) {		\
+			countdown = write_cycle;			\
+			stream(p + i, one);				\
+		} else							\
+			acc = add(acc, load(p + i));			\
+	}								\
+	_mm_sfence();							\
+	return reduce_##isa(acc);					\
+}									\
+									\
+__attribute__ ((target(isa_target)))					\
+static int touch_ordered_##isa(struct access_layout *layout,		\
+			       int write_cycle)				\
+{									\
+	const size_t per_line = CACHE_LINE_SIZE / sizeof(vec_t);	\
+	vec_t *p;							\
+	size_t k, j;							\
+	vec_t acc = zero, one = set1(1);				\
+	int countdown = write_cycle;					\
+									\
+	for (k = 0; k < layout->num_lines; k++) {			\
+		p = (vec_t *) (layout->mem +				\
+			       layout->order[k] * INTS_PER_LINE);	\
+		for (j = 0; j < per_line; j++) {			\
+			if (write_cycle > 0 && --countdown == 0) {	\
+				countdown = write_cycle;		\
+				store(p + j, add(load(p + j), one));	\
+			} else						\
+				acc = add(acc, load(p + j));		\
+		}							\
+	}								\
+	return reduce_##isa(acc);					\
+}									\
+									\
+__attribute__ ((target(isa_target)))					\
+static int touch_ordered_nt_##isa(struct access_layout *layout,	\
+				  int write_cycle)			\
+{									\
+	const size_t per_line = CACHE_LINE_SIZE / sizeof(vec_t);	\
+	vec_t *p;							\
+	size_t k, j;							\
+	vec_t acc = zero, one = set1(1);				\
+	int countdown = write_cycle;					\
+									\
+	for (k = 0; k < layout->num_lines; k++) {			\
+		p = (vec_t *) (layout->mem +				\
+			       layout->order[k] * INTS_PER_LINE);	\
+		for (j = 0; j < per_line; j++) {			\
+			if (write_cycle > 0 && --countdown == 0) {	\
+				countdown = write_cycle;		\
+				stream(p + j, one);			\
+			} else						\
+				acc = add(acc, load(p + j));		\
+		}							\
+	}								\
+	_mm_sfence();							\
+	return reduce_##isa(acc);					\
+}
+
+DEFINE_SIMD_KERNELS(sse2, "sse2", __m128i,
+		    _mm_load_si128, _mm_store_si128, _mm_stream_si128,
+		    _mm_add_epi32, _mm_set1_epi32, _mm_setzero_si128(),
+		    int v[4] __attribute__ ((aligned(16)));
+		    _mm_store_si128((__m128i *) v, acc);
+		    return v[0] + v[1] + v[2] + v[3])
+
+DEFINE_SIMD_KERNELS(avx2, "avx2", __m256i,
+		    _mm256_load_si256, _mm256_store_si256, _mm256_stream_si256,
+		    _mm256_add_epi32, _mm256_set1_epi32, _mm256_setzero_si256(),
+		    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+					      _mm256_extracti128_si256(acc, 1));
+		    int v[4] __attribute__ ((aligned(16)));
+		    _mm_store_si128((__m128i *) v, s);
+		    return v[0] + v[1] + v[2] + v[3])
+
+/* the AVX-512 load/store intrinsics take void pointers */
+#define avx512_load(p)		_mm512_load_si512((void *) (p))
+#define avx512_store(p, v)	_mm512_store_si512((void *) (p), v)
+#define avx512_stream(p, v)	_mm512_stream_si512((void *) (p), v)
+
+DEFINE_SIMD_KERNELS(avx512, "avx512f", __m512i,
+		    avx512_load, avx512_store, avx512_stream,
+		    _mm512_add_epi32, _mm512_set1_epi32, _mm512_setzero_si512(),
+		    return _mm512_reduce_add_epi32(acc))
+
+/* [isa][nontemporal] */
+static const touch_kernel_t seq_kernels[NUM_ISAS][2] = {
+	[ISA_SSE2]   = { touch_seq_sse2,   touch_seq_nt_sse2 },
+	[ISA_AVX2]   = { touch_seq_avx2,   touch_seq_nt_avx2 },
+	[ISA_AVX512] = { touch_seq_avx512, touch_seq_nt_avx512 },
+};
+
+static const touch_kernel_t ordered_kernels[NUM_ISAS][2] = {
+	[ISA_SSE2]   = { touch_ordered_sse2,   touch_ordered_nt_sse2 },
+	[ISA_AVX2]   = { touch_ordered_avx2,   touch_ordered_nt_avx2 },
+	[ISA_AVX512] = { touch_ordered_avx512, touch_ordered_nt_avx512 },
+};
+
+int touch_isa_supported(enum touch_isa isa)
+{
+	__builtin_cpu_init();
+	switch (isa) {
+	case ISA_SCALAR:
+		return 1;
+	case ISA_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case ISA_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case ISA_AVX512:
+		return __builtin_cpu_supports("avx512f");
+	default:
+		return 0;
+	}
+}
+
+touch_kernel_t select_simd_kernel(enum touch_isa isa,
+				  enum access_pattern pattern,
+				  int nontemporal)
+{
+	if (isa == ISA_SCALAR || isa >= NUM_ISAS || !touch_isa_supported(isa))
+		return NULL;
+
+	switch (pattern) {
+	case PATTERN_SEQ:
+		return seq_kernels[isa][!!nontemporal];
+	case PATTERN_STRIDE:
+	case PATTERN_RANDOM:
+		return ordered_kernels[isa][!!nontemporal];
+	default:
+		/* pointer chasing is inherently scalar */
+		return NULL;
+	}
+}
+
+#else
+
+int touch_isa_supported(enum touch_isa isa)
+{
+	return isa == ISA_SCALAR;
+}
+
+touch_kernel_t select_simd_kernel(enum touch_isa isa,
+				  enum access_pattern pattern,
+				  int nontemporal)
+{
+	return NULL;
+}
+
+#endif
+
+static const char *isa_names[NUM_ISAS] = {
+	[ISA_SCALAR] = "scalar",
+	[ISA_SSE2]   = "sse2",
+	[ISA_AVX2]   = "avx2",
+	[ISA_AVX512] = "avx512",
+};
+
+const char *touch_isa_name(enum touch_isa isa)
+{
+	return isa_names[isa];
+}
+
+enum touch_isa best_touch_isa(void)
+{
+	int isa;
+
+	for (isa = NUM_ISAS - 1; isa > ISA_SCALAR; isa--)
+		if (touch_isa_supported(isa))
+			return isa;
+	return ISA_SCALAR;
+}
+
+int parse_touch_isa(const char *name, enum touch_isa *isa)
+{
+	int i;
+
+	if (!strcmp(name, "auto")) {
+		*isa = best_touch_isa();
+		return 0;
+	}
+	for (i = 0; i < NUM_ISAS; i++)
+		if (!strcmp(name, isa_names[i])) {
+			*isa = i;
+			return 0;
+		}
+	return -1;
+}
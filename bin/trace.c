@@ -0,0 +1,450 @@
+#define _GNU_SOURCE /* for pthread_attr_setaffinity_np */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "numa.h"
+#include "pagemap.h"
+#include "trace.h"
+
+#define FIELD(name, type, member, width) \
+	{ name, type, offsetof(struct trace_record, member), width, 0 }
+
+/* columns of the CSV trace, in order */
+static const struct trace_field record_fields[] = {
+	FIELD("COUNT",     FIELD_U64, count,         6),
+	FIELD("WCYCLE",    FIELD_I32, write_cycle,   6),
+	FIELD("WSS",       FIELD_I32, wss,           6),
+	FIELD("DELAY",     FIELD_I32, delay,         6),
+	FIELD("SRC",       FIELD_I32, src,           3),
+	FIELD("TGT",       FIELD_I32, tgt,           3),
+	FIELD("COLD",      FIELD_U64, cold,         10),
+	FIELD("HOT1",      FIELD_U64, hot1,         10),
+	FIELD("HOT2",      FIELD_U64, hot2,         10),
+	FIELD("HOT3",      FIELD_U64, hot3,         10),
+	FIELD("WITH-CPMD", FIELD_U64, after_resume, 10),
+	FIELD("NODE",      FIELD_I32, node,          4),
+	FIELD("NUMA",      FIELD_I32, numa,          4),
+	FIELD("MOVED",     FIELD_I32, numa_moved,    6),
+	FIELD("VIRT ADDR", FIELD_U64, virt_addr,    12),
+};
+
+#define NUM_RECORD_FIELDS (sizeof(record_fields) / sizeof(record_fields[0]))
+#define PHYS_ADDR_WIDTH 12
+#define COUNTER_WIDTH 10
+/* pages of a working set whose node is looked up, evenly spaced */
+#define NODE_SAMPLES 16
+
+static const char *phase_names[NUM_PHASES] = {
+	[PHASE_COLD] = "COLD",
+	[PHASE_HOT1] = "HOT1",
+	[PHASE_HOT2] = "HOT2",
+	[PHASE_HOT3] = "HOT3",
+	[PHASE_CPMD] = "CPMD",
+};
+
+int trace_init(struct trace *trace, FILE *file, enum trace_format format,
+	       unsigned long num_pages)
+{
+	trace->file = file;
+	trace->format = format;
+	trace->num_pages = num_pages;
+	trace->fields = malloc(sizeof(record_fields));
+	trace->num_fields = NUM_RECORD_FIELDS;
+	trace->tsc_khz = 0;
+	trace->pagemap = NULL;
+	trace->numa_node = -1;
+	trace->num_nodes = numa_num_nodes();
+	trace->phys_addrs = malloc(sizeof(unsigned long) * num_pages);
+	trace->phys_buf = malloc(sizeof(uint64_t) * num_pages);
+	trace->pages = malloc(sizeof(void *) * NODE_SAMPLES);
+	trace->nodes = malloc(sizeof(int) * NODE_SAMPLES);
+	if (!trace->fields || !trace->phys_addrs || !trace->phys_buf ||
+	    !trace->pages || !trace->nodes) {
+		trace_free(trace);
+		return -1;
+	}
+	memcpy(trace->fields, record_fields, sizeof(record_fields));
+	return 0;
+}
+
+int trace_add_field(struct trace *trace, const char *name,
+		    enum trace_field_type type, size_t offset, int width)
+{
+	struct trace_field *fields, *f;
+
+	fields = realloc(trace->fields, sizeof(struct trace_field) *
+			 (trace->num_fields + 1));
+	if (!fields)
+		return -1;
+	trace->fields = fields;
+
+	f = &fields[trace->num_fields++];
+	memset(f, 0, sizeof(*f));
+	snprintf(f->name, sizeof(f->name), "%s", name);
+	f->type = type;
+	f->offset = offset;
+	f->width = width;
+	return 0;
+}
+
+int trace_add_counters(struct trace *trace, const char *const *names)
+{
+	char name[sizeof(((struct trace_field *) 0)->name)];
+	int phase, slot;
+
+	/* e.g., COLD:LLC */
+	for (phase = 0; phase < NUM_PHASES; phase++)
+		for (slot = 0; slot < NUM_PERF_SLOTS; slot++) {
+			snprintf(name, sizeof(name), "%s:%s",
+				 phase_names[phase], names[slot]);
+			if (trace_add_field(trace, name, FIELD_U64,
+					    offsetof(struct trace_record,
+						     perf[phase][slot]),
+					    COUNTER_WIDTH))
+				return -1;
+		}
+	return 0;
+}
+
+void trace_free(struct trace *trace)
+{
+	free(trace->fields);
+	free(trace->phys_addrs);
+	free(trace->phys_buf);
+	free(trace->pages);
+	free(trace->nodes);
+	trace->fields = NULL;
+	trace->phys_addrs = NULL;
+	trace->phys_buf = NULL;
+	trace->pages = NULL;
+	trace->nodes = NULL;
+}
+
+void trace_resolve_nodes(struct trace *trace, struct trace_record *rec)
+{
+	unsigned long i, num, pagesize = getpagesize();
+	int counts[64];
+	int node, best = -1;
+
+	/* nothing to ask move_pages() */
+	if (trace->num_nodes == 1 && trace->numa_node < 0) {
+		rec->node = 0;
+		return;
+	}
+	rec->node = -1;
+
+	num = trace->num_pages < NODE_SAMPLES ? trace->num_pages :
+		NODE_SAMPLES;
+	for (i = 0; i < num; i++)
+		trace->pages[i] = (void *) (unsigned long)
+			(rec->virt_addr + i * trace->num_pages / num *
+			 pagesize);
+	if (numa_page_nodes(trace->pages, num, trace->nodes))
+		return;
+
+	/* majority vote among the first 64 nodes */
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < num; i++) {
+		node = trace->nodes[i];
+		if (node >= 0 && node < 64)
+			counts[node]++;
+		if (trace->numa_node >= 0 && node != trace->numa_node)
+			rec->numa |= NUMA_MISPLACED;
+	}
+	for (node = 0; node < 64; node++)
+		if (counts[node] && (best < 0 || counts[node] > counts[best]))
+			best = node;
+	rec->node = best;
+}
+
+int trace_write_header(struct trace *trace, const char *meta)
+{
+	struct trace_header hdr;
+	size_t meta_len = meta ? strlen(meta) : 0;
+	size_t table_size;
+
+	if (trace->format == TRACE_CSV) {
+		if (meta)
+			fputs(meta, trace->file);
+		trace_print_columns(trace->file, trace->fields,
+				    trace->num_fields);
+		return ferror(trace->file) ? -1 : 0;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	strncpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	table_size = sizeof(struct trace_field) * trace->num_fields;
+	hdr.header_size = sizeof(hdr) + table_size + meta_len;
+	hdr.record_size = sizeof(struct trace_record);
+	hdr.num_fields = trace->num_fields;
+	hdr.num_pages = trace->num_pages;
+	hdr.page_size = getpagesize();
+	hdr.meta_len = meta_len;
+	hdr.tsc_khz = trace->tsc_khz;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, trace->file) != 1 ||
+	    fwrite(trace->fields, table_size, 1, trace->file) != 1 ||
+	    (meta_len && fwrite(meta, meta_len, 1, trace->file) != 1))
+		return -1;
+	return 0;
+}
+
+int trace_write(struct trace *trace, const struct trace_record *rec,
+		const uint64_t *phys)
+{
+	unsigned long i, pagesize;
+
+	if (!phys) {
+		pagesize = getpagesize();
+		memset(trace->phys_addrs, 0,
+		       sizeof(unsigned long) * trace->num_pages);
+		if (trace->pagemap)
+			pagemap_resolve(trace->pagemap, rec->virt_addr,
+					rec->virt_addr +
+					trace->num_pages * pagesize,
+					trace->phys_addrs, NULL,
+					trace->num_pages);
+		else
+			get_phys_addrs(0, rec->virt_addr,
+				       rec->virt_addr + trace->num_pages * pagesize,
+				       trace->phys_addrs, trace->num_pages);
+		for (i = 0; i < trace->num_pages; i++)
+			trace->phys_buf[i] = trace->phys_addrs[i];
+		phys = trace->phys_buf;
+	}
+
+	if (trace->format == TRACE_CSV) {
+		trace_print_csv(trace->file, trace->fields, trace->num_fields,
+				rec, phys, trace->num_pages);
+		return ferror(trace->file) ? -1 : 0;
+	}
+
+	if (fwrite(rec, sizeof(*rec), 1, trace->file) != 1 ||
+	    fwrite(phys, sizeof(uint64_t), trace->num_pages,
+		   trace->file) != trace->num_pages)
+		return -1;
+	return 0;
+}
+
+int trace_read_header(FILE *file, struct trace_header *hdr,
+		      struct trace_field **fields, char **meta)
+{
+	size_t table_size;
+	uint32_t i;
+
+	*fields = NULL;
+	*meta = NULL;
+
+	if (fread(hdr, sizeof(*hdr), 1, file) != 1)
+		goto invalid;
+	if (strncmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != TRACE_VERSION)
+		goto invalid;
+
+	table_size = sizeof(struct trace_field) * hdr->num_fields;
+	if (hdr->header_size != sizeof(*hdr) + table_size + hdr->meta_len)
+		goto invalid;
+
+	*fields = malloc(table_size);
+	*meta = malloc(hdr->meta_len + 1);
+	if (!*fields || !*meta)
+		goto fail;
+	if (fread(*fields, table_size, 1, file) != 1)
+		goto invalid;
+	if (hdr->meta_len && fread(*meta, hdr->meta_len, 1, file) != 1)
+		goto invalid;
+	(*meta)[hdr->meta_len] = '\0';
+
+	for (i = 0; i < hdr->num_fields; i++) {
+		(*fields)[i].name[sizeof((*fields)[i].name) - 1] = '\0';
+		if ((*fields)[i].type > FIELD_U64 ||
+		    (*fields)[i].offset + ((*fields)[i].type == FIELD_I32 ?
+					   sizeof(int32_t) : sizeof(uint64_t))
+		    > hdr->record_size)
+			goto invalid;
+	}
+	return 0;
+
+invalid:
+	errno = EINVAL;
+fail:
+	free(*fields);
+	free(*meta);
+	*fields = NULL;
+	*meta = NULL;
+	return -1;
+}
+
+int trace_read(FILE *file, size_t record_size, unsigned long num_pages,
+	       void *rec, uint64_t *phys)
+{
+	if (fread(rec, record_size, 1, file) != 1)
+		return ferror(file) ? -1 : 0;
+	if (fread(phys, sizeof(uint64_t), num_pages, file) != num_pages)
+		return -1;
+	return 1;
+}
+
+void trace_print_columns(FILE *out, const struct trace_field *fields,
+			 int num_fields)
+{
+	int i;
+
+	/* '#' takes the place of the first column's padding */
+	fprintf(out, "#");
+	for (i = 0; i < num_fields; i++)
+		fprintf(out, "%s%*s", i ? ", " : " ",
+			(int) fields[i].width - (i ? 0 : 1), fields[i].name);
+	fprintf(out, ", %*s\n", PHYS_ADDR_WIDTH, "PHYS ADDR");
+}
+
+void trace_print_csv(FILE *out, const struct trace_field *fields,
+		     int num_fields, const void *rec,
+		     const uint64_t *phys, unsigned long num_pages)
+{
+	const char *base = rec;
+	int32_t i32;
+	uint64_t u64;
+	unsigned long i;
+	int f;
+
+	for (f = 0; f < num_fields; f++) {
+		fputs(f ? ", " : " ", out);
+		if (fields[f].type == FIELD_I32) {
+			memcpy(&i32, base + fields[f].offset, sizeof(i32));
+			fprintf(out, "%*" PRId32, (int) fields[f].width, i32);
+		} else {
+			memcpy(&u64, base + fields[f].offset, sizeof(u64));
+			fprintf(out, "%*" PRIu64, (int) fields[f].width, u64);
+		}
+	}
+	for (i = 0; i < num_pages; i++)
+		fprintf(out, ", %*" PRIu64, PHYS_ADDR_WIDTH, phys[i]);
+	fprintf(out, "\n");
+}
+
+static void nap(long nanoseconds)
+{
+	struct timespec delay;
+
+	delay.tv_sec = 0;
+	delay.tv_nsec = nanoseconds;
+	nanosleep(&delay, NULL);
+}
+
+/* the writer thread sleeps this long when the ring is empty */
+#define WRITER_IDLE_NS 1000000
+/* the producer sleeps this long when the ring is full */
+#define PRODUCER_STALL_NS 100000
+
+static void* writer_thread(void *arg)
+{
+	struct trace_writer *writer = arg;
+	struct trace_record *rec;
+	unsigned long head, tail = writer->tail;
+	sigset_t all;
+	int stop;
+
+	/* signals are for the measuring thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	for (;;) {
+		/* read stop before head: nothing is committed after stop */
+		stop = __atomic_load_n(&writer->stop, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&writer->head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (stop)
+				break;
+			nap(WRITER_IDLE_NS);
+			continue;
+		}
+		while (tail != head) {
+			rec = &writer->ring[tail & (writer->size - 1)];
+			if (trace_write(writer->trace, rec, NULL) &&
+			    !writer->error)
+				writer->error = errno ? errno : EIO;
+			tail++;
+			__atomic_store_n(&writer->tail, tail, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+int trace_writer_start(struct trace_writer *writer, struct trace *trace,
+		       unsigned long size, int cpu)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	cpu_set_t cpus;
+	int err;
+
+	/* round up to a power of two */
+	writer->size = 1;
+	while (writer->size < size)
+		writer->size <<= 1;
+
+	writer->trace = trace;
+	writer->head = 0;
+	writer->tail = 0;
+	writer->stalls = 0;
+	writer->error = 0;
+	writer->stop = 0;
+	writer->ring = calloc(writer->size, sizeof(struct trace_record));
+	if (!writer->ring)
+		return ENOMEM;
+
+	/* don't inherit the SCHED_FIFO priority of the measuring thread */
+	pthread_attr_init(&attr);
+	param.sched_priority = 0;
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+	if (cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	err = pthread_create(&writer->thread, &attr, writer_thread, writer);
+	pthread_attr_destroy(&attr);
+	if (err) {
+		free(writer->ring);
+		writer->ring = NULL;
+	}
+	return err;
+}
+
+struct trace_record *trace_writer_reserve(struct trace_writer *writer)
+{
+	while (writer->head -
+	       __atomic_load_n(&writer->tail, __ATOMIC_ACQUIRE) >= writer->size) {
+		writer->stalls++;
+		nap(PRODUCER_STALL_NS);
+	}
+	return &writer->ring[writer->head & (writer->size - 1)];
+}
+
+void trace_writer_commit(struct trace_writer *writer)
+{
+	__atomic_store_n(&writer->head, writer->head + 1, __ATOMIC_RELEASE);
+}
+
+int trace_writer_stop(struct trace_writer *writer)
+{
+	__atomic_store_n(&writer->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(writer->thread, NULL);
+	free(writer->ring);
+	writer->ring = NULL;
+	return writer->error;
+}
@@ -0,0 +1,90 @@
+/* Convert a binary cache_cost trace (cache_cost -B) to the CSV format
+ * written by cache_cost without -B.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static void die(char *error)
+{
+	fprintf(stderr, "Error: %s (errno: %m)\n",
+		error);
+	exit(1);
+}
+
+static void usage(char *error) {
+	if (error)
+		fprintf(stderr, "Error: %s\n", error);
+	fprintf(stderr,
+"Usage: trace2csv [-o FILENAME] [-h] TRACE\n"
+"Options:\n"
+"       -o: Name of output file (default: standard output).\n"
+"       -h: Show this message.\n");
+	exit(1);
+}
+
+#define OPTSTR "o:h"
+
+int main(int argc, char** argv)
+{
+	FILE *in, *out = stdout;
+	struct trace_header hdr;
+	struct trace_field *fields;
+	char *meta;
+	void *rec;
+	uint64_t *phys;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, OPTSTR)) != -1) {
+		switch (opt) {
+		case 'o':
+			out = fopen(optarg, "w");
+			if (out == NULL)
+				usage("could not open file");
+			break;
+		case 'h':
+			usage(NULL);
+			break;
+		case '?':
+		default:
+			usage("Bad argument.");
+			break;
+		}
+	}
+
+	if (optind != argc - 1)
+		usage("Expected exactly one trace.");
+
+	in = fopen(argv[optind], "r");
+	if (!in)
+		die("could not open trace");
+
+	if (trace_read_header(in, &hdr, &fields, &meta))
+		die("not a cache_cost trace");
+
+	rec = malloc(hdr.record_size);
+	phys = malloc(sizeof(uint64_t) * (hdr.num_pages ? hdr.num_pages : 1));
+	if (!rec || !phys)
+		die("out of memory");
+
+	fputs(meta, out);
+	trace_print_columns(out, fields, hdr.num_fields);
+	while ((ret = trace_read(in, hdr.record_size, hdr.num_pages,
+				 rec, phys)) == 1)
+		trace_print_csv(out, fields, hdr.num_fields, rec,
+				phys, hdr.num_pages);
+	if (ret < 0)
+		fprintf(stderr, "Warning: trace is truncated.\n");
+
+	free(rec);
+	free(phys);
+	free(fields);
+	free(meta);
+	fclose(in);
+	if (fclose(out))
+		die("could not write output");
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "tsc.h"
+
+/* frequency: median of CALIB_ROUNDS measurements over CALIB_NS each */
+#define CALIB_ROUNDS 5
+#define CALIB_NS 20000000
+/* overhead: back-to-back empty regions */
+#define OVERHEAD_ROUNDS 10000
+
+int tsc_have_rdtscp = 0;
+
+static uint64_t timespec_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+
+static void detect_features(struct tsc_calibration *cal)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	cal->rdtscp = 0;
+	cal->invariant = 0;
+	if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+		cal->rdtscp = !!(edx & (1 << 27));
+	if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+		cal->invariant = !!(edx & (1 << 8));
+	tsc_have_rdtscp = cal->rdtscp;
+}
+
+/* TSC ticks per microsecond during one CALIB_NS interval */
+static int measure_mhz(double *mhz)
+{
+	struct timespec t0, t1, delay = { 0, CALIB_NS };
+	uint64_t c0, c1;
+
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &t0))
+		return -1;
+	c0 = tsc_begin();
+	nanosleep(&delay, NULL);
+	c1 = tsc_end();
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &t1))
+		return -1;
+	*mhz = (double) (c1 - c0) * 1000.0 /
+		(timespec_ns(&t1) - timespec_ns(&t0));
+	return 0;
+}
+
+int tsc_calibrate(struct tsc_calibration *cal)
+{
+	double mhz[CALIB_ROUNDS];
+	uint64_t *cycles;
+	uint64_t start, stop;
+	int i;
+
+	detect_features(cal);
+
+	for (i = 0; i < CALIB_ROUNDS; i++)
+		if (measure_mhz(&mhz[i]))
+			return -1;
+	qsort(mhz, CALIB_ROUNDS, sizeof(double), compare_double);
+	cal->mhz = mhz[CALIB_ROUNDS / 2];
+
+	cycles = malloc(sizeof(uint64_t) * OVERHEAD_ROUNDS);
+	if (!cycles)
+		return -1;
+	for (i = 0; i < OVERHEAD_ROUNDS; i++) {
+		start = tsc_begin();
+		stop = tsc_end();
+		cycles[i] = stop - start;
+	}
+	qsort(cycles, OVERHEAD_ROUNDS, sizeof(uint64_t), compare_u64);
+	cal->overhead = cycles[0];
+	cal->jitter = cycles[OVERHEAD_ROUNDS * 99 / 100] - cycles[0];
+	free(cycles);
+	return 0;
+}
+
+#else
+
+int tsc_calibrate(struct tsc_calibration *cal)
+{
+	/* no TSC */
+	memset(cal, 0, sizeof(*cal));
+	return -1;
+}
+
+#endif
+
+double tsc_mhz(void)
+{
+	static struct tsc_calibration cal;
+
+	if (!cal.mhz && tsc_calibrate(&cal))
+		return 0.0;
+	return cal.mhz;
+}
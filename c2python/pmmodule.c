@@ -11,16 +11,17 @@
 #include <numpy/arrayobject.h>
 
 #include "pm_common.h"
+#include "pm_store.h"
 
 static struct ovd_plen *preempt = NULL;
 static struct ovd_plen *samel2 = NULL;
 static struct ovd_plen *samechip = NULL;
 static struct ovd_plen *offchip = NULL;
 
-static int pcount = 0;
-static int l2count = 0;
-static int chipcount = 0;
-static int offcount = 0;
+static long pcount = 0;
+static long l2count = 0;
+static long chipcount = 0;
+static long offcount = 0;
 
 static int loaded(int set)
 {
@@ -64,7 +65,7 @@ static PyObject* pm_load(PyObject *self, PyObject *args)
 	int tss;
 
 	struct full_ovd_plen *full_costs = NULL;
-	int num_samples;
+	long num_samples;
 
 	if (!PyArg_ParseTuple(args, "sIIii", &filename, &cores_per_l2,
 				&num_phys_cpu, &wss, &tss))
@@ -126,7 +127,7 @@ static PyObject* pm_get_preemption(PyObject *self, PyObject *args)
 	PyArrayObject *py_preempt;
 	npy_intp shape[2];
 
-	int i;
+	long i;
 	long long *tmp;
 
 	if (!loaded(0)) {
@@ -175,7 +176,7 @@ static PyObject* pm_get_samel2(PyObject *self, PyObject *args)
 	PyArrayObject *py_samel2;
 	npy_intp shape[2];
 
-	int i;
+	long i;
 	long long *tmp;
 
 	if (!loaded(0)) {
@@ -224,7 +225,7 @@ static PyObject* pm_get_samechip(PyObject *self, PyObject *args)
 	PyArrayObject *py_samechip;
 	npy_intp shape[2];
 
-	int i;
+	long i;
 	long long *tmp;
 
 	if (!loaded(0)) {
@@ -273,7 +274,7 @@ static PyObject* pm_get_offchip(PyObject *self, PyObject *args)
 	PyArrayObject *py_offchip;
 	npy_intp shape[2];
 
-	int i;
+	long i;
 	long long *tmp;
 
 	if (!loaded(0)) {
@@ -316,8 +317,81 @@ err_alloc:
 	return NULL;
 }
 
+/*
+ * pm_info:	what the header of a sample store says about the experiment
+ *
+ * @filename:	raw data file
+ *
+ * returns a dict (host, tsc_mhz, wss, cachesize, num_ws, tasks,
+ * capacity, delta, counters, and cpus: a list of (l2, llc, node) per
+ * CPU, None where unknown), or None for sample files of older pm_tasks
+ */
+static PyObject* pm_info(PyObject *self, PyObject *args)
+{
+	const char *filename;
+	struct pm_store_header header;
+	struct pm_store_cpu *cpus;
+	PyObject *info, *cpu_list, *cpu;
+	unsigned int i;
+	int fd, err;
+
+	if (!PyArg_ParseTuple(args, "s", &filename))
+		return NULL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+						      (char *) filename);
+	err = !pm_store_check(fd) || pm_store_info(fd, &header, &cpus);
+	close(fd);
+	if (err) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	cpu_list = PyList_New(header.num_cpus);
+	if (!cpu_list) {
+		free(cpus);
+		return NULL;
+	}
+	for (i = 0; i < header.num_cpus; i++) {
+#define TOPO(x) ((x) == UINT16_MAX ? Py_BuildValue("") : \
+		 PyInt_FromLong(x))
+		cpu = Py_BuildValue("(NNN)", TOPO(cpus[i].l2),
+				    TOPO(cpus[i].llc), TOPO(cpus[i].node));
+#undef TOPO
+		if (!cpu) {
+			Py_DECREF(cpu_list);
+			free(cpus);
+			return NULL;
+		}
+		PyList_SET_ITEM(cpu_list, i, cpu);
+	}
+	free(cpus);
+
+	header.host[PM_STORE_HOST_LEN - 1] = '\0';
+	info = Py_BuildValue("{s:s,s:d,s:I,s:I,s:I,s:I,s:K,s:O,s:O,s:N}",
+			     "host", header.host,
+			     "tsc_mhz", header.tsc_mhz,
+			     "wss", header.wss,
+			     "cachesize", header.cachesize,
+			     "num_ws", header.num_ws,
+			     "tasks", header.num_tasks < header.max_tasks ?
+					header.num_tasks : header.max_tasks,
+			     "capacity",
+					(unsigned long long) header.capacity,
+			     "delta", header.flags & PM_STORE_DELTA ?
+					Py_True : Py_False,
+			     "counters", header.flags & PM_STORE_COUNTERS ?
+					Py_True : Py_False,
+			     "cpus", cpu_list);
+	return info;
+}
+
 static PyMethodDef PmMethods[] = {
 	{"load", pm_load, METH_VARARGS, "Load data from raw files"},
+	{"info", pm_info, METH_VARARGS,
+		"Get the experiment described in a sample store"},
 	{"getPreemption", pm_get_preemption, METH_VARARGS,
 		"Get preemption overheads - length"},
 	{"getL2Migration", pm_get_samel2, METH_VARARGS,
@@ -6,7 +6,13 @@ FILENAME is where the .raw overhead data are. Filename
 and the path to it also gives the base path and filename for the
 files that contains already processed overheads and the directory
 where to save the output data.
-FILENAME should be something like: "res_plugin=GSN-EDF_wss=WSS_tss=TSS.raw".
+FILENAME should be something like: "res_plugin=GSN-EDF_wss=WSS_tss=TSS.raw"
+(pm_test_script also adds "_backing=BACKING_pollute=LEVEL" after the WSS;
+analyze one interference level at a time).
+pm_task writes the samples of all tasks of a task set to one sample
+store, which can be given as FILENAME as it is; its header gives the
+WSS, the number of tasks and the TSC frequency. Files of older
+pm_tasks (one plain array of samples) are read as well.
 Also, take a look at the "compact_results" script
 """
 
@@ -143,8 +149,18 @@ class Analyzer(defapp.App):
     def process_raw_data(self, datafile, conf):
         coresL2 = self.options.coresL2
         pcpu = self.options.pcpu
+        wss = int(conf['wss'])
+        tss = int(conf['tss'])
+        # sample stores describe the experiment themselves
+        info = pm.info(datafile)
+        if info:
+            wss = info['wss']
+            tss = info['tasks']
+            if self.options.verbose:
+                print "%s: host %s, TSC %.3f MHz, WSS %d KB, %d tasks" % \
+                        (datafile, info['host'], info['tsc_mhz'], wss, tss)
         # initialize pmmodule
-        pm.load(datafile, coresL2, pcpu, int(conf['wss']), int(conf['tss']))
+        pm.load(datafile, coresL2, pcpu, wss, tss)
         # raw overheads
         ovds = Overhead()
         # valid overheads
@@ -0,0 +1,42 @@
+#ifndef BACKING_H
+#define BACKING_H
+
+#include <stddef.h>
+
+/* Memory that backs a working set */
+
+enum backing_mode {
+	BACKING_ANON = 0,	/* private anonymous, 4 KB pages only */
+	BACKING_THP,		/* private anonymous, transparent huge pages */
+	BACKING_HUGETLB_2M,	/* hugetlbfs, 2 MB pages */
+	BACKING_HUGETLB_1G,	/* hugetlbfs, 1 GB pages */
+	BACKING_SHM,		/* POSIX shared memory segment */
+	BACKING_FILE,		/* shared mapping of a file */
+	NUM_BACKINGS
+};
+
+struct backing {
+	enum backing_mode mode;
+	void *base;
+	size_t len;
+	size_t page_size;	/* expected size of the backing pages */
+};
+
+/* Parse "anon-4k", "thp", "hugetlb-2m", "hugetlb-1g", "shm", "file" or
+ * "file:PATH". *path is set to PATH, or to NULL (a temporary file).
+ * Returns 0 on success, -1 if name is not a known mode.
+ */
+int parse_backing(const char *name, enum backing_mode *mode,
+		  const char **path);
+const char *backing_mode_name(enum backing_mode mode);
+
+/* Map len bytes (rounded up to the page size of the mode), aligned to
+ * the page size. path is only used by BACKING_FILE.
+ * Returns 0 on success, -1 with errno set otherwise. The hugetlb modes
+ * need reserved huge pages (see /proc/sys/vm/nr_hugepages).
+ */
+int backing_map(struct backing *backing, enum backing_mode mode,
+		size_t len, const char *path);
+void backing_unmap(struct backing *backing);
+
+#endif
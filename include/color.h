@@ -0,0 +1,45 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stddef.h>
+
+/* Page coloring: the physical address bits just above the page offset
+ * select the LLC sets that a page maps to. Pages of the same color
+ * compete for the same sets; pages of different colors never do.
+ */
+
+/* Number of page colors of the LLC of cpu (sets * line size /
+ * page_size, rounded down to a power of two), or 1 if unknown.
+ */
+int llc_page_colors(int cpu, size_t page_size);
+
+static inline int page_color(unsigned long phys_addr, size_t page_size,
+			     int num_colors)
+{
+	return (phys_addr / page_size) % num_colors;
+}
+
+/* A virtually contiguous region built from pages of chosen colors. */
+struct color_region {
+	char *base;
+	size_t len;
+	size_t page_size;
+	unsigned long pages;
+};
+
+/* Move the pages of [pool, pool + pool_len) that have one of the num
+ * colors in colors[] into a new region, in round-robin color order:
+ * page i of the region has color colors[i % num]. The region is as
+ * large as the scarcest color allows, at most max_pages pages (0: no
+ * limit other than vm.max_map_count, as every page is a mapping of its
+ * own). Pool pages are faulted in first; the pool is unmapped
+ * afterwards. Needs 'page_size' pages and physical addresses in
+ * /proc/self/pagemap (root).
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+int color_region_build(struct color_region *region, void *pool,
+		       size_t pool_len, size_t page_size, int num_colors,
+		       const int *colors, int num, unsigned long max_pages);
+void color_region_free(struct color_region *region);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+/* Interface to Linux's /sys/devices/system/node and to the NUMA
+ * memory policy system calls (no libnuma needed).
+ */
+
+/* Number of nodes (1 if the kernel has no NUMA support). */
+int numa_num_nodes(void);
+
+/* Node of cpu, or 0 if unknown. */
+int numa_node_of_cpu(int cpu);
+
+/* Store the CPUs of node in cpus[]; returns their number or -1. */
+int numa_node_cpus(int node, int *cpus, int max_cpus);
+
+/* ACPI SLIT distance between two nodes (10 means local), -1 if unknown. */
+int numa_distance(int from, int to);
+
+/* Bind the pages of [addr, addr + len) to node, moving pages that are
+ * already elsewhere. Returns 0 on success, -1 with errno set otherwise.
+ */
+int numa_bind(void *addr, size_t len, int node);
+
+/* Look up the node of each of count pages; nodes[i] is negative if
+ * pages[i] is not present. Returns 0 on success, -1 otherwise.
+ */
+int numa_page_nodes(void **pages, unsigned long count, int *nodes);
+
+/* Is automatic NUMA balancing (/proc/sys/kernel/numa_balancing) on? */
+int numa_balancing_enabled(void);
+
+/* System-wide number of pages moved by NUMA balancing (/proc/vmstat). */
+unsigned long numa_pages_migrated(void);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef PAGEMAP_H
 #define PAGEMAP_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 /* Interface to Linux's /proc/<PID>/pagemap */
 
 /* target == 0 means 'this process' */
@@ -13,5 +16,58 @@ size_t get_phys_addrs(
 	unsigned long *phys_addr,
 	size_t num_addr);
 
-#endif
+/* Page flags reported by pagemap_resolve() */
+#define PAGE_PRESENT	0x01
+#define PAGE_SWAPPED	0x02
+#define PAGE_FILE	0x04	/* file page or shared anonymous page */
+#define PAGE_EXCLUSIVE	0x08	/* mapped only by this process */
+#define PAGE_THP	0x10	/* part of a transparent huge page */
+#define PAGE_HUGE	0x20	/* part of a hugetlbfs page */
+
+/* Persistent pagemap handle. Translations of pages within one
+ * registered range (e.g., a memory arena) are cached until the kernel
+ * reports in /proc/vmstat that it migrated, swapped, split or
+ * collapsed pages.
+ */
+struct pagemap {
+	int fd;			/* /proc/<PID>/pagemap */
+	int kpageflags_fd;	/* /proc/kpageflags, -1 if not readable */
+	int vmstat_fd;
+	size_t page_size;
+	uint64_t generation;	/* of the cached translations */
+
+	unsigned long cache_first;	/* first cached virtual page */
+	size_t cache_pages;
+	uint64_t *cache_entries;	/* raw pagemap entries */
+	unsigned char *cache_flags;	/* PAGE_*, 0 if not cached */
+
+	uint64_t *buf;		/* for uncached ranges */
+	size_t buf_len;
+};
 
+/* Returns 0 on success, -1 if the pagemap cannot be opened. */
+int pagemap_open(struct pagemap *pm, pid_t target);
+void pagemap_close(struct pagemap *pm);
+
+/* Cache translations of the len bytes starting at start.
+ * Replaces any previously registered range.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int pagemap_cache_range(struct pagemap *pm, unsigned long start, size_t len);
+
+/* Forget cached translations, e.g., after remapping memory. */
+void pagemap_invalidate(struct pagemap *pm);
+
+/* Like get_phys_addrs(), but with one pread() per range, from the cache
+ * if possible. If flags is non-NULL, it receives the PAGE_* flags of
+ * each page. PAGE_THP and PAGE_HUGE require read access to
+ * /proc/kpageflags. Returns the number of pages resolved.
+ */
+size_t pagemap_resolve(struct pagemap *pm,
+		       unsigned long virt_addr_start,
+		       unsigned long virt_addr_end,
+		       unsigned long *phys_addr,
+		       unsigned int *flags,
+		       size_t num_addr);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdint.h>
+
+/* Per-thread performance counters (perf_event_open), read around the
+ * timed phases of a measurement.
+ */
+
+/* Counter slots. If the hardware event of a slot cannot be opened
+ * (e.g., in a VM without a virtual PMU), a software event takes its
+ * place: context switches, page faults, CPU migrations and task clock
+ * (ns), respectively.
+ */
+enum perf_slot {
+	PERF_LLC_MISSES = 0,
+	PERF_DTLB_MISSES,
+	PERF_INSTRUCTIONS,
+	PERF_REF_CYCLES,
+	NUM_PERF_SLOTS
+};
+
+struct perf_event_mmap_page;
+
+struct perf_group {
+	int fd[NUM_PERF_SLOTS];		/* fd[0] leads the group */
+	struct perf_event_mmap_page *page[NUM_PERF_SLOTS];
+	int software[NUM_PERF_SLOTS];	/* slot fell back to software */
+	int rdpmc;			/* all slots can be read with rdpmc */
+};
+
+/* Open the counters of the calling thread. They count on any CPU, so
+ * they follow the thread across migrations. If software_only is set,
+ * hardware events are not even tried.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+int perf_group_open(struct perf_group *group, int software_only);
+void perf_group_close(struct perf_group *group);
+
+/* Short name (e.g., "LLC" or, after fallback, "PGFLT") of a slot. */
+const char *perf_slot_name(struct perf_group *group, int slot);
+
+/* Read all slots: with rdpmc from user space if the kernel allows it,
+ * otherwise with a single read() of the group.
+ */
+void perf_group_read(struct perf_group *group, uint64_t *values);
+
+/* Read all slots with rdpmc only, without a system call.
+ * Returns 0 on success, -1 if some slot cannot be read that way.
+ */
+int perf_group_read_user(struct perf_group *group, uint64_t *values);
+
+#endif
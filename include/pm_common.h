@@ -19,7 +19,9 @@
 
 /* WSS, CACHESIZE, DATAPOINTS may be given as commandline define
  * when ricompiling this test for different WSS, CACHESIZE and (?) datapoints
- * ATM only WSS can be passed through scons building mechanism
+ * ATM WSS and CACHESIZE can be passed through scons building mechanism.
+ * pm_task takes the WSS, the cache size and the number of working sets
+ * at runtime (-w, -c, -n); WSS and CACHESIZE are only its defaults.
  */
 
 /* Definitions and variables related to experimental measurement.
@@ -30,7 +32,7 @@
  */
 /*
  * default working set size, in KB
- * non-default WSS are taken from the test script (-DWSS=...)
+ * non-default WSS are taken from the test script (pm_task -w)
  */
 #ifndef WSS
 #define WSS	3072
@@ -40,10 +42,16 @@
  * Koruna: L2: 6MB every 2 cores
  * Ludwig: L2: 3MB every 2 cores, L3 12MB
  * Pound:  L2: 256KB, L3 8MB
+ * in KB; "cache_calib -l" measures it on the target machine.
+ * pm_task uses the LLC size in sysfs if there is one.
  */
+#ifndef CACHESIZE
 #define CACHESIZE	(12 * 1024)
+#endif
 
-/* number of measurements that can be stored per single pm_task */
+/* default number of measurements that can be stored per single pm_task
+ * (pm_task -d)
+ */
 #define DATAPOINTS	100000
 
 /* The following macro don't need (hopefully) any modification */
@@ -52,14 +60,16 @@
  * Niagara, Koruna, Ludwig, Pound cache line size: 64B
  */
 #define CACHEALIGNMENT	64
-/* ints per WSS */
-#define	INTS_PER_WSS	(WSS*1024)/(sizeof(int))
+/* ints per working set of wss KB */
+#define	INTS_PER_WSS(wss)	((size_t)(wss) * 1024 / sizeof(int))
 /* reads vs. writes ratio */
 #define READRATIO	75
 /* random seed */
 #define SEEDVAL		12345
-/* number of "working sets" to cycle through */
-#define NUMWS		((CACHESIZE*2)/WSS)+2
+/* default number of "working sets" to cycle through, so that together
+ * they are larger than twice the cache (cachesize and wss in KB)
+ */
+#define NUMWS(cachesize, wss)	(((cachesize)*2)/(wss)+2)
 /* runtime in milliseconds -- 60s*/
 #define SIMRUNTIME	60000
 /* times to read warm memory to get accurate data */
@@ -71,24 +81,12 @@
 
 #define NS_PER_MS	1000000
 
-struct data_entry {
-	unsigned long long timestamp;
-
-	/* cC cold cache access
-	 * hH hot cache access
-	 * pP preeption / migration
-	 */
-	char access_type;
-	unsigned long long access_time;
-
-	unsigned int cpu;
-	unsigned long job_count;
-	unsigned long sched_count;
-	unsigned long last_rt_task;
-	unsigned long long preemption_length;
-};
-
-/* serializable data entry */
+/* serializable data entry
+ * access_type:
+ * cC cold cache access
+ * hH hot cache access
+ * pP preeption / migration
+ */
 struct saved_data_entry {
 	char access_type;
 	unsigned long long access_time;
@@ -116,31 +114,26 @@ struct ovd_plen {
 	long long plen;
 };
 
-/* write data_entry -> saved_data_entry on disk */
-int serialize_data_entry(char *filename, struct data_entry *samples, int num);
-/* read saved_data_entry from disk */
-int read_sdata_entry(const char *filename, struct saved_data_entry **samples);
-
 /* get valid overhead from trace file */
-int get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
+long get_valid_ovd(const char *filename, struct full_ovd_plen **full_costs,
 		int wss, int tss);
 
 /* get ovd and pm length for different cores configurations (on uma xeon) */
 /* Watch out for different topologies:
  * /sys/devices/system/cpu/cpuX/cache/indexY/shared_cpu_list
  */
-void get_ovd_plen_umaxeon(struct full_ovd_plen *full_costs, int num_samples,
+void get_ovd_plen_umaxeon(struct full_ovd_plen *full_costs, long num_samples,
 		unsigned int cores_per_l2, unsigned int num_phys_cpu,
-		struct ovd_plen *preempt, int *pcount,
-		struct ovd_plen *samel2, int *l2count,
-		struct ovd_plen *samechip, int *chipcount,
-		struct ovd_plen *offchip, int *offcount);
+		struct ovd_plen *preempt, long *pcount,
+		struct ovd_plen *samel2, long *l2count,
+		struct ovd_plen *samechip, long *chipcount,
+		struct ovd_plen *offchip, long *offcount);
 
 /* get ovd and pm length for different cores configurations */
-void get_ovd_plen(struct full_ovd_plen *full_costs, int num_samples,
+void get_ovd_plen(struct full_ovd_plen *full_costs, long num_samples,
 		 unsigned int cores_per_l2, unsigned int cores_per_chip,
-		 struct ovd_plen *preempt, int *pcount,
-		 struct ovd_plen *samel2, int *l2count,
-		 struct ovd_plen *samechip, int *chipcount,
-		 struct ovd_plen *offchip, int *offcount);
+		 struct ovd_plen *preempt, long *pcount,
+		 struct ovd_plen *samel2, long *l2count,
+		 struct ovd_plen *samechip, long *chipcount,
+		 struct ovd_plen *offchip, long *offcount);
 #endif
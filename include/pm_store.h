@@ -0,0 +1,324 @@
+/*
+ * preemption and migration overhead measurement
+ *
+ * shared sample store: one file per task set
+ */
+#ifndef PM_STORE_H
+#define PM_STORE_H
+
+#include <stdint.h>
+
+#include "pm_common.h"
+#include "perfctr.h"
+
+/* The store is a file of max_tasks segments of capacity records each.
+ * Every pm_task of a task set claims a segment when it starts (the
+ * first one creates the file) and appends its samples to it through a
+ * shared mapping, so that they are in the file as soon as they are
+ * written, whatever happens to the task afterwards. A segment never
+ * wraps: samples that do not fit are counted as dropped.
+ *
+ *	header | segment table | topology table | segment 0 | ...
+ *
+ * The header describes the experiment (host, TSC frequency, working
+ * sets, CPUs), so that the analysis does not depend on file names.
+ * Segments start at page boundaries. Only the task that claimed a
+ * segment writes to it; used is its append cursor and is advanced
+ * after the record is complete, so readers (even while the tasks run)
+ * only see complete records.
+ *
+ * All fields are little endian, as are the machines that write them.
+ * Stores of version 1 (records of struct saved_data_entry, nothing but
+ * the segment sizes in the header) are still read, with the fields
+ * they lack set to 0, but no longer written.
+ */
+#define PM_STORE_MAGIC		"PMSTORE"
+#define PM_STORE_VERSION	2
+
+/* Records are delta encoded (see below) rather than struct pm_record */
+#define PM_STORE_DELTA		0x1
+/* Records are followed by counter deltas (see below) */
+#define PM_STORE_COUNTERS	0x2
+
+#define PM_STORE_HOST_LEN	64
+
+struct pm_store_header {
+	char magic[8];			/* set last by the creator */
+	uint32_t version;
+	uint32_t flags;
+	uint32_t record_size;		/* sizeof(struct pm_record) */
+	uint32_t max_tasks;
+	volatile uint32_t num_tasks;	/* segments claimed so far */
+	uint32_t num_cpus;		/* entries of the topology table */
+	uint64_t capacity;		/* records per segment */
+	uint64_t segment_size;		/* bytes, a multiple of the page */
+	uint64_t data_offset;		/* of segment 0 */
+	double tsc_mhz;
+	uint32_t wss;			/* KB */
+	uint32_t cachesize;		/* KB */
+	uint32_t num_ws;		/* working sets per task */
+	uint32_t pad;
+	char host[PM_STORE_HOST_LEN];
+};
+
+struct pm_store_segment {
+	int32_t pid;
+	uint32_t pad;
+	uint64_t period;		/* ns */
+	uint64_t exec_cost;		/* ns */
+	volatile uint64_t count;	/* records written */
+	volatile uint64_t used;		/* bytes written */
+	volatile uint64_t dropped;	/* records that did not fit */
+};
+
+/* Which caches and memory each CPU is attached to: CPUs with the same
+ * l2 (llc) index share an L2 (last-level) cache. UINT16_MAX if unknown.
+ */
+struct pm_store_cpu {
+	uint16_t l2;
+	uint16_t llc;
+	uint16_t node;
+	uint16_t pad;
+};
+
+/* A sample, packed: half the size of struct saved_data_entry.
+ * access_time saturates at UINT32_MAX cycles (a second or more).
+ */
+struct pm_record {
+	uint64_t preemption_length;
+	uint32_t access_time;
+	uint16_t cpu;
+	char access_type;
+	uint8_t pad;
+};
+
+/* Delta encoding (PM_STORE_DELTA): the access type, then the access
+ * time as the zigzag varint of its difference to the previous access
+ * time of the same kind (c/C, h/H or p/P; 0 at first), the cpu as a
+ * varint, and for p/P the preemption length as a varint. Varints are
+ * little endian base 128, 7 bits per byte, high bit set on all but
+ * the last byte. A record takes at most PM_DELTA_MAX bytes; segments
+ * have room for capacity records of PM_DELTA_AVG bytes, which is more
+ * than samples of the same job and working set take. capacity is thus
+ * a byte budget here, not a number of samples: a segment takes samples
+ * until less than PM_DELTA_MAX bytes are left, which is usually more
+ * than capacity of them, but fewer if they compress badly.
+ */
+#define PM_DELTA_MAX		(1 + 10 + 5 + 10)
+#define PM_DELTA_AVG		8
+#define PM_DELTA_KINDS		3
+
+/* Counter deltas (PM_STORE_COUNTERS): the hardware events of perfctr.h
+ * counted over the timed phase of the sample, NUM_PERF_SLOTS of them
+ * after each record: uint64_t in packed stores, varints in delta
+ * encoded ones (about PM_COUNTERS_DELTA_AVG bytes in all). 0 if the
+ * counters could not be read.
+ */
+#define PM_COUNTERS_SIZE	(NUM_PERF_SLOTS * sizeof(uint64_t))
+#define PM_COUNTERS_DELTA_MAX	(NUM_PERF_SLOTS * 10)
+#define PM_COUNTERS_DELTA_AVG	16
+
+/* What the creator of a store puts in the header. */
+struct pm_store_params {
+	unsigned int max_tasks;
+	unsigned long capacity;		/* records per task (delta: of
+					 * PM_DELTA_AVG bytes) */
+	unsigned int flags;
+	double tsc_mhz;
+	unsigned int wss;
+	unsigned int cachesize;
+	unsigned int num_ws;
+	unsigned int num_cpus;
+	const struct pm_store_cpu *cpus;
+};
+
+/* The view of a writer: the header and its own segment. */
+struct pm_store {
+	int fd;
+	struct pm_store_header *header;
+	size_t header_len;
+	struct pm_store_segment *segment;
+	unsigned char *data;
+	uint64_t limit;			/* bytes, less once sealed */
+	uint64_t last[PM_DELTA_KINDS];	/* delta encoding state */
+};
+
+/* Create the store described by params, or open the store that
+ * another task of the task set created (params are then ignored), and
+ * claim the next free segment. The segment is allocated on disk and
+ * read into the page cache, but the first write to each of its pages
+ * (again after writeback) still faults: append with interrupts on.
+ * Returns 0 on success, -1 with errno set otherwise (ENOSPC if all
+ * segments are taken, EINVAL if filename is not a store).
+ */
+int pm_store_open(struct pm_store *store, const char *filename,
+		  const struct pm_store_params *params);
+
+/* Record the task parameters in our segment. */
+void pm_store_set_task(struct pm_store *store, uint64_t period,
+		       uint64_t exec_cost);
+
+/* Flush the segment to disk and unmap it. */
+void pm_store_close(struct pm_store *store);
+
+/* largest record of a store, in bytes */
+static inline size_t pm_store_record_max(const struct pm_store_header *h)
+{
+	int counters = h->flags & PM_STORE_COUNTERS;
+
+	if (h->flags & PM_STORE_DELTA)
+		return PM_DELTA_MAX + (counters ? PM_COUNTERS_DELTA_MAX : 0);
+	return sizeof(struct pm_record) + (counters ? PM_COUNTERS_SIZE : 0);
+}
+
+/* records that still fit (at least) */
+static inline uint64_t pm_store_room(struct pm_store *store)
+{
+	return (store->limit - store->segment->used) /
+		pm_store_record_max(store->header);
+}
+
+/* Drop all further records, e.g. because a group of records that
+ * belong together does not fit any more.
+ */
+static inline void pm_store_seal(struct pm_store *store)
+{
+	store->limit = store->segment->used;
+}
+
+static inline int pm_delta_kind(char access_type)
+{
+	switch (access_type) {
+	case 'c': case 'C':
+		return 0;
+	case 'h': case 'H':
+		return 1;
+	default:
+		return 2;
+	}
+}
+
+static inline unsigned char* pm_put_varint(unsigned char *pos, uint64_t v)
+{
+	while (v >= 0x80) {
+		*pos++ = v | 0x80;
+		v >>= 7;
+	}
+	*pos++ = v;
+	return pos;
+}
+
+/* Append a sample, or count it as dropped if it does not fit.
+ * counters are its counter deltas, kept if the store has room for them.
+ */
+static inline void pm_store_append(struct pm_store *store, char access_type,
+				   uint64_t access_time, unsigned int cpu,
+				   uint64_t preemption_length,
+				   const uint64_t *counters)
+{
+	struct pm_store_segment *seg = store->segment;
+	unsigned char *pos = store->data + seg->used;
+	struct pm_record *rec;
+	int64_t delta;
+	int kind, slot;
+
+	if (!pm_store_room(store)) {
+		seg->dropped++;
+		return;
+	}
+	if (store->header->flags & PM_STORE_DELTA) {
+		kind = pm_delta_kind(access_type);
+		delta = access_time - store->last[kind];
+		store->last[kind] = access_time;
+		*pos++ = access_type;
+		pos = pm_put_varint(pos, (uint64_t) delta << 1 ^
+				    (uint64_t) (delta >> 63));
+		pos = pm_put_varint(pos, cpu);
+		if (kind == 2)
+			pos = pm_put_varint(pos, preemption_length);
+		if (store->header->flags & PM_STORE_COUNTERS)
+			for (slot = 0; slot < NUM_PERF_SLOTS; slot++)
+				pos = pm_put_varint(pos, counters[slot]);
+	} else {
+		rec = (struct pm_record *) pos;
+		rec->preemption_length = preemption_length;
+		rec->access_time = access_time < UINT32_MAX ?
+			access_time : UINT32_MAX;
+		rec->cpu = cpu;
+		rec->access_type = access_type;
+		rec->pad = 0;
+		pos += sizeof(*rec);
+		if (store->header->flags & PM_STORE_COUNTERS) {
+			memcpy(pos, counters, PM_COUNTERS_SIZE);
+			pos += PM_COUNTERS_SIZE;
+		}
+	}
+	__sync_synchronize();
+	seg->used = pos - store->data;
+	seg->count++;
+}
+
+/* Nonzero if the file behind fd is a store. */
+int pm_store_check(int fd);
+
+/* Copy of the header of the store behind fd, and of its topology
+ * table (malloc'ed, may be NULL if cpus is NULL).
+ * Returns 0 on success, -1 if fd is not a store of a version we read.
+ */
+int pm_store_info(int fd, struct pm_store_header *header,
+		  struct pm_store_cpu **cpus);
+
+/* Sequential reader of the samples of a file: a sample store, or the
+ * plain array of struct saved_data_entry of older pm_tasks. The file
+ * is mapped read-only and samples are handed out in place (plain) or
+ * decoded one at a time, without copying the file; if it cannot be
+ * mapped, it is streamed through a small window instead.
+ */
+enum pm_format {
+	PM_FORMAT_PLAIN = 0,
+	PM_FORMAT_PACKED,
+	PM_FORMAT_DELTA,
+};
+
+struct pm_reader_segment {
+	uint64_t offset;		/* in the file */
+	uint64_t len;			/* bytes */
+	uint64_t count;			/* records */
+};
+
+struct pm_reader {
+	int fd;
+	int err;			/* errno of a failed read, or 0 */
+	enum pm_format format;
+	struct pm_store_header header;	/* of a store */
+	uint64_t num_samples;		/* in all segments */
+	uint64_t dropped;		/* did not fit in the store */
+
+	unsigned int num_segments;
+	struct pm_reader_segment *segments;
+	int seg;			/* current segment */
+	uint64_t left;			/* records left in it */
+
+	const unsigned char *map;	/* the whole file, NULL if streaming */
+	size_t map_len;
+	const unsigned char *pos, *end;	/* what is left of the segment */
+	unsigned char *buf;		/* streaming window */
+	uint64_t next, seg_end;		/* file offsets (streaming) */
+
+	uint64_t last[PM_DELTA_KINDS];	/* delta decoding state */
+	struct saved_data_entry sample;	/* decoded */
+	/* counter deltas of the sample (PM_STORE_COUNTERS), else 0 */
+	uint64_t counters[NUM_PERF_SLOTS];
+};
+
+/* Returns 0 on success, -1 with errno set otherwise. */
+int pm_reader_open(struct pm_reader *r, const char *filename);
+
+/* The next sample, in segment order, or NULL at the end (or on a read
+ * error: r->err is set). It is valid until the next call.
+ */
+const struct saved_data_entry* pm_reader_next(struct pm_reader *r);
+
+void pm_reader_close(struct pm_reader *r);
+
+#endif
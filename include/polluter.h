@@ -0,0 +1,113 @@
+#ifndef POLLUTER_H
+#define POLLUTER_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "perfctr.h"
+#include "touch.h"
+
+/* Background load: a thread pinned to a CPU that does not measure and
+ * traverses its own footprint over and over, optionally paced to a
+ * target rate. It competes with the measured task for the shared
+ * caches and memory bandwidth at a known, repeatable level.
+ */
+
+/* What the rate of a polluter is counted in. */
+enum polluter_unit {
+	RATE_MBPS = 0,		/* MB/s traversed */
+	RATE_LLC,		/* thousands of LLC misses per second */
+	NUM_RATE_UNITS
+};
+
+struct polluter_spec {
+	int footprint;			/* KB */
+	enum access_pattern pattern;
+	int stride;
+	int write_cycle;
+	touch_kernel_t kernel;		/* NULL: the scalar kernel */
+	enum polluter_unit unit;
+	long rate;			/* in unit, 0: as fast as it can */
+};
+
+/* The footprint is traversed in chunks of at most this many KB, and
+ * the rate is controlled after each chunk, so that a paced polluter
+ * issues a steady stream of accesses rather than bursts of passes.
+ */
+#define POLLUTER_CHUNK_KB 256
+
+struct polluter {
+	int cpu;
+	struct polluter_spec spec;
+	int *mem;
+	int num_chunks;
+	struct access_layout *chunks;
+	struct perf_group perf;
+	int counting;			/* perf counts LLC misses */
+
+	/* written by the thread, read by anyone */
+	volatile unsigned long long bytes;	/* traversed so far */
+	volatile unsigned long long misses;	/* LLC misses so far */
+	volatile int ready;		/* footprint prefaulted */
+	volatile int stop;
+	int err;			/* why the thread gave up, if it did */
+	pthread_t thread;
+};
+
+/* A snapshot of the traffic of a polluter. */
+struct polluter_mark {
+	unsigned long long bytes;
+	unsigned long long misses;
+	struct timespec time;		/* CLOCK_MONOTONIC */
+};
+
+/* "mbps" or "llc"; returns -1 if name is unknown */
+int parse_rate_unit(const char *name, enum polluter_unit *unit);
+const char *rate_unit_name(enum polluter_unit unit);
+
+/* Parse "KB[:PATTERN[:WRITECYCLE[:RATE[:UNIT]]]]" (UNIT mbps, the
+ * default, or llc) into spec. Returns 0 on success, -1 otherwise.
+ */
+int parse_polluter_spec(const char *spec, struct polluter_spec *out);
+
+/* Start the thread on cpu under SCHED_OTHER. The thread maps and
+ * prefaults the footprint itself, so that its pages come from the
+ * memory next to cpu (even under mlockall(MCL_FUTURE)); this waits
+ * until it has. LLC misses are
+ * counted if the PMU permits; a RATE_LLC polluter fails with ENOTSUP
+ * otherwise.
+ * Returns 0 on success, an error number otherwise.
+ */
+int polluter_start(struct polluter *p, int cpu,
+		   const struct polluter_spec *spec);
+
+void polluter_mark(struct polluter *p, struct polluter_mark *mark);
+
+/* Rate in unit that p achieved since mark. */
+double polluter_rate(struct polluter *p, const struct polluter_mark *mark,
+		     enum polluter_unit unit);
+
+void polluter_stop(struct polluter *p);
+
+/* Rates that pm_polluter exports in shared memory, for scripts and
+ * other tasks to read while it runs. seq is odd while an update is in
+ * progress (a reader retries until it reads the same even seq before
+ * and after copying).
+ */
+#define POLLUTER_STATS_VERSION 1
+
+struct polluter_stats {
+	uint32_t version;
+	uint32_t cpus;			/* polluters */
+	volatile uint64_t seq;
+	uint64_t bytes;			/* totals since start */
+	uint64_t misses;		/* 0 if not counted */
+	double mbps;			/* over the last interval */
+	double llc_kps;
+	int64_t target;			/* spec rate, in target_unit */
+	uint32_t target_unit;
+	uint32_t counting;		/* misses are counted */
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef PREEMPTOR_H
+#define PREEMPTOR_H
+
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "touch.h"
+
+/* A thread that stands in for a higher-priority task: released on a
+ * given CPU at a given time, it traverses its own footprint and blocks
+ * again. Released on the CPU where the measured task sleeps, it evicts
+ * a controlled amount of the task's cache state.
+ */
+struct preemptor {
+	int footprint;			/* KB */
+	enum access_pattern pattern;
+	int write_cycle;
+	int *mem;
+	struct access_layout layout;
+	touch_kernel_t kernel;
+
+	struct timespec release;	/* CLOCK_MONOTONIC */
+	sem_t start;
+	sem_t done;
+	int stop;
+	unsigned long runs;
+	pthread_t thread;
+};
+
+/* Map and prefault the footprint and start the thread, blocked. With a
+ * priority > 0, it runs under SCHED_FIFO with that priority; otherwise
+ * (or if that is not permitted) under SCHED_OTHER.
+ * Returns 0 on success, an error number otherwise.
+ */
+int preemptor_start(struct preemptor *p, int footprint,
+		    enum access_pattern pattern, int stride,
+		    int write_cycle, int priority);
+
+/* Move the preemptor to cpu and let it run there at release.
+ * Returns 0 on success, an error number otherwise.
+ */
+int preemptor_release(struct preemptor *p, int cpu,
+		      const struct timespec *release);
+
+/* Wait until the released preemptor has blocked again. */
+void preemptor_wait(struct preemptor *p);
+
+void preemptor_stop(struct preemptor *p);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef STOPPING_H
+#define STOPPING_H
+
+/* Adaptive sample sizes: running statistics of a series of CPMD
+ * samples, and the rule that decides when the target statistic is
+ * known precisely enough to stop.
+ */
+
+enum stop_statistic {
+	STOP_MEAN = 0,	/* 95% normal confidence interval of the mean */
+	STOP_P99,	/* 95% order-statistic interval of the 99th percentile */
+	STOP_MAX,	/* the maximum no longer grows (stable tail) */
+	NUM_STOP_STATISTICS
+};
+
+struct stop_rule {
+	enum stop_statistic statistic;
+	double width;		/* relative width of the interval */
+	double floor;		/* absolute width that is always precise
+				 * enough (e.g., the timer jitter) */
+};
+
+struct stop_series {
+	unsigned long n;
+	double mean;
+	double m2;		/* sum of squared deviations (Welford) */
+	double max;
+	double *values;		/* in arrival order */
+	unsigned long size;
+	double *sorted;		/* scratch for percentiles */
+	/* last verdict */
+	unsigned long checked;	/* n at the last check */
+	int converged;
+	int valid;		/* estimate, lo and hi are set */
+	double estimate;
+	double lo;
+	double hi;
+};
+
+/* Parse "STAT:WIDTH", e.g. "p99:0.05" (STAT is mean, p99 or max).
+ * Returns 0 on success, -1 if spec is malformed.
+ */
+int parse_stop_rule(const char *spec, struct stop_rule *rule);
+const char *stop_statistic_name(enum stop_statistic statistic);
+
+/* Returns 0 on success, -1 on allocation failure. */
+int stop_series_add(struct stop_series *series, double value);
+void stop_series_free(struct stop_series *series);
+
+/* Is the interval of the statistic narrow enough? Re-evaluated only
+ * when the series has grown noticeably since the last call, so it is
+ * cheap to ask after every sample. Updates estimate, lo and hi.
+ */
+int stop_series_converged(const struct stop_rule *rule,
+			  struct stop_series *series);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef STRATA_H
+#define STRATA_H
+
+#include <stdio.h>
+
+/* Stratified choice of the target CPU of each sample.
+ *
+ * The (source, target) pairs of a CPU group are sorted into migration
+ * classes by the closest cache that the two CPUs share. Each sample
+ * goes to the class with the fewest samples so far that the current
+ * CPU can reach, and within it to the least covered pair, so sparse
+ * classes (e.g., same-L2 pairs) fill up as fast as abundant ones.
+ * Coverage counts can be kept in a file across runs.
+ */
+
+enum strata_class {
+	CLASS_PREEMPTION = 0,
+	CLASS_L1,
+	CLASS_L2,
+	CLASS_L3,
+	CLASS_L4,
+	CLASS_MEMORY,		/* no shared cache */
+	NUM_CLASSES
+};
+
+struct strata {
+	int num;		/* CPUs of the group */
+	int *cpus;
+	int *index_of;		/* cpu -> position in cpus[], -1 if absent */
+	int max_cpu;
+	/* per pair, num * num entries in source-major order */
+	signed char *pair_class;	/* -1: never generated */
+	unsigned long *coverage;	/* samples, including earlier runs */
+	unsigned long *taken;		/* samples of this run */
+	/* per class */
+	int pairs[NUM_CLASSES];
+	unsigned long samples[NUM_CLASSES];
+	unsigned long quota;		/* samples per class, 0: no limit */
+	int closed[NUM_CLASSES];	/* no more samples wanted */
+	int next_class;			/* breaks ties round-robin */
+};
+
+/* Sort the pairs of the num CPUs in cpus[] into classes. If domain_of
+ * is non-NULL, only pairs that cross LLC domains are generated. quota
+ * is the number of samples wanted per class (0 for no limit).
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int strata_init(struct strata *strata, const int *cpus, int num,
+		const int *domain_of, unsigned long quota);
+void strata_free(struct strata *strata);
+
+const char *strata_class_name(int cls);
+
+/* Pick the target CPU of a sample that starts on src. */
+int strata_pick(struct strata *strata, int src);
+
+/* Count a sample of (src, tgt). Returns 1 if its class still wanted
+ * it, 0 if the class already had its quota.
+ */
+int strata_record(struct strata *strata, int src, int tgt);
+
+/* Class of the pair (src, tgt), -1 if the group never generates it. */
+int strata_class_of(struct strata *strata, int src, int tgt);
+
+/* Treat cls as full from now on (e.g., its estimate is good enough). */
+void strata_close(struct strata *strata, int cls);
+
+/* Do all classes have their quota? */
+int strata_done(struct strata *strata);
+
+/* Add the coverage counts of fname (if it exists) to ours.
+ * Returns 0 on success, -1 if the file cannot be read.
+ */
+int strata_load(struct strata *strata, const char *fname);
+
+/* Add the samples of this run to the counts in fname, under an
+ * exclusive lock so that concurrent runs may share the file.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+int strata_save(struct strata *strata, const char *fname);
+
+/* '#' lines: pairs and samples of each class */
+void strata_print(FILE *out, struct strata *strata);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "strata.h"
+#include "trace.h"
+
+/* Streaming statistics of cache_cost samples: per migration class and
+ * per series (the timed phases and the CPMD derived from them), the
+ * count, minimum, maximum, mean and variance, and a log-linear
+ * histogram. Everything merges exactly (histograms bucket by bucket,
+ * moments with Chan et al.'s pairwise update), so summaries of
+ * repetitions, campaign workers and separate runs add up.
+ */
+
+/* Values below 2^HIST_SUB_BITS have a bucket each; above, every power
+ * of two is split into 2^(HIST_SUB_BITS - 1) buckets (about 3% wide).
+ */
+#define HIST_SUB_BITS	6
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_HALF	(HIST_SUB / 2)
+#define HIST_BUCKETS	(HIST_SUB + (64 - HIST_SUB_BITS) * HIST_HALF)
+
+enum summary_series {
+	SERIES_COLD = 0,
+	SERIES_HOT1,
+	SERIES_HOT2,
+	SERIES_HOT3,
+	SERIES_WITH_CPMD,
+	SERIES_CPMD,	/* WITH-CPMD minus the fastest other phase */
+	NUM_SERIES
+};
+
+struct stat_series {
+	uint64_t n;
+	int64_t min;
+	int64_t max;
+	double mean;
+	double m2;		/* sum of squared deviations */
+	uint64_t hist[HIST_BUCKETS];	/* negative values count as 0 */
+};
+
+/* The configuration that a summary describes: a summary file has
+ * entries for many, and only entries of equal keys are merged.
+ */
+struct summary_key {
+	int wss;		/* KB */
+	int write_cycle;
+	int sleep_min;		/* us */
+	int sleep_max;
+	char pattern[16];	/* access pattern */
+};
+
+/* Statistics of one configuration. */
+struct summary {
+	struct summary_key key;
+	struct stat_series series[NUM_CLASSES][NUM_SERIES];
+};
+
+int hist_bucket(uint64_t value);
+/* smallest value of a bucket */
+uint64_t hist_bucket_low(int bucket);
+
+void stat_series_add(struct stat_series *s, int64_t value);
+void stat_series_merge(struct stat_series *into,
+		       const struct stat_series *from);
+
+const char *summary_series_name(int series);
+
+void summary_init(struct summary *summary, const struct summary_key *key);
+
+/* Add the phases (cycles[NUM_PHASES]) of a sample of class cls. */
+void summary_add(struct summary *summary, int cls, const uint64_t *cycles);
+void summary_merge(struct summary *into, const struct summary *from);
+
+/* Merge the entries of fname (if it exists) for summary->key into
+ * summary. Returns 0 on success, -1 if the file cannot be parsed (or
+ * is of an older format, whose entries have no full key).
+ */
+int summary_load(struct summary *summary, const char *fname);
+
+/* Replace the entries of fname for summary->key by those of summary,
+ * keeping the entries of other configurations. The file is
+ * replaced atomically, so readers never see a partial summary.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+int summary_save(const struct summary *summary, const char *fname,
+		 double tsc_mhz);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+/* Interface to Linux's /sys/devices/system/cpu cache topology */
+
+/* Parse a sysfs CPU list (e.g., "0-3,8,10-11") into cpus[].
+ * Returns the number of CPUs stored or -1 if the list is malformed.
+ */
+int parse_cpu_list(const char *list, int *cpus, int max_cpus);
+
+/* Group CPUs 0 .. num_cpus - 1 by the last-level cache that they share.
+ * domain_of[cpu] receives the (dense, 0-based) domain index of each CPU.
+ * Returns the number of domains. If sysfs does not describe the caches,
+ * all CPUs end up in a single domain.
+ */
+int get_llc_domains(int num_cpus, int *domain_of);
+
+/* Number of sets and line size of the last-level cache of cpu.
+ * Returns 0 on success, -1 if sysfs does not describe the caches.
+ */
+int get_llc_geometry(int cpu, int *sets, int *line_size);
+
+/* Level of the closest data or unified cache that cpu shares with
+ * other (e.g., 2 for a shared L2), or 0 if they share none (or sysfs
+ * does not describe the caches).
+ */
+int get_shared_cache_level(int cpu, int other);
+
+/* Size in KB of the data or unified cache of each level of cpu, in
+ * sizes[level] (0 where there is none), for levels up to max_level.
+ * Returns the highest level found, 0 if sysfs does not describe them.
+ */
+int get_cache_sizes(int cpu, int *sizes, int max_level);
+
+#endif
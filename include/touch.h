@@ -0,0 +1,98 @@
+#ifndef TOUCH_H
+#define TOUCH_H
+
+#include <stddef.h>
+
+/* Access patterns used to traverse a working set */
+
+#define CACHE_LINE_SIZE 64
+#define INTS_PER_LINE (CACHE_LINE_SIZE / sizeof(int))
+
+/* In pointer-chasing mode, the last int of each cache line holds the
+ * index of the next line in the ring. It is only ever read.
+ */
+#define CHASE_LINK (INTS_PER_LINE - 1)
+
+enum access_pattern {
+	PATTERN_SEQ = 0,	/* sequential sweep */
+	PATTERN_STRIDE,		/* fixed stride, wrapping around */
+	PATTERN_RANDOM,		/* random permutation of the cache lines */
+	PATTERN_CHASE,		/* dependent loads through a shuffled ring */
+	NUM_PATTERNS
+};
+
+/* Precomputed traversal of one working set. */
+struct access_layout {
+	enum access_pattern pattern;
+	int stride;		/* in bytes, PATTERN_STRIDE only */
+	int *mem;
+	size_t num_lines;
+	/* order in which cache lines are visited (stride and random) */
+	unsigned int *order;
+	size_t order_len;
+};
+
+/* returns 0 on success, -1 if name is not a known pattern */
+int parse_access_pattern(const char *name, enum access_pattern *pattern);
+const char *access_pattern_name(enum access_pattern pattern);
+
+/* Prepare layout for traversing the wss KB starting at mem.
+ * Must be called for every new allocation, outside of timed regions.
+ * Layout buffers are reused across calls.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int build_layout(struct access_layout *layout, enum access_pattern pattern,
+		 int stride, int *mem, int wss);
+void free_layout(struct access_layout *layout);
+
+/* Traverse the working set once. Every write_cycle-th int touched is
+ * incremented, all others are read; write_cycle == 0 means read-only.
+ * Returns the sum of the values read.
+ */
+typedef int (*touch_kernel_t)(struct access_layout *layout, int write_cycle);
+
+/* Write cycles up to this have specialized, division-free kernels;
+ * larger ones fall back to a generic kernel.
+ */
+#define MAX_KERNEL_WCYCLE 8
+
+/* pick the kernel once, before measuring */
+touch_kernel_t select_touch_kernel(enum access_pattern pattern,
+				   int write_cycle);
+
+/* convenience: select and run the kernel */
+int touch_layout(struct access_layout *layout, int write_cycle);
+
+/* Self-check: minimum cycles per cache line of kernel (with the given
+ * pattern and write_cycle) when the working set is L1-resident.
+ */
+double kernel_cycles_per_line(touch_kernel_t kernel,
+			      enum access_pattern pattern, int write_cycle);
+
+/* Vector kernels (touch_simd.c) */
+
+enum touch_isa {
+	ISA_SCALAR = 0,
+	ISA_SSE2,
+	ISA_AVX2,
+	ISA_AVX512,
+	NUM_ISAS
+};
+
+/* "auto" selects the widest ISA supported by this CPU;
+ * returns -1 if name is unknown
+ */
+int parse_touch_isa(const char *name, enum touch_isa *isa);
+const char *touch_isa_name(enum touch_isa isa);
+/* checked with cpuid */
+int touch_isa_supported(enum touch_isa isa);
+enum touch_isa best_touch_isa(void);
+
+/* Returns NULL if isa is scalar or not supported, or if pattern has no
+ * vector kernel. Vector kernels need CACHE_LINE_SIZE-aligned memory.
+ */
+touch_kernel_t select_simd_kernel(enum touch_isa isa,
+				  enum access_pattern pattern,
+				  int nontemporal);
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "pagemap.h"
+#include "perfctr.h"
+
+/* cache_cost sample traces, as CSV text or as compact binary records.
+ *
+ * A binary trace starts with a struct trace_header, followed by
+ * num_fields struct trace_field entries that describe the fixed-size
+ * records, and by meta_len bytes of metadata text (the '#' lines of the
+ * CSV trace). Then come the records: record_size bytes of fields,
+ * followed by the physical addresses of the num_pages pages of the
+ * working set, as 64-bit values. Everything is in host byte order.
+ */
+
+#define TRACE_MAGIC "CPMDTRC"
+#define TRACE_VERSION 1
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;	/* offset of the first record */
+	uint32_t record_size;	/* fields only, without physical addresses */
+	uint32_t num_fields;
+	uint32_t num_pages;	/* physical addresses per record */
+	uint32_t page_size;
+	uint32_t meta_len;
+	uint32_t tsc_khz;	/* calibrated TSC frequency, 0 if unknown */
+};
+
+enum trace_field_type {
+	FIELD_I32 = 0,
+	FIELD_U64,
+};
+
+struct trace_field {
+	char name[16];
+	uint32_t type;
+	uint32_t offset;	/* within the record */
+	uint32_t width;		/* of the CSV column */
+	uint32_t reserved;
+};
+
+/* timed phases of a sample */
+enum trace_phase {
+	PHASE_COLD = 0,
+	PHASE_HOT1,
+	PHASE_HOT2,
+	PHASE_HOT3,
+	PHASE_CPMD,	/* after the preemption or migration */
+	NUM_PHASES
+};
+
+/* One sample of cache_cost. */
+struct trace_record {
+	uint64_t count;
+	int32_t write_cycle;
+	int32_t wss;
+	int32_t delay;
+	int32_t src;
+	int32_t tgt;
+	int32_t node;		/* home node of the working set */
+	uint64_t cold;
+	uint64_t hot1;
+	uint64_t hot2;
+	uint64_t hot3;
+	uint64_t after_resume;
+	uint64_t virt_addr;
+	int32_t numa;		/* NUMA_* flags */
+	int32_t numa_moved;	/* pages moved by NUMA balancing (anywhere)
+				 * during the sample */
+	/* cycles from release to acquisition of the working set (-X) */
+	uint64_t handoff;
+	/* performance counter deltas of each phase (-E) */
+	uint64_t perf[NUM_PHASES][NUM_PERF_SLOTS];
+};
+
+/* NUMA balancing moved pages (anywhere) during the sample */
+#define NUMA_BALANCED	0x1
+/* some pages are not on the requested node */
+#define NUMA_MISPLACED	0x2
+
+enum trace_format {
+	TRACE_CSV = 0,
+	TRACE_BINARY,
+};
+
+/* Output side of a trace. */
+struct trace {
+	FILE *file;
+	enum trace_format format;
+	unsigned long num_pages;
+	/* columns that are written */
+	struct trace_field *fields;
+	int num_fields;
+	uint32_t tsc_khz;		/* for the binary header */
+	/* if set, used to resolve physical addresses (by the writer thread) */
+	struct pagemap *pagemap;
+	unsigned long *phys_addrs;	/* scratch for address resolution */
+	uint64_t *phys_buf;
+	/* home node lookup */
+	int numa_node;			/* requested node, -1 if none */
+	int num_nodes;			/* of the machine */
+	void **pages;
+	int *nodes;
+};
+
+/* Returns 0 on success, -1 on allocation failure. */
+int trace_init(struct trace *trace, FILE *file, enum trace_format format,
+	       unsigned long num_pages);
+void trace_free(struct trace *trace);
+
+/* Add a column for a record member that is not written by default.
+ * Must be called before trace_write_header().
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int trace_add_field(struct trace *trace, const char *name,
+		    enum trace_field_type type, size_t offset, int width);
+
+/* Add a column for every phase and performance counter slot; names are
+ * those of the slots. Must be called before trace_write_header().
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int trace_add_counters(struct trace *trace, const char *const *names);
+
+/* meta: '#' lines written before the samples; may be NULL */
+int trace_write_header(struct trace *trace, const char *meta);
+
+/* Fill in rec->node (the node that holds most pages of the working set,
+ * -1 if unknown) and add NUMA_MISPLACED to rec->numa, from a few pages
+ * spread over it; node 0 without asking on single-node machines with no
+ * requested node. For the measuring thread, right after the sample: the
+ * working set may move later.
+ */
+void trace_resolve_nodes(struct trace *trace, struct trace_record *rec);
+
+/* Write one record. If phys is NULL, the physical addresses of the
+ * pages at rec->virt_addr are looked up in trace->pagemap, or else in
+ * /proc/self/pagemap.
+ * Returns 0 on success, -1 on I/O error.
+ */
+int trace_write(struct trace *trace, const struct trace_record *rec,
+		const uint64_t *phys);
+
+/* Reading binary traces */
+
+/* Reads and checks the header. *fields and *meta are malloc'd, meta
+ * is NUL-terminated. Returns 0 on success, -1 on error (errno is
+ * EINVAL if the file is not a trace of a supported version).
+ */
+int trace_read_header(FILE *file, struct trace_header *hdr,
+		      struct trace_field **fields, char **meta);
+
+/* Read the next record_size bytes of fields into rec, and num_pages
+ * physical addresses into phys. Returns 1 on success, 0 at the end of
+ * the trace and -1 on error.
+ */
+int trace_read(FILE *file, size_t record_size, unsigned long num_pages,
+	       void *rec, uint64_t *phys);
+
+/* CSV formatting of records described by a field table */
+void trace_print_columns(FILE *out, const struct trace_field *fields,
+			 int num_fields);
+void trace_print_csv(FILE *out, const struct trace_field *fields,
+		     int num_fields, const void *rec,
+		     const uint64_t *phys, unsigned long num_pages);
+
+/* Single-producer, single-consumer ring of records that a writer
+ * thread drains to a trace, so that formatting, address resolution and
+ * I/O do not happen between measurements.
+ */
+struct trace_writer {
+	struct trace *trace;
+	struct trace_record *ring;
+	unsigned long size;		/* power of two */
+	/* written by the producer only */
+	unsigned long head __attribute__ ((aligned(64)));
+	unsigned long stalls;		/* times the ring was full */
+	/* written by the writer thread only */
+	unsigned long tail __attribute__ ((aligned(64)));
+	int error;			/* errno of a failed write */
+	int stop;
+	pthread_t thread;
+};
+
+/* Start the writer thread with normal (non-real-time) priority.
+ * If cpu >= 0, the thread is pinned to it.
+ * Returns 0 on success, an error number otherwise.
+ */
+int trace_writer_start(struct trace_writer *writer, struct trace *trace,
+		       unsigned long size, int cpu);
+
+/* Get the next free slot, waiting for the writer thread if the ring is
+ * full. Fill it in and hand it over with trace_writer_commit().
+ */
+struct trace_record *trace_writer_reserve(struct trace_writer *writer);
+void trace_writer_commit(struct trace_writer *writer);
+
+/* Drain the ring and stop the writer thread.
+ * Returns 0, or the errno of the first failed write.
+ */
+int trace_writer_stop(struct trace_writer *writer);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+
+/* Serialized time stamp counter reads for timing code regions, and
+ * calibration of the TSC against CLOCK_MONOTONIC_RAW.
+ *
+ * A region is timed as
+ *	start = tsc_begin();  ...  stop = tsc_end();
+ * tsc_begin() lets earlier instructions finish before it reads the TSC
+ * and keeps the region from starting early; tsc_end() waits for the
+ * region to finish (rdtscp, or lfence if there is no rdtscp) and keeps
+ * later instructions from starting before the TSC is read.
+ */
+
+struct tsc_calibration {
+	double mhz;		/* TSC frequency */
+	uint64_t overhead;	/* cycles of an empty timed region (minimum) */
+	uint64_t jitter;	/* 99th percentile minus minimum of the same */
+	int invariant;		/* constant rate in all P-, C- and T-states */
+	int rdtscp;		/* tsc_end() uses rdtscp */
+};
+
+/* set by tsc_calibrate() */
+extern int tsc_have_rdtscp;
+
+/* Detect rdtscp, measure the TSC frequency (in about 100 ms) and the
+ * overhead of tsc_begin()/tsc_end(). Call before timing anything.
+ * Returns 0 on success, -1 if CLOCK_MONOTONIC_RAW is not available.
+ */
+int tsc_calibrate(struct tsc_calibration *cal);
+
+/* Calibrated TSC frequency; calibrates on the first call. */
+double tsc_mhz(void);
+
+/* cycles of a region, without the timing overhead */
+static inline uint64_t tsc_cycles(const struct tsc_calibration *cal,
+				  uint64_t start, uint64_t stop)
+{
+	uint64_t cycles = stop - start;
+
+	return cycles > cal->overhead ? cycles - cal->overhead : 0;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+
+static inline uint64_t tsc_begin(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("lfence\n\trdtsc\n\tlfence"
+			     : "=a" (lo), "=d" (hi) : : "memory");
+	return lo | ((uint64_t) hi << 32);
+}
+
+static inline uint64_t tsc_end(void)
+{
+	uint32_t lo, hi;
+
+	if (tsc_have_rdtscp)
+		__asm__ __volatile__("rdtscp\n\tlfence"
+				     : "=a" (lo), "=d" (hi) : : "ecx", "memory");
+	else
+		__asm__ __volatile__("lfence\n\trdtsc\n\tlfence"
+				     : "=a" (lo), "=d" (hi) : : "memory");
+	return lo | ((uint64_t) hi << 32);
+}
+
+#endif
+
+#endif
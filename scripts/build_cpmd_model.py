@@ -6,27 +6,104 @@ import subprocess
 from cpmd_util import *
 from cpmd_params import *
 
+def trace_name(wss, writecycle, sleep_min, sleep_max):
+    output_name = 'pmo_host=%s_wss=%s_wcycle=%s_smin=%s_smax=%s_pattern=%s' % (host, wss, writecycle, sleep_min, sleep_max, pattern)
+    if isa != 'scalar':
+        output_name += '_isa=%s' % isa
+    if backing != 'anon-4k':
+        output_name += '_backing=%s' % backing
+    if numa_placement:
+        output_name += '_numa=%s' % numa_placement.replace(':', '-')
+    if colors:
+        output_name += '_colors=%s' % colors.replace(':', '-')
+    if preemptor:
+        output_name += '_preempt=%s' % preemptor.replace(':', '-')
+    if handoff:
+        output_name += '_handoff'
+    return output_name + '.csv'
+
 def obtain_traces():
     create_dir(TRACES_DIR)
 
-    for wss in wss_values:
-        for writecycle in writecycle_values:
-            for (sleep_min, sleep_max) in sleep_values:
-                output_name = 'pmo_host=%s_wss=%d_wcycle=%d_smin=%d_smax=%d.csv' % (host, wss, writecycle, sleep_min, sleep_max)
-                cachecost_path = '%s -m%d -w%d -s%d -c%d -x%d -y%d -o %s' % (path.join(CPMD_DIR, 'cache_cost'), topo.cpus(), writecycle, wss, samples, sleep_min, sleep_max, path.join(TRACES_DIR, output_name))
-                if path.exists(path.join(TRACES_DIR, output_name)):
-                    print "Skipped: %s exists." % output_name
-                else:
-                    try:
-                        bg_tasks = start_background_tasks(topo.cpus())
-
-                        proc = subprocess.Popen(cachecost_path, shell=True, stdout=subprocess.PIPE)
-                        proc.wait()
-
-                        stop_background_tasks(bg_tasks)
-                    except OSError as (msg):
-                        raise OSError("Could not create trace '%s': %s" % (path.join(TRACES_DIR, output_name), msg))
-                    print 'Completed %s.' % output_name
+    configs = [(wss, writecycle, sleep_min, sleep_max)
+               for wss in (calibrated_wss_values() if calibrate_wss else wss_values)
+               for writecycle in writecycle_values
+               for (sleep_min, sleep_max) in sleep_values]
+    missing = []
+    for config in configs:
+        if path.exists(path.join(TRACES_DIR, trace_name(*config))):
+            print "Skipped: %s exists." % trace_name(*config)
+        else:
+            missing.append(config)
+    if not missing:
+        return
+
+    # One cache_cost process measures the matrix of the missing
+    # configurations, so that the arena, memory locking and the
+    # background tasks are set up only once. -u skips the traces of the
+    # matrix that exist already.
+    def values(column):
+        return ','.join(['%d' % v for v in sorted(set([c[column] for c in missing]))])
+    sleeps = sorted(set([(c[2], c[3]) for c in missing]))
+    trace_path = path.join(TRACES_DIR, trace_name('{wss}', '{wcycle}', '{smin}', '{smax}'))
+    if binary_trace:
+        trace_path = path.splitext(trace_path)[0] + '.bin'
+    # the spinning handoff threads leave the last CPU to the trace writer
+    measured_cpus = topo.cpus() - 1 if handoff else topo.cpus()
+    cachecost_path = "%s -m%d -s %s -w %s -x %s -y %s -c%d -a %s -k %s -M %s -u -o '%s'" % (path.join(CPMD_DIR, 'cache_cost'), measured_cpus, values(0), values(1), ','.join(['%d' % x for (x, y) in sleeps]), ','.join(['%d' % y for (x, y) in sleeps]), samples, pattern, isa, backing, trace_path)
+    if llc_campaign:
+        cachecost_path += ' -T'
+    if binary_trace:
+        cachecost_path += ' -B'
+    if numa_placement:
+        cachecost_path += ' -A %s' % numa_placement
+    if colors:
+        cachecost_path += ' -C %s' % colors
+    if perf_counters:
+        cachecost_path += ' -E'
+    if preemptor:
+        cachecost_path += ' -F %s' % preemptor
+    if polluter:
+        cachecost_path += ' -G %s' % polluter
+    if handoff:
+        cachecost_path += ' -X'
+    if coverage_file:
+        cachecost_path += ' -V %s' % coverage_file
+    elif stratified:
+        cachecost_path += ' -D'
+    if stop_rule:
+        cachecost_path += ' -Q %s' % stop_rule
+    if summary_file:
+        cachecost_path += ' -Y %s' % path.join(RESULTS_DIR, summary_file)
+        if summary_only:
+            cachecost_path += ' -z'
+
+    try:
+        bg_tasks = [] if polluter else start_background_tasks(topo.cpus())
+
+        proc = subprocess.Popen(cachecost_path, shell=True, stdout=subprocess.PIPE)
+        proc.wait()
+
+        stop_background_tasks(bg_tasks)
+    except OSError as (msg):
+        raise OSError("Could not run '%s': %s" % (cachecost_path, msg))
+
+    for config in missing:
+        output_name = trace_name(*config)
+        try:
+            if binary_trace:
+                trace_path = path.splitext(path.join(TRACES_DIR, output_name))[0] + '.bin'
+                subprocess.check_call([path.join(CPMD_DIR, 'trace2csv'), '-o', path.join(TRACES_DIR, output_name), trace_path])
+                remove(trace_path)
+        except (OSError, subprocess.CalledProcessError) as (msg):
+            raise OSError("Could not create trace '%s': %s" % (path.join(TRACES_DIR, output_name), msg))
+        print 'Completed %s.' % output_name
+
+    # traces of the matrix that were measured again, in binary
+    if binary_trace:
+        for name in listdir(TRACES_DIR):
+            if name.endswith('.bin'):
+                remove(path.join(TRACES_DIR, name))
 
 #
 # group_traces()
@@ -42,11 +119,25 @@ def group_traces():
     for wss in trace_files.keys():
         output_files = {}
         counter = {} # Number of samples in each output_file
+
+        # TSC frequency of the traces, passed on to the model
+        mhz = None
+        for trace_file in trace_files[wss]:
+            trace_mhz = trace_tsc_mhz(path.join(TRACES_DIR, trace_file))
+            if trace_mhz is None:
+                continue
+            if mhz is None:
+                mhz = trace_mhz
+            elif abs(trace_mhz - mhz) > mhz * 0.01:
+                print 'Warning: %s has a TSC frequency of %.3f MHz, not %.3f MHz.' % (trace_file, trace_mhz, mhz)
+
         for migtype in types_of_migration:
             output_name = 'pmo_host=%s_type=%s_wss=%s.csv' % (host, migtype, wss)
             try:
                 # Create a new file for each type of migration
                 output_files[migtype] = open(path.join(COMPLETED_DIR, output_name), 'w')
+                if mhz is not None:
+                    output_files[migtype].write('# tsc_mhz=%.3f\n' % mhz)
                 counter[migtype] = 0
             except IOError as (msg):
                 raise IOError("Could not write output file '%s': %s" % (path.join(COMPLETED_DIR, output_name), msg))
@@ -56,24 +147,47 @@ def group_traces():
             try:
                 f = open(path.join(TRACES_DIR, trace_file), 'r')
 
+                # Traces without NODE/NUMA columns predate NUMA support
+                node_col = None
+                numa_col = None
+                numa_moved = 0
+
                 line = f.readline()
                 while line:
+                    if not is_sample(line): # Header, metadata or warnings
+                        columns = trace_columns(line)
+                        if columns and 'NODE' in columns:
+                            node_col = columns.index('NODE')
+                            numa_col = columns.index('NUMA')
+                        line = f.readline()
+                        continue
+
                     splitted_line = line.split(',')
                     splitted_line = [x.strip() for x in splitted_line]
 
+                    # NUMA balancing moved pages: not a clean sample
+                    if numa_col is not None and int(splitted_line[numa_col]) & 1:
+                        numa_moved += 1
+                        line = f.readline()
+                        continue
+
                     source_cpu = int(splitted_line[4].strip())
                     dest_cpu = int(splitted_line[5].strip())
-                    line_migtype = topo.migrationType(source_cpu, dest_cpu)
+                    home_node = int(splitted_line[node_col]) if node_col is not None else None
+                    line_migtype = topo.migrationType(source_cpu, dest_cpu, home_node)
 
                     counter[line_migtype] += 1
                     splitted_line[0] = str(counter[line_migtype]) # Modify number of the line
 
-                    output_line = '%6s, %3s, %6s, %6s, %3s, %3s, %8s, %8s, %8s, %8s, %8s\n' % tuple(splitted_line)
+                    # Drop the address columns
+                    output_line = '%6s, %3s, %6s, %6s, %3s, %3s, %8s, %8s, %8s, %8s, %8s\n' % tuple(splitted_line[:11])
 
                     output_files[line_migtype].write(output_line) # Write in the file of this migration type
 
                     line = f.readline()
                 f.close()
+                if numa_moved > 0:
+                    print 'Skipped %d sample(s) of %s after NUMA balancing page moves.' % (numa_moved, trace_file)
             except IOError as (msg):
                 raise IOError("Could not read trace file '%s': %s" % (path.join(TRACES_DIR, trace_file), msg))
 
@@ -95,9 +209,16 @@ def remove_outliers_and_create_model():
                 f = open(path.join(COMPLETED_DIR, trace_files[migtype][wss]), 'r')
 
                 seq = []
+                mhz = CLOCK
 
                 line = f.readline()
                 while line:
+                    if line.startswith('#'):
+                        if line.startswith('# tsc_mhz=') and CLOCK is None:
+                            mhz = float(line.split('=')[1])
+                        line = f.readline()
+                        continue
+
                     splitted_line = line.split(',')
                     splitted_line = [x.strip() for x in splitted_line]
 
@@ -115,6 +236,9 @@ def remove_outliers_and_create_model():
             except IOError as (msg):
                 raise IOError("Could not read trace file '%s': %s" % (path.join(COMPLETED_DIR, trace_file), msg))
 
+            if mhz is None:
+                raise ValueError("Unknown TSC frequency of '%s': set CLOCK in cpmd_params.py" % trace_files[migtype][wss])
+
             seq.sort()
 
             # Remove outliers
@@ -128,29 +252,96 @@ def remove_outliers_and_create_model():
             output['wss'] = wss
             output['number_of_samples'] = samples
             output['number_of_filtered_samples'] = filtered_samples
-            output['maximum_overhead'] = cycles_to_ms(numpy.max(seq))
-            output['average_overhead'] = cycles_to_ms(numpy.mean(seq))
-            output['minimum_overhead'] = cycles_to_ms(numpy.min(seq))
-            output['median_overhead'] = cycles_to_ms(numpy.median(seq))
-            output['standard_deviation'] = cycles_to_ms(numpy.std(seq))
-            output['variance'] = cycles_to_ms(cycles_to_ms(numpy.var(seq)))
-            output['maximum_cutoff'] = cycles_to_ms(maxcutoff)
-            output['minimum_cutoff'] = cycles_to_ms(mincutoff)
-
-            outputfile.write('%s\t%d\t%d\t%d\t%.12e\t%.12e\t%.12e\t%.12e' +
-                             '\t%.12e\t%.12e\t%.12e\t%.12e\n'
-                             % (output['type'],
-                                int(output['wss']),
-                                output['number_of_samples'],
-                                output['number_of_filtered_samples'],
-                                output['maximum_overhead'],
-                                output['average_overhead'],
-                                output['minimum_overhead'],
-                                output['median_overhead'],
-                                output['standard_deviation'],
-                                output['variance'],
-                                output['maximum_cutoff'],
-                                output['minimum_cutoff']))
+            output['maximum_overhead'] = cycles_to_ms(numpy.max(seq), mhz)
+            output['average_overhead'] = cycles_to_ms(numpy.mean(seq), mhz)
+            output['minimum_overhead'] = cycles_to_ms(numpy.min(seq), mhz)
+            output['median_overhead'] = cycles_to_ms(numpy.median(seq), mhz)
+            output['standard_deviation'] = cycles_to_ms(numpy.std(seq), mhz)
+            output['variance'] = cycles_to_ms(cycles_to_ms(numpy.var(seq), mhz), mhz)
+            output['maximum_cutoff'] = cycles_to_ms(maxcutoff, mhz)
+            output['minimum_cutoff'] = cycles_to_ms(mincutoff, mhz)
+
+            write_model_line(outputfile, output)
+
+        outputfile.close()
+
+def write_model_line(outputfile, output):
+    outputfile.write('%s\t%d\t%d\t%d\t%.12e\t%.12e\t%.12e\t%.12e'
+                     '\t%.12e\t%.12e\t%.12e\t%.12e\n'
+                     % (output['type'],
+                        int(output['wss']),
+                        output['number_of_samples'],
+                        output['number_of_filtered_samples'],
+                        output['maximum_overhead'],
+                        output['average_overhead'],
+                        output['minimum_overhead'],
+                        output['median_overhead'],
+                        output['standard_deviation'],
+                        output['variance'],
+                        output['maximum_cutoff'],
+                        output['minimum_cutoff']))
+
+#
+# create_model_from_summary()
+# Same model, but from the CPMD histograms of a cache_cost summary
+# (summary_only): the migration types are cache_cost's classes and the
+# statistics are exact to the width of a bucket (~3%)
+#
+def create_model_from_summary():
+    create_dir(MODEL_DIR)
+
+    fname = path.join(RESULTS_DIR, summary_file)
+    try:
+        (mhz, summary) = read_summary(fname)
+    except (IOError, ValueError, IndexError) as (msg):
+        raise IOError("Could not read summary '%s': %s" % (fname, msg))
+    if CLOCK is not None:
+        mhz = CLOCK
+    if mhz is None:
+        raise ValueError("Unknown TSC frequency of '%s': set CLOCK in cpmd_params.py" % fname)
+
+    migtypes = sorted(set([c for wss in summary.keys() for c in summary[wss].keys()]))
+    for migtype in migtypes:
+        outputfile = open(path.join(MODEL_DIR, 'model_type=%s' % migtype), 'w')
+
+        for wss in sorted(summary.keys()):
+            if not summary[wss].has_key(migtype):
+                continue
+            stats = summary[wss][migtype]['CPMD']
+            hist = stats['hist']
+
+            # Remove outliers
+            q1 = hist_quantile(hist, 0.25)
+            q3 = hist_quantile(hist, 0.75)
+            iqr = q3 - q1
+            mincutoff = q1 - 1.5*iqr
+            maxcutoff = q3 + 1.5*iqr
+            # bucket values within the observed range; negative
+            # samples are in bucket 0
+            kept = dict([(min(max(low, stats['min']), stats['max']), count)
+                         for (low, count) in hist.items()
+                         if mincutoff <= low <= maxcutoff])
+            values = numpy.array(kept.keys(), dtype=float)
+            counts = numpy.array(kept.values(), dtype=float)
+            mean = numpy.average(values, weights=counts)
+            var = numpy.average((values - mean)**2, weights=counts)
+
+            output = {}
+
+            output['type'] = migtype
+            output['wss'] = wss
+            output['number_of_samples'] = stats['n']
+            output['number_of_filtered_samples'] = int(counts.sum())
+            output['maximum_overhead'] = cycles_to_ms(values.max(), mhz)
+            output['average_overhead'] = cycles_to_ms(mean, mhz)
+            output['minimum_overhead'] = cycles_to_ms(values.min(), mhz)
+            output['median_overhead'] = cycles_to_ms(hist_quantile(kept, 0.5), mhz)
+            output['standard_deviation'] = cycles_to_ms(numpy.sqrt(var), mhz)
+            output['variance'] = cycles_to_ms(cycles_to_ms(var, mhz), mhz)
+            output['maximum_cutoff'] = cycles_to_ms(maxcutoff, mhz)
+            output['minimum_cutoff'] = cycles_to_ms(mincutoff, mhz)
+
+            write_model_line(outputfile, output)
 
         outputfile.close()
 
@@ -158,5 +349,8 @@ if __name__ == '__main__':
     random.seed()
 
     obtain_traces()
-    group_traces()
-    remove_outliers_and_create_model()
+    if summary_only:
+        create_model_from_summary()
+    else:
+        group_traces()
+        remove_outliers_and_create_model()
@@ -11,6 +11,7 @@ class CacheTopology:
     def __init__(self, topology_file = None):
         if topology_file == None:
             self._collectTopology()
+            self._collectNumaTopology()
         else:
             self._collectTopologyFromFile(topology_file)
         self._createMigrationTable()
@@ -23,15 +24,21 @@ class CacheTopology:
         """CacheTopology.saveTopology(topology_file): Saves cache topology object to a file."""
         try:
             f = open(topology_file, 'w')
-            pickle.dump(self._cache_topology, f, 0)
+            pickle.dump({'caches': self._cache_topology,
+                         'node_of_cpu': self._node_of_cpu,
+                         'node_distance': self._node_distance}, f, 0)
         except IOError as (msg):
             raise IOError("Could not write topology file '%s': %s" % topology_file, msg)
 
-    def migrationType(self, source_cpu, dest_cpu):
-        """CacheTopology.migrationType(source_cpu, dest_cpu): Returns
+    def migrationType(self, source_cpu, dest_cpu, home_node = None):
+        """CacheTopology.migrationType(source_cpu, dest_cpu, home_node): Returns
            the memory level associated with the migration from
            source_cpu to dest_cpu. For example:
-           (0,1) -> 'L3', (0,0) -> 'PREEMPTION'."""
+           (0,1) -> 'L3', (0,0) -> 'PREEMPTION'.
+           If the processors don't share a cache and home_node (the NUMA
+           node of the working set) is given, the class depends on the
+           distance from dest_cpu to the data: 'MEMORY' if it is local,
+           'MEMORY-<distance>' otherwise, e.g. 'MEMORY-21'."""
 
         if source_cpu == dest_cpu:
             return 'PREEMPTION'
@@ -40,7 +47,27 @@ class CacheTopology:
                 if self._inCpuList(dest_cpu, self._cache_topology[source_cpu][cache_index]['shared_cpu_list']):
                     return 'L%s' % self._cache_topology[source_cpu][cache_index]['level']
 
-            return 'MEMORY' # The processors don't communicate via cache, they use memory
+            # The processors don't communicate via cache, they use memory
+            return self._memoryType(dest_cpu, home_node)
+
+    def nodeOfCpu(self, cpu):
+        """CacheTopology.nodeOfCpu(cpu): Returns the NUMA node of cpu."""
+        return self._node_of_cpu[cpu]
+
+    def nodeDistance(self, from_node, to_node):
+        """CacheTopology.nodeDistance(from_node, to_node): Returns the
+           NUMA distance between two nodes (10 means local)."""
+        return self._node_distance[from_node][to_node]
+
+    def remoteDistances(self):
+        """CacheTopology.remoteDistances(): Returns the sorted list of
+           distinct distances between different NUMA nodes."""
+        distances = set()
+        for node in range(len(self._node_distance)):
+            for other in range(len(self._node_distance)):
+                if self._node_distance[node][other] != self._node_distance[node][node]:
+                    distances.add(self._node_distance[node][other])
+        return sorted(distances)
 
     def migrationTable(self):
         """CacheTopology.migrationTable(): Return a processor->cache->other_processors correspondence in the following format:
@@ -50,7 +77,19 @@ class CacheTopology:
     def migrationTypes(self):
         """CacheTopology.migrationTypes(): Returns a list with the types of migration of this architecture (minimal set)
            Assumes every processor can do to all types of migration"""
-        return [x for x in self._migration_table[0].keys() if len(self._migration_table[0][x]) > 0]
+        types = [x for x in self._migration_table[0].keys() if len(self._migration_table[0][x]) > 0]
+        if 'MEMORY' in types:
+            types += ['MEMORY-%d' % d for d in self.remoteDistances()]
+        return types
+
+    def _memoryType(self, cpu, home_node):
+        if home_node is None or home_node < 0 or home_node >= len(self._node_distance):
+            return 'MEMORY'
+        node = self._node_of_cpu[cpu]
+        distance = self._node_distance[node][home_node]
+        if distance == self._node_distance[node][node]:
+            return 'MEMORY'
+        return 'MEMORY-%d' % distance
 
     def _createMigrationTable(self):
         # Create migration table
@@ -100,15 +139,54 @@ class CacheTopology:
         except Exception as (msg):
             raise Exception(msg)
 
+    def _collectNumaTopology(self):
+        # Without /sys/devices/system/node, everything is one node
+        self._node_of_cpu = [0 for x in range(self._cpus)]
+        self._node_distance = [[10]]
+
+        node_dir = '/sys/devices/system/node'
+        if not os.path.exists(node_dir):
+            return
+        nodes = [int(x[4:]) for x in os.listdir(node_dir) if x.startswith('node') and x[4:].isdigit()]
+        if len(nodes) == 0:
+            return
+
+        self._node_distance = [[10 if x == y else -1 for y in range(max(nodes) + 1)] for x in range(max(nodes) + 1)]
+        try:
+            for node in nodes:
+                f = open(os.path.join(node_dir, 'node%d' % node, 'distance'), 'r')
+                self._node_distance[node] = [int(x) for x in f.read().split()]
+                f.close()
+
+                f = open(os.path.join(node_dir, 'node%d' % node, 'cpulist'), 'r')
+                cpu_list = f.read().strip()
+                f.close()
+                if cpu_list:
+                    for cpu in range(self._cpus):
+                        if self._inCpuList(cpu, cpu_list):
+                            self._node_of_cpu[cpu] = node
+        except IOError as (msg):
+            raise IOError("Could not read NUMA topology: %s" % msg)
+
     def _collectTopologyFromFile(self, topology_file):
         try:
             f = open(topology_file, 'r')
-            self._cache_topology = pickle.load(f)
+            topology = pickle.load(f)
             f.close()
         except IOError as (msg):
             raise IOError("Could not read topology file '%s': %s" % topology_file, msg)
 
-        self._cpus = len(self._cache_topology)
+        if isinstance(topology, dict):
+            self._cache_topology = topology['caches']
+            self._cpus = len(self._cache_topology)
+            self._node_of_cpu = topology['node_of_cpu']
+            self._node_distance = topology['node_distance']
+        else:
+            # Saved before NUMA support: a single node
+            self._cache_topology = topology
+            self._cpus = len(self._cache_topology)
+            self._node_of_cpu = [0 for x in range(self._cpus)]
+            self._node_distance = [[10]]
 
     def _inCpuList(self, cpu, cpu_list):
         # cpu_list example: 1,2-4,8,10
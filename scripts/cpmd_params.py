@@ -3,12 +3,76 @@ from cachetopology import *
 # Parameters
 CPMD_DIR = '..'
 
-CLOCK = 2266.0 # MHz
+CLOCK = None # MHz; None: the TSC frequency recorded in the traces
 host = 'litmus'
 
 wss_values = [2**x for x in range(0,10)]
+# Measure the WSS values with cache_calib instead (powers of two plus
+# points around each cache size it finds), once per results directory
+calibrate_wss = False
 writecycle_values = [2,3,4,5]
 sleep_values = [(0,1000)]
-samples = 4
+pattern = 'seq' # seq, stride, random or chase (cache_cost -a)
+isa = 'scalar' # scalar, sse2, avx2, avx512 or auto (cache_cost -k)
+backing = 'anon-4k' # anon-4k, thp, hugetlb-2m, hugetlb-1g, shm or file (cache_cost -M)
+samples = 4 # per migration type; an upper bound if stop_rule is set
+
+# Stop sampling a configuration once the CPMD statistic of every
+# migration type is known to within a relative width (cache_cost -Q):
+# None (always take 'samples' samples), e.g. 'p99:0.05', 'mean:0.02'
+# or 'max:0.05'
+stop_rule = None
+
+# Measure each LLC domain in parallel (cache_cost -T)
+llc_campaign = False
+
+# NUMA node of the working sets (cache_cost -A): None (don't care),
+# e.g. '1' (bind to node 1) or 'touch:1' (first touch from node 1)
+numa_placement = None
+
+# LLC page colors of the working sets (cache_cost -C): None (any page),
+# e.g. '0-7' or, with an explicit number of colors, '32:0-7'
+colors = None
+
+# Footprint (KB) of a higher-priority preemptor that runs during each
+# sleep (cache_cost -F): None, e.g. '512' or '512:random:2' (footprint,
+# access pattern, write cycle). Vary it to obtain CPMD as a function of
+# the preemptor footprint.
+preemptor = None
+
+# Background load on the CPUs that do not measure: None (one unpinned
+# memthrash process per CPU) or cache_cost's own pinned polluter threads
+# (cache_cost -G), e.g. '8192:random:2:2000' (footprint in KB, access
+# pattern, write cycle, MB/s per thread; 0 MB/s is unthrottled). Their
+# achieved bandwidth is recorded in the traces (# polluter_mbps).
+polluter = None
+
+# Migrate by handing the working set between threads pinned to each CPU
+# instead of calling sched_setaffinity() (cache_cost -X); the handoff
+# latency is recorded in the HANDOFF column. The last CPU is then not
+# measured: it runs the trace writer
+handoff = False
+
+# Pick CPU pairs by migration class so that rare classes (e.g., shared
+# L2) get as many samples as common ones (cache_cost -D); samples is
+# then per class. coverage_file keeps per-pair counts across runs
+# (cache_cost -V), e.g. 'coverage.txt'
+stratified = False
+coverage_file = None
+
+# Keep streaming statistics and histograms of the samples of each
+# working set size and migration class in a file (cache_cost -Y), e.g.
+# 'summary.txt' (under the results directory). It accumulates across
+# runs. With summary_only, cache_cost records no samples at all and the
+# model is built from the histograms (cache_cost -z).
+summary_file = None
+summary_only = False
+
+# Record LLC misses, dTLB misses, instructions and reference cycles of
+# each timed phase (cache_cost -E)
+perf_counters = False
+
+# Let cache_cost write binary traces (-B), converted to CSV by trace2csv
+binary_trace = False
 
 topo = CacheTopology()
@@ -25,6 +25,31 @@ def decode(name):
         params[k] = v
     return params
 
+def is_sample(line):
+    # cache_cost traces also contain '#' metadata/header lines and warnings
+    fields = line.split(',')
+    return len(fields) > 1 and fields[0].strip().isdigit()
+
+def trace_columns(line):
+    # Column names if line is the column header of a cache_cost trace
+    # ('# COUNT, WCYCLE, ...'), otherwise None
+    if not line.startswith('#') or 'COUNT' not in line:
+        return None
+    return [x.strip() for x in line.lstrip('#').split(',')]
+
+def trace_tsc_mhz(fname):
+    # TSC frequency that cache_cost calibrated ('# tsc_mhz=...'), or None
+    f = open(fname, 'r')
+    try:
+        for line in f:
+            if is_sample(line):
+                break
+            if line.startswith('# tsc_mhz='):
+                return float(line.split('=')[1])
+    finally:
+        f.close()
+    return None
+
 def get_config(fname):
     return path.splitext(path.basename(fname))[0]
 
@@ -119,5 +144,96 @@ def stop_background_tasks(bg_tasks):
     for t in bg_tasks:
         t.wait()
 
-def cycles_to_ms(c):
-    return c / (CLOCK * 1000.0)
+def calibrated_wss_values():
+    # WSS grid of cache_calib, dense around the measured cache sizes.
+    # It is measured once and kept in the results directory.
+    grid_file = path.join(RESULTS_DIR, 'wss_grid')
+    if not path.exists(grid_file):
+        create_dir(RESULTS_DIR)
+        calib_path = path.join(CPMD_DIR, 'cache_calib')
+        try:
+            grid = subprocess.Popen([calib_path, '-g'], stdout=subprocess.PIPE).communicate()[0]
+        except OSError as (msg):
+            raise OSError("Could not run '%s': %s" % (calib_path, msg))
+        if not grid.strip():
+            raise ValueError("'%s -g' did not print a WSS grid" % calib_path)
+        f = open(grid_file, 'w')
+        f.write(grid)
+        f.close()
+    f = open(grid_file, 'r')
+    try:
+        return [int(x) for x in f.read().strip().split(',')]
+    finally:
+        f.close()
+
+# Histograms of cache_cost summaries (-Y): see include/summary.h
+def hist_bucket_low(bucket, sub_bits = 6):
+    sub = 1 << sub_bits
+    half = sub / 2
+    if bucket < sub:
+        return bucket
+    shift = (bucket - sub) / half + 1
+    return ((bucket - sub) % half + half) << shift
+
+def merge_stats(a, b):
+    # Pool two stats dicts of read_summary() exactly (as summary_merge())
+    n = a['n'] + b['n']
+    if not a['n'] or not b['n']:
+        return a if a['n'] else b
+    delta = b['mean'] - a['mean']
+    hist = dict(a['hist'])
+    for (low, count) in b['hist'].items():
+        hist[low] = hist.get(low, 0) + count
+    return {'n': n, 'min': min(a['min'], b['min']),
+            'max': max(a['max'], b['max']),
+            'mean': a['mean'] + delta * b['n'] / n,
+            'm2': a['m2'] + b['m2'] + delta * delta * (float(a['n']) * b['n'] / n),
+            'hist': hist}
+
+def read_summary(fname):
+    # Returns (tsc_mhz, {wss: {class: {series: stats}}}); stats has the
+    # keys n, min, max, mean, m2 and hist (bucket -> count). Entries of
+    # the same WSS (other write cycles, sleeps or access patterns) are
+    # pooled, as the traces of a WSS are.
+    mhz = None
+    sub_bits = 6
+    summary = {}
+    f = open(fname, 'r')
+    try:
+        for line in f:
+            if line.startswith('# tsc_mhz='):
+                mhz = float(line.split('=')[1])
+            elif line.startswith('# hist_sub_bits='):
+                sub_bits = int(line.split('=')[1])
+            if line.startswith('#') or not line.strip():
+                continue
+            # WSS WCYCLE SMIN SMAX PATTERN CLASS SERIES N MIN MAX MEAN M2 ...
+            fields = line.split()
+            hist = {}
+            for x in fields[12:]:
+                (b, c) = x.split(':')
+                hist[hist_bucket_low(int(b), sub_bits)] = int(c)
+            stats = {'n': int(fields[7]), 'min': int(fields[8]),
+                     'max': int(fields[9]), 'mean': float(fields[10]),
+                     'm2': float(fields[11]), 'hist': hist}
+            series = summary.setdefault(int(fields[0]), {}).setdefault(fields[5], {})
+            if series.has_key(fields[6]):
+                stats = merge_stats(series[fields[6]], stats)
+            series[fields[6]] = stats
+    finally:
+        f.close()
+    return (mhz, summary)
+
+def hist_quantile(hist, p):
+    # Lower bound of the bucket that holds the p-quantile;
+    # hist maps the lower bound of each bucket to its count
+    total = sum(hist.values())
+    seen = 0
+    for low in sorted(hist.keys()):
+        seen += hist[low]
+        if seen >= p * total:
+            return low
+    return None
+
+def cycles_to_ms(c, mhz):
+    return c / (mhz * 1000.0)